@@ -59,6 +59,7 @@ module ContextHandleGLExtensions =
 type ContextHandle(handle : IGraphicsContext, window : IWindowInfo) =
     static let current = new ThreadLocal<ValueOption<ContextHandle>>(fun () -> ValueOption.None)
     static let contextError = new Event<ContextErrorEventHandler, ContextErrorEventArgs>()
+    static let lastVMContext = ref 0L
 
     let l = obj()
     let onDisposed = Event<unit>()
@@ -67,6 +68,9 @@ type ContextHandle(handle : IGraphicsContext, window : IWindowInfo) =
     let mutable onMakeCurrent : ConcurrentHashSet<unit -> unit> = null
     let mutable driverInfo = None
 
+    // key of the context in the GLVM caches, unlike the address of the native context it is never reused
+    let vmContext = nativeint (Interlocked.Increment(&lastVMContext.contents))
+
     static member Current
         with get() =
             let curr = current.Value
@@ -96,6 +100,9 @@ type ContextHandle(handle : IGraphicsContext, window : IWindowInfo) =
 
     member x.Handle = handle
 
+    /// Unique key identifying the context in the GLVM caches.
+    member x.VMContext = vmContext
+
     member x.Driver =
         match driverInfo with
         | None ->
@@ -138,13 +145,17 @@ type ContextHandle(handle : IGraphicsContext, window : IWindowInfo) =
 
         ContextHandle.Current <- ValueSome x
 
-        GLVM.hglCleanup((unbox<IGraphicsContextInternal> handle).Context.Handle)
+        // activate the GLVM state cache of the context for the helpers called on this thread
+        GLVM.hglMakeCurrent(vmContext)
+        GLVM.hglCleanup(vmContext)
         let actions = Interlocked.Exchange(&onMakeCurrent, null)
         if notNull actions then
             for a in actions do
                 a()
 
     member x.ReleaseCurrent() =
+        GLVM.hglMakeCurrent(0n)
+
         if handle.IsCurrent then
             handle.MakeCurrent(null)
         else
@@ -181,6 +192,9 @@ type ContextHandle(handle : IGraphicsContext, window : IWindowInfo) =
             if setDefaultStates then
                 GL.SetDefaultStates()
 
+            // share format-only VAOs between vertex input bindings if supported
+            GLVM.hglUseSeparateVertexFormats(vmContext, if GL.ARB_vertex_attrib_binding then 1 else 0) |> ignore
+
             debugOutput <-
                 if debug.DebugOutput.IsNone && not debug.DebugLabels then None
                 else
@@ -244,9 +258,9 @@ type ContextHandle(handle : IGraphicsContext, window : IWindowInfo) =
             if lockTaken then
                 if not isDisposed then
 
-                    // release potentially pending UnsharedObjects
+                    // release potentially pending UnsharedObjects and the VAOs/state cached for the context
                     x.Use(fun () -> 
-                        GLVM.hglCleanup((unbox<IGraphicsContextInternal> handle).Context.Handle)
+                        GLVM.hglDeleteContextCache(vmContext)
                     
                         let actions = Interlocked.Exchange(&onMakeCurrent, null)
                         if notNull actions then
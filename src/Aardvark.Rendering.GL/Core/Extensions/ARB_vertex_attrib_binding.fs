@@ -0,0 +1,10 @@
+﻿namespace Aardvark.Rendering.GL
+
+open System
+
+[<AutoOpen>]
+module ARB_vertex_attrib_binding =
+
+    type GL private() =
+        static let supported = ExtensionHelpers.isSupported (Version(4, 3)) "GL_ARB_vertex_attrib_binding"
+        static member ARB_vertex_attrib_binding = supported
@@ -19,6 +19,15 @@ type VMStats =
         val mutable public RemovedInstructions : int
     end
 
+type VertexArrayPoolStats =
+    struct
+        val mutable public Hits : int
+        val mutable public Misses : int
+        val mutable public Recycled : int
+        val mutable public Deleted : int
+        val mutable public Pooled : int
+    end
+
 module GLVM =
     open System.Runtime.InteropServices
     open System.Runtime.CompilerServices
@@ -30,9 +39,48 @@ module GLVM =
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern void hglCleanup(void* ctx)
 
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglCleanupAll(void* ctx)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglDeleteContextCache(void* ctx)
+
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern void hglDeleteVAO(void* ctx, int vao)
 
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglInvalidateBuffer(int buffer)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglSetCleanupBudget(int maxDeletions)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglSetVertexArrayPoolCapacity(int capacity)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglGetVertexArrayPoolStats(void* ctx, VertexArrayPoolStats& stats)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern int hglUseSeparateVertexFormats(void* ctx, int enable)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglMakeCurrent(void* ctx)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglResetState(void* ctx)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglDeleteState(void* ctx)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern nativeint hglCreateUniformRing(nativeint segmentSize)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglDeleteUniformRing(nativeint ring)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void hglUniformRingNextFrame(nativeint ring)
+
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern void vmInit()
 
@@ -54,6 +102,12 @@ module GLVM =
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern void vmUnlink(FragmentPtr left)
 
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void vmInsertAfter(FragmentPtr left, FragmentPtr first, FragmentPtr last)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void vmRemoveAfter(FragmentPtr left, FragmentPtr last)
+
 
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern int vmNewBlock(FragmentPtr left)
@@ -82,9 +136,30 @@ module GLVM =
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern void vmClear(FragmentPtr frag)
 
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void vmCommit(FragmentPtr frag)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void vmReclaim()
+
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern void vmRunSingle(FragmentPtr frag)
 
     [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
     extern void vmRun(FragmentPtr frag, VMMode mode, VMStats& stats)
 
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern int vmCapture(string path, FragmentPtr frag)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern nativeint vmLoadCapture(string path, nativeint context)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void vmReplayCapture(nativeint capture, VMMode mode, VMStats& stats)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void vmVisitCapture(nativeint capture, nativeint visit, nativeint userData)
+
+    [<DllImport(lib, CallingConvention = CallingConvention.Cdecl); SuppressUnmanagedCodeSecurity>]
+    extern void vmDeleteCapture(nativeint capture)
+
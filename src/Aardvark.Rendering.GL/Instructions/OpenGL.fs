@@ -744,6 +744,9 @@ module OpenGl =
 
         let HBindTextures = getGLVMProcAddress "hglBindTextures"
         let HBindSamplers = getGLVMProcAddress "hglBindSamplers"
+        let HUploadUniformBlocks = getGLVMProcAddress "hglUploadUniformBlocks"
+        let HUniformRingNextFrame = getGLVMProcAddress "hglUniformRingNextFrame"
+        let HSetVertexAttribValues = getGLVMProcAddress "hglSetVertexAttribValues"
 
 
 
@@ -822,6 +825,9 @@ module OpenGl =
               HBindVertexAttributes, "hglBindVertexAttributes"
               HBindTextures, "hglBindTextures"
               HBindSamplers, "hglBindSamplers"
+              HUploadUniformBlocks, "hglUploadUniformBlocks"
+              HUniformRingNextFrame, "hglUniformRingNextFrame"
+              HSetVertexAttribValues, "hglSetVertexAttribValues"
 
             ] |> Map.ofList
 
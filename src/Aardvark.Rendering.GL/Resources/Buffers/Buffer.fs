@@ -51,6 +51,8 @@ type Buffer =
 
         member x.Dispose() =
             using x.Context.ResourceLock (fun _ ->
+                // VAOs capturing the buffer must not be shared anymore, its name may be reused
+                GLVM.hglInvalidateBuffer x.Handle
                 x.Destroy()
 
                 ResourceCounts.removeBuffer x.Context (int64 x.SizeInBytes)
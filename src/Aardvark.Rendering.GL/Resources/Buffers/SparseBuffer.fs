@@ -29,6 +29,7 @@ type SparseBuffer(ctx : Context, size : nativeint, handle : int, beforeRender :
     member x.Dispose() =
         use __ = ctx.ResourceLock
         x.Release()
+        GLVM.hglInvalidateBuffer handle
         GL.DeleteBuffer(handle)
         GL.Check "could not delete buffer"
 
@@ -79,8 +79,15 @@ module RenderTasks =
         do NativePtr.write contextHandle 0n
 
         let writeCurrentContextHandle() =
-            let ctx = ContextHandle.Current.Value.Handle |> unbox<OpenTK.Graphics.IGraphicsContextInternal>
-            NativePtr.write contextHandle ctx.Context.Handle
+            let ctx = ContextHandle.Current.Value.VMContext
+            NativePtr.write contextHandle ctx
+
+            // other tasks and user code may have changed GL state behind the back of the
+            // GLVM state cache since the last run
+            GLVM.hglResetState ctx
+
+        // uniform ring of the task, created on first use and advanced once per frame
+        let mutable uniformRing = 0n
 
         let scope =
             {
@@ -103,10 +110,24 @@ module RenderTasks =
         member x.RenderTaskLock = renderTaskLock
         member x.ResourceManager = manager
 
+        /// The persistently mapped uniform ring of the task (0n if not supported), needs a current context.
+        member x.UniformRing =
+            if uniformRing = 0n then
+                uniformRing <- GLVM.hglCreateUniformRing(AbstractOpenGlRenderTask.UniformRingSegmentSize)
+            uniformRing
+
+        /// Size of one segment of the uniform ring of a task.
+        static member val UniformRingSegmentSize = 1n <<< 20 with get, set
+
         override x.Runtime = Some ctx.Runtime
         override x.FramebufferSignature = Some signature
 
         override x.Release() =
+            if uniformRing <> 0n then
+                use __ = ctx.ResourceLock
+                GLVM.hglDeleteUniformRing uniformRing
+                uniformRing <- 0n
+
             contextHandle |> NativePtr.free
             runtimeStats |> NativePtr.free
             resources.Dispose()
@@ -150,6 +171,10 @@ module RenderTasks =
 
                     let rt = NativePtr.read runtimeStats
                     renderToken.AddDrawCalls(rt.X, rt.Y)
+
+                    // fence the segment written by this frame and move on to the next one
+                    if uniformRing <> 0n then
+                        GLVM.hglUniformRingNextFrame uniformRing
                 )
 
                 GL.BindVertexArray 0
@@ -1,6 +1,7 @@
 ﻿namespace Aardvark.Rendering.Vulkan
 
 open System
+open System.Collections.Generic
 open System.Runtime.InteropServices
 open System.Runtime.CompilerServices
 open Aardvark.Base
@@ -19,7 +20,10 @@ module IndirectCommands =
             val mutable Handle : VkBuffer
             val mutable Offset : uint64
             val mutable Stride : int
-            new (handle, offset, stride) = { Handle = handle; Offset = offset; Stride = stride }
+            val mutable CountHandle : VkBuffer
+            val mutable CountOffset : uint64
+            new (handle, offset, stride) = { Handle = handle; Offset = offset; Stride = stride; CountHandle = VkBuffer.Null; CountOffset = 0UL }
+            new (handle, offset, stride, countHandle, countOffset) = { Handle = handle; Offset = offset; Stride = stride; CountHandle = countHandle; CountOffset = countOffset }
         end
 
     [<StructLayout(LayoutKind.Explicit)>]
@@ -27,6 +31,7 @@ module IndirectCommands =
         struct
             [<FieldOffset(0)>] val mutable public IsIndirect     : uint8
             [<FieldOffset(1)>] val mutable public IsIndexed      : uint8
+            [<FieldOffset(2)>] val mutable public HasCount       : uint8
             [<FieldOffset(4)>] val mutable public Count          : int
             [<FieldOffset(8)>] val mutable public DrawCalls      : nativeptr<DrawCallInfo>
             [<FieldOffset(8)>] val mutable public DrawCallBuffer : DrawCallBuffer
@@ -48,6 +53,16 @@ module IndirectCommands =
                 dc.DrawCallBuffer <- DrawCallBuffer(buffer, offset, stride)
                 dc
 
+            // indirect draw reading the number of draws (at most maxCount) from countBuffer at countOffset.
+            static member IndirectCount(buffer: VkBuffer, offset: uint64, stride: int, countBuffer: VkBuffer, countOffset: uint64, maxCount: int, indexed: bool) =
+                let mutable dc = Unchecked.defaultof<DrawCall>
+                dc.IsIndirect     <- 1uy
+                dc.IsIndexed      <- if indexed then 1uy else 0uy
+                dc.HasCount       <- 1uy
+                dc.Count          <- maxCount
+                dc.DrawCallBuffer <- DrawCallBuffer(buffer, offset, stride, countBuffer, countOffset)
+                dc
+
             member x.Dispose() =
                 if x.IsIndirect = 0uy && not <| NativePtr.isNullPtr x.DrawCalls then
                     NativePtr.free x.DrawCalls
@@ -59,6 +74,49 @@ module IndirectCommands =
                 member x.Dispose() = x.Dispose()
         end
 
+    [<StructLayout(LayoutKind.Explicit)>]
+    type MeshTaskCall =
+        struct
+            [<FieldOffset(0)>] val mutable public IsIndirect     : uint8
+            [<FieldOffset(1)>] val mutable public HasCount       : uint8
+            [<FieldOffset(4)>] val mutable public Count          : int
+            [<FieldOffset(8)>] val mutable public Groups         : nativeptr<EXTMeshShader.VkDrawMeshTasksIndirectCommandEXT>
+            [<FieldOffset(8)>] val mutable public TaskBuffer     : DrawCallBuffer
+
+            static member Direct(groups: EXTMeshShader.VkDrawMeshTasksIndirectCommandEXT[]) =
+                let mutable mc = Unchecked.defaultof<MeshTaskCall>
+                mc.IsIndirect <- 0uy
+                mc.Count      <- groups.Length
+                mc.Groups     <- NativePtr.alloc mc.Count
+                for i = 0 to mc.Count - 1 do mc.Groups.[i] <- groups.[i]
+                mc
+
+            static member Indirect(buffer: VkBuffer, count: int, offset: uint64, stride: int) =
+                let mutable mc = Unchecked.defaultof<MeshTaskCall>
+                mc.IsIndirect <- 1uy
+                mc.Count      <- count
+                mc.TaskBuffer <- DrawCallBuffer(buffer, offset, stride)
+                mc
+
+            static member IndirectCount(buffer: VkBuffer, offset: uint64, stride: int, countBuffer: VkBuffer, countOffset: uint64, maxCount: int) =
+                let mutable mc = Unchecked.defaultof<MeshTaskCall>
+                mc.IsIndirect <- 1uy
+                mc.HasCount   <- 1uy
+                mc.Count      <- maxCount
+                mc.TaskBuffer <- DrawCallBuffer(buffer, offset, stride, countBuffer, countOffset)
+                mc
+
+            member x.Dispose() =
+                if x.IsIndirect = 0uy && not <| NativePtr.isNullPtr x.Groups then
+                    NativePtr.free x.Groups
+
+                x.Count <- 0
+                x.Groups <- NativePtr.zero
+
+            interface IDisposable with
+                member x.Dispose() = x.Dispose()
+        end
+
     [<StructLayout(LayoutKind.Sequential)>]
     type VertexBufferBinding =
         struct
@@ -122,6 +180,36 @@ module IndirectCommands =
                 member x.Dispose() = x.Dispose()
         end
 
+    [<StructLayout(LayoutKind.Sequential)>]
+    type PushDescriptorSetBinding =
+        struct
+            val mutable public BindPoint  : VkPipelineBindPoint
+            val mutable public Layout     : VkPipelineLayout
+            val mutable public Set        : uint32
+            val mutable public WriteCount : uint32
+            val mutable public Writes     : nativeptr<VkWriteDescriptorSet>
+
+            new (bindPoint: VkPipelineBindPoint, layout: VkPipelineLayout, set: uint32, writeCount: int) =
+                {
+                    BindPoint  = bindPoint
+                    Layout     = layout
+                    Set        = set
+                    WriteCount = uint32 writeCount
+                    Writes     = NativePtr.alloc writeCount
+                }
+
+            member this.Dispose() =
+                if not <| NativePtr.isNullPtr this.Writes then
+                    NativePtr.free this.Writes
+                    this.Writes <- NativePtr.zero
+
+                this.Layout <- VkPipelineLayout.Null
+                this.WriteCount <- 0u
+
+            interface IDisposable with
+                member x.Dispose() = x.Dispose()
+        end
+
     [<StructLayout(LayoutKind.Sequential)>]
     type IndexBufferBinding =
         struct
@@ -140,10 +228,54 @@ module VKVM =
             val mutable public CommandCount : uint32
             val mutable public Commands : nativeint
             val mutable public Next : nativeptr<CommandFragment>
+            val mutable public Compiled : nativeint
 
-            new(count, commands, next) = { CommandCount = count; Commands = commands; Next = next }
+            new(count, commands, next, compiled) = { CommandCount = count; Commands = commands; Next = next; Compiled = compiled }
+        end
+
+    type SerializedHandleType =
+        | Pipeline          = 1
+        | PipelineLayout    = 2
+        | DescriptorSet     = 3
+        | Buffer            = 4
+        | Image             = 5
+        | Event             = 6
+        | QueryPool         = 7
+        | RenderPass        = 8
+        | Framebuffer       = 9
+        | ImageView         = 10
+        | Sampler           = 11
+        | BufferView        = 12
+
+    [<StructLayout(LayoutKind.Sequential)>]
+    type SerializedHandle =
+        struct
+            val mutable public Type : SerializedHandleType
+            val mutable public Padding : uint32
+            val mutable public Handle : uint64
         end
 
+    /// Device extensions and features enabled on the device passed to vmInit.
+    /// Each flag requires the extension and the corresponding Vk*Features member to be enabled.
+    [<Flags>]
+    type VMFeatures =
+        | None                                      = 0x0000
+        | Synchronization2                          = 0x0001
+        | DynamicRendering                          = 0x0002
+        | ExtendedDynamicState                      = 0x0004
+        | ExtendedDynamicState2                     = 0x0008
+        | ExtendedDynamicState3PolygonMode          = 0x0010
+        | PushDescriptor                            = 0x0020
+        | MultiDraw                                 = 0x0040
+        | DrawIndirectCount                         = 0x0080
+        | MeshShader                                = 0x0100
+        | ExtendedDynamicState2LogicOp              = 0x0200
+        | ExtendedDynamicState2PatchControlPoints   = 0x0400
+        | ExtendedDynamicState3RasterizationSamples = 0x0800
+        | ExtendedDynamicState3DepthClampEnable     = 0x1000
+        | ExtendedDynamicState3ColorBlendEnable     = 0x2000
+        | ExtendedDynamicState3ColorWriteMask       = 0x4000
+
 
     [<AutoOpen>]
     module Types = 
@@ -192,6 +324,36 @@ module VKVM =
             | NextSubpass = 42
             | EndRenderPass = 43
             | ExecuteCommands = 44
+            | PipelineBarrier2 = 45
+            | SetEvent2 = 46
+            | WaitEvents2 = 47
+            | WriteTimestamp2 = 48
+            | BeginRendering = 49
+            | EndRendering = 50
+            | SetCullMode = 51
+            | SetFrontFace = 52
+            | SetPrimitiveTopology = 53
+            | SetDepthTestEnable = 54
+            | SetDepthWriteEnable = 55
+            | SetDepthCompareOp = 56
+            | SetDepthBoundsTestEnable = 57
+            | SetStencilTestEnable = 58
+            | SetStencilOp = 59
+            | SetRasterizerDiscardEnable = 60
+            | SetDepthBiasEnable = 61
+            | SetPrimitiveRestartEnable = 62
+            | SetPatchControlPoints = 63
+            | SetLogicOp = 64
+            | SetPolygonMode = 65
+            | SetRasterizationSamples = 66
+            | SetDepthClampEnable = 67
+            | SetColorBlendEnable = 68
+            | SetColorWriteMask = 69
+            | PushDescriptorSet = 70
+            | PushDescriptorSetWithTemplate = 71
+            | DrawMeshTasks = 72
+            | DrawMeshTasksIndirect = 73
+            | DrawMeshTasksIndirectCount = 74
  
             | CallFragment = 100
             | Custom = 101
@@ -201,6 +363,8 @@ module VKVM =
             | IndirectBindIndexBuffer = 104
             | IndirectBindVertexBuffers = 105
             | IndirectDraw = 106
+            | IndirectPushDescriptorSet = 107
+            | IndirectDrawMeshTasks = 108
 
         [<StructLayout(LayoutKind.Sequential)>]
         type BindPipelineCommand =
@@ -673,6 +837,303 @@ module VKVM =
                 val mutable public CommandBuffers : nativeptr<VkCommandBuffer>
             end
 
+        type DependencyInfo =
+            {
+                DependencyFlags         : VkDependencyFlags
+                MemoryBarriers          : Vulkan13.VkMemoryBarrier2[]
+                BufferMemoryBarriers    : Vulkan13.VkBufferMemoryBarrier2[]
+                ImageMemoryBarriers     : Vulkan13.VkImageMemoryBarrier2[]
+            }
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type DependencyInfoArgs =
+            struct
+                val mutable public DependencyFlags : VkDependencyFlags
+                val mutable public MemoryBarrierCount : uint32
+                val mutable public MemoryBarriers : nativeptr<Vulkan13.VkMemoryBarrier2>
+                val mutable public BufferMemoryBarrierCount : uint32
+                val mutable public BufferMemoryBarriers : nativeptr<Vulkan13.VkBufferMemoryBarrier2>
+                val mutable public ImageMemoryBarrierCount : uint32
+                val mutable public ImageMemoryBarriers : nativeptr<Vulkan13.VkImageMemoryBarrier2>
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type PipelineBarrier2Command =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public DependencyInfo : DependencyInfoArgs
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetEvent2Command =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public Event : VkEvent
+                val mutable public DependencyInfo : DependencyInfoArgs
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type WaitEvents2Command =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public EventCount : uint32
+                val mutable public Events : nativeptr<VkEvent>
+                val mutable public DependencyInfos : nativeptr<DependencyInfoArgs>
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type WriteTimestamp2Command =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public Stage : uint64
+                val mutable public QueryPool : VkQueryPool
+                val mutable public Query : uint32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type BeginRenderingCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public Flags : Vulkan13.VkRenderingFlags
+                val mutable public RenderArea : VkRect2D
+                val mutable public LayerCount : uint32
+                val mutable public ViewMask : uint32
+                val mutable public ColorAttachmentCount : uint32
+                val mutable public ColorAttachments : nativeptr<Vulkan13.VkRenderingAttachmentInfo>
+                val mutable public DepthAttachment : nativeptr<Vulkan13.VkRenderingAttachmentInfo>
+                val mutable public StencilAttachment : nativeptr<Vulkan13.VkRenderingAttachmentInfo>
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type EndRenderingCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetCullModeCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public CullMode : VkCullModeFlags
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetFrontFaceCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public FrontFace : VkFrontFace
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetPrimitiveTopologyCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public PrimitiveTopology : VkPrimitiveTopology
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetDepthTestEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public DepthTestEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetDepthWriteEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public DepthWriteEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetDepthCompareOpCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public DepthCompareOp : VkCompareOp
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetDepthBoundsTestEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public DepthBoundsTestEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetStencilTestEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public StencilTestEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetStencilOpCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public FaceMask : VkStencilFaceFlags
+                val mutable public FailOp : VkStencilOp
+                val mutable public PassOp : VkStencilOp
+                val mutable public DepthFailOp : VkStencilOp
+                val mutable public CompareOp : VkCompareOp
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetRasterizerDiscardEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public RasterizerDiscardEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetDepthBiasEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public DepthBiasEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetPrimitiveRestartEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public PrimitiveRestartEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetPatchControlPointsCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public PatchControlPoints : uint32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetLogicOpCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public LogicOp : VkLogicOp
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetPolygonModeCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public PolygonMode : VkPolygonMode
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetRasterizationSamplesCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public RasterizationSamples : VkSampleCountFlags
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetDepthClampEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public DepthClampEnable : VkBool32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetColorBlendEnableCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public FirstAttachment : uint32
+                val mutable public AttachmentCount : uint32
+                val mutable public ColorBlendEnables : nativeptr<VkBool32>
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type SetColorWriteMaskCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public FirstAttachment : uint32
+                val mutable public AttachmentCount : uint32
+                val mutable public ColorWriteMasks : nativeptr<VkColorComponentFlags>
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type PushDescriptorSetCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public PipelineBindPoint : VkPipelineBindPoint
+                val mutable public Layout : VkPipelineLayout
+                val mutable public Set : uint32
+                val mutable public WriteCount : uint32
+                val mutable public Writes : nativeptr<VkWriteDescriptorSet>
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type PushDescriptorSetWithTemplateCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public Template : Vulkan11.VkDescriptorUpdateTemplate
+                val mutable public Layout : VkPipelineLayout
+                val mutable public Set : uint32
+                val mutable public DataSize : uint32
+                val mutable public Data : nativeint
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type DrawMeshTasksCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public GroupCountX : uint32
+                val mutable public GroupCountY : uint32
+                val mutable public GroupCountZ : uint32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type DrawMeshTasksIndirectCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public Buffer : VkBuffer
+                val mutable public Offset : VkDeviceSize
+                val mutable public DrawCount : uint32
+                val mutable public Stride : uint32
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type DrawMeshTasksIndirectCountCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType        
+                val mutable public Buffer : VkBuffer
+                val mutable public Offset : VkDeviceSize
+                val mutable public CountBuffer : VkBuffer
+                val mutable public CountBufferOffset : VkDeviceSize
+                val mutable public MaxDrawCount : uint32
+                val mutable public Stride : uint32
+            end
+
         [<StructLayout(LayoutKind.Sequential)>]
         type CallFragmentCommand =
             struct
@@ -732,16 +1193,159 @@ module VKVM =
                 val mutable public Calls : nativeptr<DrawCall>
             end
 
+        [<StructLayout(LayoutKind.Sequential)>]
+        type IndirectPushDescriptorSetCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType  
+                val mutable public Binding : nativeptr<PushDescriptorSetBinding>
+            end
+
+        [<StructLayout(LayoutKind.Sequential)>]
+        type IndirectDrawMeshTasksCommand =
+            struct
+                val mutable public Length : uint32
+                val mutable public OpCode : CommandType  
+                val mutable public Stats : nativeptr<V2i>
+                val mutable public IsActive : nativeptr<int>
+                val mutable public Calls : nativeptr<MeshTaskCall>
+            end
+
     [<AutoOpen>]
     module VM =
+        /// Initializes the VM for the given device, returns 0 if another device is still initialized.
+        [<DllImport("vkvm")>]
+        extern int vmInit(VkDevice device, VMFeatures features)
+
+        [<DllImport("vkvm")>]
+        extern void vmRelease(VkDevice device)
+
+        [<DllImport("vkvm")>]
+        extern void vmSetMaxMultiDrawCount(uint32 count)
+
         [<DllImport("vkvm")>]
         extern void vmRun(VkCommandBuffer cmd, CommandFragment* fragment)
 
+        [<DllImport("vkvm")>]
+        extern void vmLink(CommandFragment* left, CommandFragment* right)
+
+        [<DllImport("vkvm")>]
+        extern void vmUnlink(CommandFragment* left)
+
+        [<DllImport("vkvm")>]
+        extern void vmInsertAfter(CommandFragment* left, CommandFragment* first, CommandFragment* last)
+
+        [<DllImport("vkvm")>]
+        extern void vmRemoveAfter(CommandFragment* left, CommandFragment* last)
+
+        [<DllImport("vkvm")>]
+        extern int vmCompile(CommandFragment* fragment, uint64 size)
+
+        [<DllImport("vkvm")>]
+        extern void vmDecompile(CommandFragment* fragment)
+
+        [<DllImport("vkvm")>]
+        extern nativeint vmEncoderCreate(uint64 chunkSize)
+
+        [<DllImport("vkvm")>]
+        extern void vmEncoderDelete(nativeint encoder)
+
+        [<DllImport("vkvm")>]
+        extern void vmEncoderReset(nativeint encoder)
+
+        [<DllImport("vkvm")>]
+        extern void vmEncoderBegin(nativeint encoder)
+
+        [<DllImport("vkvm")>]
+        extern nativeint vmEncoderPush(nativeint encoder, CommandType opCode, uint32 size)
+
+        [<DllImport("vkvm")>]
+        extern nativeint vmEncoderPushArray(nativeint encoder, uint32 field, nativeint data, uint32 count, uint32 elementSize)
+
+        [<DllImport("vkvm")>]
+        extern int vmEncoderPushCommands(nativeint encoder, nativeint commands, uint64 size)
+
+        [<DllImport("vkvm")>]
+        extern CommandFragment* vmEncoderFinish(nativeint encoder, uint64& size)
+
+        [<DllImport("vkvm")>]
+        extern uint64 vmRetireEpoch()
+
+        [<DllImport("vkvm")>]
+        extern int vmCanFree(uint64 epoch)
+
+        [<DllImport("vkvm")>]
+        extern int vmExport(string path, CommandFragment* fragment)
+
+        [<DllImport("vkvm")>]
+        extern nativeint vmImport(string path)
+
+        [<DllImport("vkvm")>]
+        extern uint32 vmImportHandleCount(nativeint stream)
+
+        [<DllImport("vkvm")>]
+        extern SerializedHandle* vmImportHandles(nativeint stream)
+
+        [<DllImport("vkvm")>]
+        extern void vmImportBind(nativeint stream, uint64* handles)
+
+        [<DllImport("vkvm")>]
+        extern CommandFragment* vmImportFragment(nativeint stream)
+
+        [<DllImport("vkvm")>]
+        extern void vmImportClose(nativeint stream)
+
     [<AutoOpen>]
     module private Helpers =
         let inline usizeof<'a> = uint32 sizeof<'a>
         let inline nsizeof<'a> = nativeint sizeof<'a>
 
+        // memory that running VMs may still read (commands, fragments) is only freed once all
+        // VMs that started before it was retired are finished (vmRetireEpoch/vmCanFree)
+        let private retired = System.Collections.Generic.Queue<struct(uint64 * nativeint)>()
+
+        let retire (ptr : nativeint) =
+            lock retired (fun () ->
+                if ptr <> 0n then retired.Enqueue(struct(VM.vmRetireEpoch(), ptr))
+
+                let mutable blocked = false
+                while not blocked && retired.Count > 0 do
+                    let struct(epoch, p) = retired.Peek()
+                    if VM.vmCanFree(epoch) <> 0 then
+                        retired.Dequeue() |> ignore
+                        Marshal.FreeHGlobal p
+                    else
+                        blocked <- true
+            )
+
+        let dependencyInfoSize (info : DependencyInfo) =
+            info.MemoryBarriers.Length * sizeof<Vulkan13.VkMemoryBarrier2> +
+            info.BufferMemoryBarriers.Length * sizeof<Vulkan13.VkBufferMemoryBarrier2> +
+            info.ImageMemoryBarriers.Length * sizeof<Vulkan13.VkImageMemoryBarrier2>
+
+        // writes the barrier arrays to ptr + offset and returns the args pointing to them (relative to ptr)
+        let writeDependencyInfo (ptr : nativeint) (offset : nativeint) (info : DependencyInfo) =
+            let mOffset = offset
+            let bOffset = mOffset + nativeint (info.MemoryBarriers.Length * sizeof<Vulkan13.VkMemoryBarrier2>)
+            let iOffset = bOffset + nativeint (info.BufferMemoryBarriers.Length * sizeof<Vulkan13.VkBufferMemoryBarrier2>)
+
+            let mPtr = NativePtr.ofNativeInt (ptr + mOffset)
+            let bPtr = NativePtr.ofNativeInt (ptr + bOffset)
+            let iPtr = NativePtr.ofNativeInt (ptr + iOffset)
+            for i in 0 .. info.MemoryBarriers.Length - 1 do NativePtr.set mPtr i info.MemoryBarriers.[i]
+            for i in 0 .. info.BufferMemoryBarriers.Length - 1 do NativePtr.set bPtr i info.BufferMemoryBarriers.[i]
+            for i in 0 .. info.ImageMemoryBarriers.Length - 1 do NativePtr.set iPtr i info.ImageMemoryBarriers.[i]
+
+            let mutable args = Unchecked.defaultof<DependencyInfoArgs>
+            args.DependencyFlags <- info.DependencyFlags
+            args.MemoryBarrierCount <- uint32 info.MemoryBarriers.Length
+            args.MemoryBarriers <- NativePtr.ofNativeInt mOffset
+            args.BufferMemoryBarrierCount <- uint32 info.BufferMemoryBarriers.Length
+            args.BufferMemoryBarriers <- NativePtr.ofNativeInt bOffset
+            args.ImageMemoryBarrierCount <- uint32 info.ImageMemoryBarriers.Length
+            args.ImageMemoryBarriers <- NativePtr.ofNativeInt iOffset
+            args
+
     type CommandStream() =
         static let ptrSize = nsizeof<nativeint>
 
@@ -753,15 +1357,13 @@ module VKVM =
         let mutable prev : CommandStream voption = ValueNone
         let mutable next : CommandStream voption = ValueNone
 
-        let mutable handle = 
-            let handle = NativePtr.alloc 1
-            NativePtr.write handle (CommandFragment(0u, 0n, NativePtr.zero))
-            handle
+        // streams called by this one, compiled along with it before running
+        let called = HashSet<CommandStream>(HashIdentity.Reference)
 
-        let update (f : CommandFragment -> CommandFragment) =
-            let h = NativePtr.read handle
-            let r = f h
-            NativePtr.write handle r
+        let mutable handle : nativeptr<CommandFragment> = 
+            let handle = Marshal.AllocHGlobal sizeof<CommandFragment> |> NativePtr.ofNativeInt
+            NativePtr.write handle (CommandFragment(0u, 0n, NativePtr.zero, 0n))
+            handle
 
         member private x.HandleCount
             with get() : uint32 = NativePtr.read (NativePtr.cast handle)
@@ -769,30 +1371,28 @@ module VKVM =
 
         member private x.HandleNext
             with get() : nativeptr<CommandFragment> = NativePtr.read (NativePtr.ofNativeInt (8n + ptrSize + NativePtr.toNativeInt handle))
-            and set (c : nativeptr<CommandFragment>) = NativePtr.write (NativePtr.ofNativeInt (8n + ptrSize + NativePtr.toNativeInt handle)) c
+            and set (c : nativeptr<CommandFragment>) = VM.vmLink(handle, c)
 
         member private x.HandleCommands
             with get() : nativeint = NativePtr.read (NativePtr.ofNativeInt (8n + NativePtr.toNativeInt handle))
             and set (c : nativeint) = NativePtr.write (NativePtr.ofNativeInt (8n + NativePtr.toNativeInt handle)) c
+
+        member private x.HandleCompiled
+            with get() : nativeint = NativePtr.read (NativePtr.ofNativeInt (8n + 2n * ptrSize + NativePtr.toNativeInt handle))
             
         member private x.Append<'r>(size : int, f : nativeint -> unit) =
+            if x.HandleCompiled <> 0n then VM.vmDecompile(handle)
             let size = nativeint size
             let e = position + size
             if e > capacity then
                 let newCapacity = Fun.NextPowerOfTwo (int64 e) |> nativeint
-                update (fun h ->
-                    let mutable h = h
-                    let ptr = 
-                        if h.Commands = 0n then 
-                            Marshal.AllocHGlobal(newCapacity)
-                        else 
-                            let n = Marshal.AllocHGlobal(newCapacity)
-                            Marshal.Copy(h.Commands, n, length)
-                            Marshal.FreeHGlobal h.Commands
-                            n
-                    h.Commands <- ptr
-                    h
-                )
+                let old = x.HandleCommands
+                let ptr = Marshal.AllocHGlobal(newCapacity)
+                if old <> 0n then Marshal.Copy(old, ptr, length)
+
+                // running VMs may still read the old commands
+                x.HandleCommands <- ptr
+                retire old
                 capacity <- newCapacity
 
             let ptr = x.HandleCommands + position
@@ -818,6 +1418,12 @@ module VKVM =
         member x.Count = count
         member x.IsEmpty = count = 0u
 
+        member x.IsCompiled = x.HandleCompiled <> 0n
+
+        // validates and decodes the recorded commands, used by vmRun until the stream changes
+        member x.Compile() =
+            VM.vmCompile(handle, uint64 length) <> 0
+
         member x.Prev
             with get() = prev
             and private set p = prev <- p
@@ -839,28 +1445,26 @@ module VKVM =
                     x.HandleNext <- NativePtr.zero
 
         member x.Clear() =
-            if count > 0u then
-                update (fun f ->
-                    let mutable f = f
-                    if f.Commands <> 0n then
-                        Marshal.FreeHGlobal f.Commands
-                        f.Commands <- 0n
-                    f.CommandCount <- 0u
-                    capacity <- 0n
-                    length <- 0n
-                    count <- 0u
-                    position <- 0n
-
-
-                    f
-                )
+            if x.HandleCompiled <> 0n then VM.vmDecompile(handle)
+            called.Clear()
+            if count > 0u || capacity > 0n then
+                let old = x.HandleCommands
+                x.HandleCount <- 0u
+                x.HandleCommands <- 0n
+                retire old
+
+                capacity <- 0n
+                length <- 0n
+                count <- 0u
+                position <- 0n
 
         member x.Dispose() =
             if NativePtr.isNull handle then
                 Log.warn "double free"
             else
+                // the fragment needs to be unlinked already, running VMs may still be executing it
                 x.Clear()
-                NativePtr.free handle
+                retire (NativePtr.toNativeInt handle)
                 handle <- NativePtr.zero
 
         member x.BindPipeline(pipelineBindPoint : VkPipelineBindPoint, pipeline : VkPipeline) =
@@ -1102,6 +1706,43 @@ module VKVM =
                 )
             x.Append(&cmd)
 
+        member x.DrawMeshTasks(gx : uint32, gy : uint32, gz : uint32) =
+            let mutable cmd =
+                DrawMeshTasksCommand(
+                    Length = usizeof<DrawMeshTasksCommand>,
+                    OpCode = CommandType.DrawMeshTasks,
+                    GroupCountX = gx,
+                    GroupCountY = gy,
+                    GroupCountZ = gz
+                )
+            x.Append(&cmd)
+
+        member x.DrawMeshTasksIndirect(buffer : VkBuffer, offset : VkDeviceSize, drawCount : uint32, stride : uint32) =
+            let mutable cmd =
+                DrawMeshTasksIndirectCommand(
+                    Length = usizeof<DrawMeshTasksIndirectCommand>,
+                    OpCode = CommandType.DrawMeshTasksIndirect,
+                    Buffer = buffer,
+                    Offset = offset,
+                    DrawCount = drawCount,
+                    Stride = stride
+                )
+            x.Append(&cmd)
+
+        member x.DrawMeshTasksIndirectCount(buffer : VkBuffer, offset : VkDeviceSize, countBuffer : VkBuffer, countOffset : VkDeviceSize, maxDrawCount : uint32, stride : uint32) =
+            let mutable cmd =
+                DrawMeshTasksIndirectCountCommand(
+                    Length = usizeof<DrawMeshTasksIndirectCountCommand>,
+                    OpCode = CommandType.DrawMeshTasksIndirectCount,
+                    Buffer = buffer,
+                    Offset = offset,
+                    CountBuffer = countBuffer,
+                    CountBufferOffset = countOffset,
+                    MaxDrawCount = maxDrawCount,
+                    Stride = stride
+                )
+            x.Append(&cmd)
+
         member x.CopyImage(src : VkImage, srcLayout : VkImageLayout, dst : VkImage, dstLayout : VkImageLayout, regions : VkImageCopy[]) =
             let regionCount = regions.Length
             let baseSize = sizeof<CopyImageCommand>
@@ -1562,6 +2203,317 @@ module VKVM =
                 )
             x.Append(&cmd)
 
+        member x.BeginRendering(flags : Vulkan13.VkRenderingFlags, renderArea : VkRect2D, layerCount : uint32, viewMask : uint32,
+                                colorAttachments : Vulkan13.VkRenderingAttachmentInfo[],
+                                depthAttachment : Vulkan13.VkRenderingAttachmentInfo voption,
+                                stencilAttachment : Vulkan13.VkRenderingAttachmentInfo voption) =
+            let cCount = colorAttachments.Length
+            let dCount = if depthAttachment.IsSome then 1 else 0
+            let sCount = if stencilAttachment.IsSome then 1 else 0
+
+            let baseSize = sizeof<BeginRenderingCommand>
+            let aSize = sizeof<Vulkan13.VkRenderingAttachmentInfo>
+
+            let size = baseSize + (cCount + dCount + sCount) * aSize
+            x.Append(size, fun ptr ->
+                let cOffset = nativeint baseSize
+                let dOffset = cOffset + nativeint (cCount * aSize)
+                let sOffset = dOffset + nativeint (dCount * aSize)
+
+                let cPtr = NativePtr.ofNativeInt (ptr + cOffset)
+                for i in 0 .. cCount - 1 do NativePtr.set cPtr i colorAttachments.[i]
+
+                let mutable cmd = Unchecked.defaultof<BeginRenderingCommand>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.BeginRendering
+                cmd.Flags <- flags
+                cmd.RenderArea <- renderArea
+                cmd.LayerCount <- layerCount
+                cmd.ViewMask <- viewMask
+                cmd.ColorAttachmentCount <- uint32 cCount
+                cmd.ColorAttachments <- NativePtr.ofNativeInt cOffset
+
+                match depthAttachment with
+                | ValueSome a ->
+                    NativeInt.write (ptr + dOffset) a
+                    cmd.DepthAttachment <- NativePtr.ofNativeInt dOffset
+                | ValueNone ->
+                    cmd.DepthAttachment <- NativePtr.zero
+
+                match stencilAttachment with
+                | ValueSome a ->
+                    NativeInt.write (ptr + sOffset) a
+                    cmd.StencilAttachment <- NativePtr.ofNativeInt sOffset
+                | ValueNone ->
+                    cmd.StencilAttachment <- NativePtr.zero
+
+                NativeInt.write ptr cmd
+            )
+
+        member x.EndRendering() =
+            let mutable cmd =
+                EndRenderingCommand(
+                    Length = usizeof<EndRenderingCommand>,
+                    OpCode = CommandType.EndRendering
+                )
+            x.Append(&cmd)
+
+        member x.SetCullMode(mode : VkCullModeFlags) =
+            let mutable cmd =
+                SetCullModeCommand(
+                    Length = usizeof<SetCullModeCommand>,
+                    OpCode = CommandType.SetCullMode,
+                    CullMode = mode
+                )
+            x.Append(&cmd)
+
+        member x.SetFrontFace(frontFace : VkFrontFace) =
+            let mutable cmd =
+                SetFrontFaceCommand(
+                    Length = usizeof<SetFrontFaceCommand>,
+                    OpCode = CommandType.SetFrontFace,
+                    FrontFace = frontFace
+                )
+            x.Append(&cmd)
+
+        member x.SetPrimitiveTopology(topology : VkPrimitiveTopology) =
+            let mutable cmd =
+                SetPrimitiveTopologyCommand(
+                    Length = usizeof<SetPrimitiveTopologyCommand>,
+                    OpCode = CommandType.SetPrimitiveTopology,
+                    PrimitiveTopology = topology
+                )
+            x.Append(&cmd)
+
+        member x.SetDepthTestEnable(enable : bool) =
+            let mutable cmd =
+                SetDepthTestEnableCommand(
+                    Length = usizeof<SetDepthTestEnableCommand>,
+                    OpCode = CommandType.SetDepthTestEnable,
+                    DepthTestEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetDepthWriteEnable(enable : bool) =
+            let mutable cmd =
+                SetDepthWriteEnableCommand(
+                    Length = usizeof<SetDepthWriteEnableCommand>,
+                    OpCode = CommandType.SetDepthWriteEnable,
+                    DepthWriteEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetDepthCompareOp(op : VkCompareOp) =
+            let mutable cmd =
+                SetDepthCompareOpCommand(
+                    Length = usizeof<SetDepthCompareOpCommand>,
+                    OpCode = CommandType.SetDepthCompareOp,
+                    DepthCompareOp = op
+                )
+            x.Append(&cmd)
+
+        member x.SetDepthBoundsTestEnable(enable : bool) =
+            let mutable cmd =
+                SetDepthBoundsTestEnableCommand(
+                    Length = usizeof<SetDepthBoundsTestEnableCommand>,
+                    OpCode = CommandType.SetDepthBoundsTestEnable,
+                    DepthBoundsTestEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetStencilTestEnable(enable : bool) =
+            let mutable cmd =
+                SetStencilTestEnableCommand(
+                    Length = usizeof<SetStencilTestEnableCommand>,
+                    OpCode = CommandType.SetStencilTestEnable,
+                    StencilTestEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetStencilOp(faceMask : VkStencilFaceFlags, failOp : VkStencilOp, passOp : VkStencilOp, depthFailOp : VkStencilOp, compareOp : VkCompareOp) =
+            let mutable cmd =
+                SetStencilOpCommand(
+                    Length = usizeof<SetStencilOpCommand>,
+                    OpCode = CommandType.SetStencilOp,
+                    FaceMask = faceMask,
+                    FailOp = failOp,
+                    PassOp = passOp,
+                    DepthFailOp = depthFailOp,
+                    CompareOp = compareOp
+                )
+            x.Append(&cmd)
+
+        member x.SetRasterizerDiscardEnable(enable : bool) =
+            let mutable cmd =
+                SetRasterizerDiscardEnableCommand(
+                    Length = usizeof<SetRasterizerDiscardEnableCommand>,
+                    OpCode = CommandType.SetRasterizerDiscardEnable,
+                    RasterizerDiscardEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetDepthBiasEnable(enable : bool) =
+            let mutable cmd =
+                SetDepthBiasEnableCommand(
+                    Length = usizeof<SetDepthBiasEnableCommand>,
+                    OpCode = CommandType.SetDepthBiasEnable,
+                    DepthBiasEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetPrimitiveRestartEnable(enable : bool) =
+            let mutable cmd =
+                SetPrimitiveRestartEnableCommand(
+                    Length = usizeof<SetPrimitiveRestartEnableCommand>,
+                    OpCode = CommandType.SetPrimitiveRestartEnable,
+                    PrimitiveRestartEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetPatchControlPoints(points : uint32) =
+            let mutable cmd =
+                SetPatchControlPointsCommand(
+                    Length = usizeof<SetPatchControlPointsCommand>,
+                    OpCode = CommandType.SetPatchControlPoints,
+                    PatchControlPoints = points
+                )
+            x.Append(&cmd)
+
+        member x.SetLogicOp(op : VkLogicOp) =
+            let mutable cmd =
+                SetLogicOpCommand(
+                    Length = usizeof<SetLogicOpCommand>,
+                    OpCode = CommandType.SetLogicOp,
+                    LogicOp = op
+                )
+            x.Append(&cmd)
+
+        member x.SetPolygonMode(mode : VkPolygonMode) =
+            let mutable cmd =
+                SetPolygonModeCommand(
+                    Length = usizeof<SetPolygonModeCommand>,
+                    OpCode = CommandType.SetPolygonMode,
+                    PolygonMode = mode
+                )
+            x.Append(&cmd)
+
+        member x.SetRasterizationSamples(samples : VkSampleCountFlags) =
+            let mutable cmd =
+                SetRasterizationSamplesCommand(
+                    Length = usizeof<SetRasterizationSamplesCommand>,
+                    OpCode = CommandType.SetRasterizationSamples,
+                    RasterizationSamples = samples
+                )
+            x.Append(&cmd)
+
+        member x.SetDepthClampEnable(enable : bool) =
+            let mutable cmd =
+                SetDepthClampEnableCommand(
+                    Length = usizeof<SetDepthClampEnableCommand>,
+                    OpCode = CommandType.SetDepthClampEnable,
+                    DepthClampEnable = (if enable then 1u else 0u)
+                )
+            x.Append(&cmd)
+
+        member x.SetColorBlendEnable(firstAttachment : uint32, values : bool[]) =
+            let count = values.Length
+            let baseSize = sizeof<SetColorBlendEnableCommand>
+            let size = baseSize + count * sizeof<VkBool32>
+            x.Append(size, fun ptr ->
+                let vPtr = NativePtr.ofNativeInt (ptr + nativeint baseSize)
+
+                let mutable cmd = Unchecked.defaultof<SetColorBlendEnableCommand>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.SetColorBlendEnable
+                cmd.FirstAttachment <- firstAttachment
+                cmd.AttachmentCount <- uint32 count
+                cmd.ColorBlendEnables <- NativePtr.ofNativeInt (nativeint baseSize)
+                NativeInt.write ptr cmd
+
+                for i in 0 .. count - 1 do NativePtr.set vPtr i (if values.[i] then 1u else 0u)
+            )
+
+        member x.SetColorWriteMask(firstAttachment : uint32, values : VkColorComponentFlags[]) =
+            let count = values.Length
+            let baseSize = sizeof<SetColorWriteMaskCommand>
+            let size = baseSize + count * sizeof<VkColorComponentFlags>
+            x.Append(size, fun ptr ->
+                let vPtr = NativePtr.ofNativeInt (ptr + nativeint baseSize)
+
+                let mutable cmd = Unchecked.defaultof<SetColorWriteMaskCommand>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.SetColorWriteMask
+                cmd.FirstAttachment <- firstAttachment
+                cmd.AttachmentCount <- uint32 count
+                cmd.ColorWriteMasks <- NativePtr.ofNativeInt (nativeint baseSize)
+                NativeInt.write ptr cmd
+
+                for i in 0 .. count - 1 do NativePtr.set vPtr i values.[i]
+            )
+
+        // the image/buffer/texel buffer view arrays referenced by the writes are copied into the command
+        member x.PushDescriptorSet(bindPoint : VkPipelineBindPoint, layout : VkPipelineLayout, set : uint32, writes : VkWriteDescriptorSet[]) =
+            let wCount = writes.Length
+            let baseSize = sizeof<PushDescriptorSetCommand>
+            let wSize = wCount * sizeof<VkWriteDescriptorSet>
+
+            let infoSize (w : VkWriteDescriptorSet) =
+                let n = int w.descriptorCount
+                (if NativePtr.isNull w.pImageInfo then 0 else n * sizeof<VkDescriptorImageInfo>) +
+                (if NativePtr.isNull w.pBufferInfo then 0 else n * sizeof<VkDescriptorBufferInfo>) +
+                (if NativePtr.isNull w.pTexelBufferView then 0 else n * sizeof<VkBufferView>)
+
+            let size = baseSize + wSize + Array.sumBy infoSize writes
+            x.Append(size, fun ptr ->
+                let wPtr = NativePtr.ofNativeInt (ptr + nativeint baseSize)
+
+                let offset = ref (nativeint (baseSize + wSize))
+                let copy (src : nativeptr<'a>) (count : int) : nativeptr<'a> =
+                    if NativePtr.isNull src then
+                        NativePtr.zero
+                    else
+                        let dst = NativePtr.ofNativeInt (ptr + offset.Value)
+                        for i in 0 .. count - 1 do NativePtr.set dst i (NativePtr.get src i)
+                        let rel = NativePtr.ofNativeInt offset.Value
+                        offset.Value <- offset.Value + nativeint (count * sizeof<'a>)
+                        rel
+
+                for i in 0 .. wCount - 1 do
+                    let mutable w = writes.[i]
+                    let n = int w.descriptorCount
+                    w.pImageInfo <- copy w.pImageInfo n
+                    w.pBufferInfo <- copy w.pBufferInfo n
+                    w.pTexelBufferView <- copy w.pTexelBufferView n
+                    NativePtr.set wPtr i w
+
+                let mutable cmd = Unchecked.defaultof<PushDescriptorSetCommand>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.PushDescriptorSet
+                cmd.PipelineBindPoint <- bindPoint
+                cmd.Layout <- layout
+                cmd.Set <- set
+                cmd.WriteCount <- uint32 wCount
+                cmd.Writes <- NativePtr.ofNativeInt (nativeint baseSize)
+                NativeInt.write ptr cmd
+            )
+
+        member x.PushDescriptorSetWithTemplate(template : Vulkan11.VkDescriptorUpdateTemplate, layout : VkPipelineLayout, set : uint32, data : byte[]) =
+            let baseSize = sizeof<PushDescriptorSetWithTemplateCommand>
+            let size = baseSize + ((data.Length + 7) &&& ~~~7)
+            x.Append(size, fun ptr ->
+                Marshal.Copy(data, 0, ptr + nativeint baseSize, data.Length)
+
+                let mutable cmd = Unchecked.defaultof<PushDescriptorSetWithTemplateCommand>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.PushDescriptorSetWithTemplate
+                cmd.Template <- template
+                cmd.Layout <- layout
+                cmd.Set <- set
+                cmd.DataSize <- uint32 data.Length
+                cmd.Data <- nativeint baseSize
+                NativeInt.write ptr cmd
+            )
+
         member x.ExecuteCommands(buffers : VkCommandBuffer[]) =
             let bCount = buffers.Length
             let baseSize = sizeof<ExecuteCommandsCommand>
@@ -1583,11 +2535,76 @@ module VKVM =
             )
 
 
+        member x.PipelineBarrier2(info : DependencyInfo) =
+            let baseSize = sizeof<PipelineBarrier2Command>
+            let size = baseSize + dependencyInfoSize info
+            x.Append(size, fun ptr ->
+                let mutable cmd = Unchecked.defaultof<PipelineBarrier2Command>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.PipelineBarrier2
+                cmd.DependencyInfo <- writeDependencyInfo ptr (nativeint baseSize) info
+                NativeInt.write ptr cmd
+            )
+
+        member x.SetEvent2(evt : VkEvent, info : DependencyInfo) =
+            let baseSize = sizeof<SetEvent2Command>
+            let size = baseSize + dependencyInfoSize info
+            x.Append(size, fun ptr ->
+                let mutable cmd = Unchecked.defaultof<SetEvent2Command>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.SetEvent2
+                cmd.Event <- evt
+                cmd.DependencyInfo <- writeDependencyInfo ptr (nativeint baseSize) info
+                NativeInt.write ptr cmd
+            )
+
+        member x.WaitEvents2(events : VkEvent[], infos : DependencyInfo[]) =
+            if events.Length <> infos.Length then failf "WaitEvents2 needs one dependency info per event"
+            let eCount = events.Length
+
+            let baseSize = sizeof<WaitEvents2Command>
+            let eSize = eCount * sizeof<VkEvent>
+            let aSize = eCount * sizeof<DependencyInfoArgs>
+
+            let size = baseSize + eSize + aSize + Array.sumBy dependencyInfoSize infos
+            x.Append(size, fun ptr ->
+                let eOffset = nativeint baseSize
+                let aOffset = eOffset + nativeint eSize
+                let ePtr = NativePtr.ofNativeInt (ptr + eOffset)
+                let aPtr = NativePtr.ofNativeInt (ptr + aOffset)
+
+                let mutable offset = aOffset + nativeint aSize
+                for i in 0 .. eCount - 1 do
+                    NativePtr.set ePtr i events.[i]
+                    NativePtr.set aPtr i (writeDependencyInfo ptr offset infos.[i])
+                    offset <- offset + nativeint (dependencyInfoSize infos.[i])
+
+                let mutable cmd = Unchecked.defaultof<WaitEvents2Command>
+                cmd.Length <- uint32 size
+                cmd.OpCode <- CommandType.WaitEvents2
+                cmd.EventCount <- uint32 eCount
+                cmd.Events <- NativePtr.ofNativeInt eOffset
+                cmd.DependencyInfos <- NativePtr.ofNativeInt aOffset
+                NativeInt.write ptr cmd
+            )
+
+        member x.WriteTimestamp2(stage : Vulkan13.VkPipelineStageFlags2, pool : VkQueryPool, query : uint32) =
+            let mutable cmd =
+                WriteTimestamp2Command(
+                    Length = usizeof<WriteTimestamp2Command>,
+                    OpCode = CommandType.WriteTimestamp2,
+                    Stage = uint64 stage,
+                    QueryPool = pool,
+                    Query = query
+                )
+            x.Append(&cmd)
+
         member x.Call(other : CommandStream) =
             let mutable cmd = Unchecked.defaultof<CallFragmentCommand>
             cmd.Length <- usizeof<CallFragmentCommand>
             cmd.OpCode <- CommandType.CallFragment
             cmd.FragmentToCall <- other.Handle
+            called.Add other |> ignore
             x.Append(&cmd)
 
         member x.Custom(fptr : nativeint) =
@@ -1613,6 +2630,13 @@ module VKVM =
             cmd.Binding <- pointer
             x.Append(&cmd)
 
+        member x.IndirectPushDescriptorSet(pointer : nativeptr<PushDescriptorSetBinding>) =
+            let mutable cmd = Unchecked.defaultof<IndirectPushDescriptorSetCommand>
+            cmd.Length <- usizeof<IndirectPushDescriptorSetCommand>
+            cmd.OpCode <- CommandType.IndirectPushDescriptorSet
+            cmd.Binding <- pointer
+            x.Append(&cmd)
+
         member x.IndirectBindIndexBuffer(pointer : nativeptr<IndexBufferBinding>) =
             let mutable cmd = Unchecked.defaultof<IndirectBindIndexBufferCommand>
             cmd.Length <- usizeof<IndirectBindIndexBufferCommand>
@@ -1637,6 +2661,15 @@ module VKVM =
             cmd.Calls <- calls
             x.Append(&cmd)
 
+        member x.IndirectDrawMeshTasks(stats : nativeptr<V2i>, isActive : nativeptr<int>, calls : nativeptr<MeshTaskCall>) =
+            let mutable cmd = Unchecked.defaultof<IndirectDrawMeshTasksCommand>
+            cmd.Length <- usizeof<IndirectDrawMeshTasksCommand>
+            cmd.OpCode <- CommandType.IndirectDrawMeshTasks
+            cmd.Stats <- stats
+            cmd.IsActive <- isActive
+            cmd.Calls <- calls
+            x.Append(&cmd)
+
         member x.Position
             with get() = position
             and set p = position <- p
@@ -1650,7 +2683,21 @@ module VKVM =
         member x.Handle = handle
 
 
+        member private x.Called = called
+
+        // compiles the streams of the chain (and the streams they call) that changed since their
+        // last run, the VM must not interpret commands that fail validation
+        member private x.CompileChain(visited : HashSet<CommandStream>) =
+            let mutable current = ValueSome x
+            while current.IsSome && visited.Add current.Value do
+                let s = current.Value
+                if not s.IsEmpty && not s.IsCompiled && not (s.Compile()) then
+                    failf "[VKVM] command stream contains invalid commands"
+                for c in s.Called do c.CompileChain visited
+                current <- s.Next
+
         member x.Run(cmd : VkCommandBuffer) =
+            x.CompileChain(HashSet(HashIdentity.Reference))
             VM.vmRun(cmd, handle)
 
         interface IDisposable with
@@ -180,6 +180,12 @@ type ShaderFeatures =
         /// Specifies whether tessellation control and evaluation shaders are supported.
         TessellationShader: bool
 
+        /// Specifies whether task shaders are supported (VK_EXT_mesh_shader).
+        TaskShader: bool
+
+        /// Specifies whether mesh shaders are supported (VK_EXT_mesh_shader).
+        MeshShader: bool
+
         /// Specifies whether storage buffers and images support stores and atomic operations in the vertex, tessellation, and geometry shader stages.
         VertexPipelineStoresAndAtomics: bool
 
@@ -311,6 +317,8 @@ type ShaderFeatures =
     member internal x.Print(l : ILogger) =
         l.line "geometry:                          %A" x.GeometryShader
         l.line "tesselation:                       %A" x.TessellationShader
+        l.line "task:                              %A" x.TaskShader
+        l.line "mesh:                              %A" x.MeshShader
         l.line "geometry / tesselation point size: %A" x.TessellationAndGeometryPointSize
         l.line "vertex stores / atomics:           %A" x.VertexPipelineStoresAndAtomics
         l.line "fragment stores / atomics:         %A" x.FragmentStoresAndAtomics
@@ -432,12 +440,16 @@ type DrawingFeatures =
 
         /// Specifies whether indirect draw calls support the firstInstance parameter.
         DrawIndirectFirstInstance: bool
+
+        /// Specifies whether vkCmdDrawMultiEXT and vkCmdDrawMultiIndexedEXT are supported (VK_EXT_multi_draw).
+        MultiDraw: bool
     }
 
     member internal x.Print(l : ILogger) =
         l.line "full 32-bit indices:          %A" x.FullDrawIndexUint32
         l.line "multi draw indirect:          %A" x.MultiDrawIndirect
         l.line "draw indirect first instance: %A" x.DrawIndirectFirstInstance
+        l.line "multi draw:                   %A" x.MultiDraw
 
 [<CLIMutable>]
 type MultiviewFeatures =
@@ -481,6 +493,52 @@ type RasterizerFeatures =
         l.line "alpha to one:              %A" x.AlphaToOne
         l.line "variable multisample rate: %A" x.VariableMultisampleRate
 
+[<CLIMutable>]
+type DynamicStateFeatures =
+    {
+        /// Specifies whether the dynamic states of VK_EXT_extended_dynamic_state are supported.
+        ExtendedDynamicState: bool
+
+        /// Specifies whether rasterizer discard, depth bias and primitive restart can be enabled dynamically (VK_EXT_extended_dynamic_state2).
+        ExtendedDynamicState2: bool
+
+        /// Specifies whether the logic operation can be set dynamically.
+        ExtendedDynamicState2LogicOp: bool
+
+        /// Specifies whether the number of patch control points can be set dynamically.
+        ExtendedDynamicState2PatchControlPoints: bool
+
+        /// Specifies whether the polygon mode can be set dynamically (VK_EXT_extended_dynamic_state3).
+        ExtendedDynamicState3PolygonMode: bool
+
+        /// Specifies whether the number of rasterization samples can be set dynamically.
+        ExtendedDynamicState3RasterizationSamples: bool
+
+        /// Specifies whether depth clamping can be enabled dynamically.
+        ExtendedDynamicState3DepthClampEnable: bool
+
+        /// Specifies whether blending can be enabled dynamically per attachment.
+        ExtendedDynamicState3ColorBlendEnable: bool
+
+        /// Specifies whether the color write masks can be set dynamically per attachment.
+        ExtendedDynamicState3ColorWriteMask: bool
+    }
+
+    member internal x.Print(l : ILogger) =
+        l.line "extended dynamic state:   %A" x.ExtendedDynamicState
+        l.section "extended dynamic state 2:" (fun () ->
+            l.line "supported:              %A" x.ExtendedDynamicState2
+            l.line "logic op:               %A" x.ExtendedDynamicState2LogicOp
+            l.line "patch control points:   %A" x.ExtendedDynamicState2PatchControlPoints
+        )
+        l.section "extended dynamic state 3:" (fun () ->
+            l.line "polygon mode:           %A" x.ExtendedDynamicState3PolygonMode
+            l.line "rasterization samples:  %A" x.ExtendedDynamicState3RasterizationSamples
+            l.line "depth clamp enable:     %A" x.ExtendedDynamicState3DepthClampEnable
+            l.line "color blend enable:     %A" x.ExtendedDynamicState3ColorBlendEnable
+            l.line "color write mask:       %A" x.ExtendedDynamicState3ColorWriteMask
+        )
+
 [<CLIMutable>]
 type GraphicsPipelineFeatures =
     {
@@ -489,6 +547,7 @@ type GraphicsPipelineFeatures =
         Drawing: DrawingFeatures
         Multiview: MultiviewFeatures
         Rasterizer: RasterizerFeatures
+        DynamicState: DynamicStateFeatures
     }
 
     member internal x.Print(l : ILogger) =
@@ -497,6 +556,21 @@ type GraphicsPipelineFeatures =
         l.section "drawing:" (fun () -> x.Drawing.Print(l))
         l.section "multiview: " (fun () -> x.Multiview.Print(l))
         l.section "rasterizer:" (fun () -> x.Rasterizer.Print(l))
+        l.section "dynamic state:" (fun () -> x.DynamicState.Print(l))
+
+[<CLIMutable>]
+type CommandFeatures =
+    {
+        /// Specifies whether the synchronization commands of VK_KHR_synchronization2 are supported.
+        Synchronization2: bool
+
+        /// Specifies whether render passes can be begun without render pass objects (VK_KHR_dynamic_rendering).
+        DynamicRendering: bool
+    }
+
+    member internal x.Print(l : ILogger) =
+        l.line "synchronization2:  %A" x.Synchronization2
+        l.line "dynamic rendering: %A" x.DynamicRendering
 
 [<CLIMutable>]
 type RaytracingFeatures =
@@ -601,6 +675,7 @@ type DeviceFeatures =
         GraphicsPipeline : GraphicsPipelineFeatures
         Raytracing       : RaytracingFeatures
         Debugging        : DebuggingFeatures
+        Commands         : CommandFeatures
     }
 
     member internal x.Print(l : ILogger) =
@@ -613,6 +688,7 @@ type DeviceFeatures =
         l.section "graphics pipeline:" (fun () -> x.GraphicsPipeline.Print(l))
         l.section "raytracing:" (fun () -> x.Raytracing.Print(l))
         l.section "debugging:" (fun () -> x.Debugging.Print(l))
+        l.section "commands:" (fun () -> x.Commands.Print(l))
 
 [<CompilationRepresentation(CompilationRepresentationFlags.ModuleSuffix)>]
 module DeviceFeatures =
@@ -627,7 +703,14 @@ module DeviceFeatures =
     open EXTDescriptorIndexing
     open EXTMemoryPriority
     open EXTDeviceFault
+    open EXTMultiDraw
     open EXTOpacityMicromap
+    open EXTExtendedDynamicState
+    open EXTExtendedDynamicState2
+    open EXTExtendedDynamicState3
+    open EXTMeshShader
+    open KHRSynchronization2
+    open KHRDynamicRendering
     open NVRayTracingInvocationReorder
     open NVRayTracingValidation
     open Vulkan11
@@ -774,6 +857,49 @@ module DeviceFeatures =
                 toVkBool features.Debugging.VendorBinaryDump
             )
 
+        let md =
+            VkPhysicalDeviceMultiDrawFeaturesEXT(
+                toVkBool features.GraphicsPipeline.Drawing.MultiDraw
+            )
+
+        let sync2 =
+            VkPhysicalDeviceSynchronization2FeaturesKHR(
+                toVkBool features.Commands.Synchronization2
+            )
+
+        let dr =
+            VkPhysicalDeviceDynamicRenderingFeaturesKHR(
+                toVkBool features.Commands.DynamicRendering
+            )
+
+        let eds =
+            VkPhysicalDeviceExtendedDynamicStateFeaturesEXT(
+                toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState
+            )
+
+        let eds2 =
+            VkPhysicalDeviceExtendedDynamicState2FeaturesEXT(
+                toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState2,
+                toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState2LogicOp,
+                toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState2PatchControlPoints
+            )
+
+        let eds3 =
+            let mutable eds3 = VkPhysicalDeviceExtendedDynamicState3FeaturesEXT.Empty
+            eds3.extendedDynamicState3PolygonMode <- toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState3PolygonMode
+            eds3.extendedDynamicState3RasterizationSamples <- toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState3RasterizationSamples
+            eds3.extendedDynamicState3DepthClampEnable <- toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState3DepthClampEnable
+            eds3.extendedDynamicState3ColorBlendEnable <- toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState3ColorBlendEnable
+            eds3.extendedDynamicState3ColorWriteMask <- toVkBool features.GraphicsPipeline.DynamicState.ExtendedDynamicState3ColorWriteMask
+            eds3
+
+        let mesh =
+            VkPhysicalDeviceMeshShaderFeaturesEXT(
+                toVkBool features.Shaders.TaskShader,
+                toVkBool features.Shaders.MeshShader,
+                0u, 0u, 0u
+            )
+
         let features =
             VkPhysicalDeviceFeatures2(
                 VkPhysicalDeviceFeatures(
@@ -855,6 +981,13 @@ module DeviceFeatures =
         |> if not rq.IsEmpty  then VkStructChain.add rq  else id
         |> if not bda.IsEmpty then VkStructChain.add bda else id
         |> if not dflt.IsEmpty then VkStructChain.add dflt else id
+        |> if not md.IsEmpty then VkStructChain.add md else id
+        |> if not sync2.IsEmpty then VkStructChain.add sync2 else id
+        |> if not dr.IsEmpty then VkStructChain.add dr else id
+        |> if not eds.IsEmpty then VkStructChain.add eds else id
+        |> if not eds2.IsEmpty then VkStructChain.add eds2 else id
+        |> if not eds3.IsEmpty then VkStructChain.add eds3 else id
+        |> if not mesh.IsEmpty then VkStructChain.add mesh else id
         |> VkStructChain.add features
 
     let create (protectedMemoryFeatures : VkPhysicalDeviceProtectedMemoryFeatures)
@@ -876,6 +1009,13 @@ module DeviceFeatures =
                (rayQueryFeatures : VkPhysicalDeviceRayQueryFeaturesKHR)
                (bufferDeviceAddressFeatures : VkPhysicalDeviceBufferDeviceAddressFeaturesKHR)
                (deviceFaultFeatures : VkPhysicalDeviceFaultFeaturesEXT)
+               (multiDrawFeatures : VkPhysicalDeviceMultiDrawFeaturesEXT)
+               (synchronization2Features : VkPhysicalDeviceSynchronization2FeaturesKHR)
+               (dynamicRenderingFeatures : VkPhysicalDeviceDynamicRenderingFeaturesKHR)
+               (extendedDynamicStateFeatures : VkPhysicalDeviceExtendedDynamicStateFeaturesEXT)
+               (extendedDynamicState2Features : VkPhysicalDeviceExtendedDynamicState2FeaturesEXT)
+               (extendedDynamicState3Features : VkPhysicalDeviceExtendedDynamicState3FeaturesEXT)
+               (meshShaderFeatures : VkPhysicalDeviceMeshShaderFeaturesEXT)
                (features : VkPhysicalDeviceFeatures) =
 
         {
@@ -933,6 +1073,8 @@ module DeviceFeatures =
                 {
                     GeometryShader =                            toBool features.geometryShader
                     TessellationShader =                        toBool features.tessellationShader
+                    TaskShader =                                toBool meshShaderFeatures.taskShader
+                    MeshShader =                                toBool meshShaderFeatures.meshShader
                     VertexPipelineStoresAndAtomics =            toBool features.vertexPipelineStoresAndAtomics
                     FragmentStoresAndAtomics =                  toBool features.fragmentStoresAndAtomics
                     TessellationAndGeometryPointSize =          toBool features.shaderTessellationAndGeometryPointSize
@@ -1004,6 +1146,7 @@ module DeviceFeatures =
                             FullDrawIndexUint32 =       toBool features.fullDrawIndexUint32
                             MultiDrawIndirect =         toBool features.multiDrawIndirect
                             DrawIndirectFirstInstance = toBool features.drawIndirectFirstInstance
+                            MultiDraw =                 toBool multiDrawFeatures.multiDraw
                         }
 
                     Multiview =
@@ -1020,6 +1163,19 @@ module DeviceFeatures =
                              AlphaToOne =              toBool features.alphaToOne
                              VariableMultisampleRate = toBool features.variableMultisampleRate
                         }
+
+                    DynamicState =
+                        {
+                            ExtendedDynamicState =                      toBool extendedDynamicStateFeatures.extendedDynamicState
+                            ExtendedDynamicState2 =                     toBool extendedDynamicState2Features.extendedDynamicState2
+                            ExtendedDynamicState2LogicOp =              toBool extendedDynamicState2Features.extendedDynamicState2LogicOp
+                            ExtendedDynamicState2PatchControlPoints =   toBool extendedDynamicState2Features.extendedDynamicState2PatchControlPoints
+                            ExtendedDynamicState3PolygonMode =          toBool extendedDynamicState3Features.extendedDynamicState3PolygonMode
+                            ExtendedDynamicState3RasterizationSamples = toBool extendedDynamicState3Features.extendedDynamicState3RasterizationSamples
+                            ExtendedDynamicState3DepthClampEnable =     toBool extendedDynamicState3Features.extendedDynamicState3DepthClampEnable
+                            ExtendedDynamicState3ColorBlendEnable =     toBool extendedDynamicState3Features.extendedDynamicState3ColorBlendEnable
+                            ExtendedDynamicState3ColorWriteMask =       toBool extendedDynamicState3Features.extendedDynamicState3ColorWriteMask
+                        }
                 }
 
             Raytracing =
@@ -1047,6 +1203,12 @@ module DeviceFeatures =
                     DeviceFault      = toBool deviceFaultFeatures.deviceFault
                     VendorBinaryDump = toBool deviceFaultFeatures.deviceFaultVendorBinary
                 }
+
+            Commands =
+                {
+                    Synchronization2 = toBool synchronization2Features.synchronization2
+                    DynamicRendering = toBool dynamicRenderingFeatures.dynamicRendering
+                }
         }
 
     /// Returns the default features to be enabled.
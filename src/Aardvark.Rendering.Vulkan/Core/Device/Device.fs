@@ -158,6 +158,44 @@ type Device private (physicalDevice: PhysicalDevice, wantedExtensions: string se
             return !!pDevice
         }
 
+    // the VM may only use commands of extensions and features that are actually enabled on the device
+    do
+        let dynamicState = enabledFeatures.GraphicsPipeline.DynamicState
+
+        let vmFeatures =
+            [
+                KHRSynchronization2.Name,       VKVM.VMFeatures.Synchronization2,                           enabledFeatures.Commands.Synchronization2
+                KHRDynamicRendering.Name,       VKVM.VMFeatures.DynamicRendering,                           enabledFeatures.Commands.DynamicRendering
+                EXTExtendedDynamicState.Name,   VKVM.VMFeatures.ExtendedDynamicState,                       dynamicState.ExtendedDynamicState
+                EXTExtendedDynamicState2.Name,  VKVM.VMFeatures.ExtendedDynamicState2,                      dynamicState.ExtendedDynamicState2
+                EXTExtendedDynamicState2.Name,  VKVM.VMFeatures.ExtendedDynamicState2LogicOp,               dynamicState.ExtendedDynamicState2LogicOp
+                EXTExtendedDynamicState2.Name,  VKVM.VMFeatures.ExtendedDynamicState2PatchControlPoints,    dynamicState.ExtendedDynamicState2PatchControlPoints
+                EXTExtendedDynamicState3.Name,  VKVM.VMFeatures.ExtendedDynamicState3PolygonMode,           dynamicState.ExtendedDynamicState3PolygonMode
+                EXTExtendedDynamicState3.Name,  VKVM.VMFeatures.ExtendedDynamicState3RasterizationSamples,  dynamicState.ExtendedDynamicState3RasterizationSamples
+                EXTExtendedDynamicState3.Name,  VKVM.VMFeatures.ExtendedDynamicState3DepthClampEnable,      dynamicState.ExtendedDynamicState3DepthClampEnable
+                EXTExtendedDynamicState3.Name,  VKVM.VMFeatures.ExtendedDynamicState3ColorBlendEnable,      dynamicState.ExtendedDynamicState3ColorBlendEnable
+                EXTExtendedDynamicState3.Name,  VKVM.VMFeatures.ExtendedDynamicState3ColorWriteMask,        dynamicState.ExtendedDynamicState3ColorWriteMask
+                KHRPushDescriptor.Name,         VKVM.VMFeatures.PushDescriptor,                             true
+                EXTMultiDraw.Name,              VKVM.VMFeatures.MultiDraw,                                  enabledFeatures.GraphicsPipeline.Drawing.MultiDraw
+                KHRDrawIndirectCount.Name,      VKVM.VMFeatures.DrawIndirectCount,                          true
+                EXTMeshShader.Name,             VKVM.VMFeatures.MeshShader,                                 enabledFeatures.Shaders.MeshShader
+            ]
+            |> List.fold (fun features (name, feature, enabled) ->
+                if enabled && enabledExtensions |> List.contains name then features ||| feature
+                else features
+            ) VKVM.VMFeatures.None
+
+        if VKVM.VM.vmInit(device, vmFeatures) = 0 then
+            VkRaw.vkDestroyDevice(device, NativePtr.zero)
+            failf "could not initialize the command VM, it supports only a single device at a time"
+
+        if vmFeatures.HasFlag VKVM.VMFeatures.MultiDraw then
+            use chain = new VkStructChain()
+            let pMultiDraw  = chain.Add<EXTMultiDraw.VkPhysicalDeviceMultiDrawPropertiesEXT>()
+            let _           = chain.Add<VkPhysicalDeviceProperties2>()
+            VkRaw.vkGetPhysicalDeviceProperties2(physicalDevice.Handle, VkStructChain.toNativePtr chain)
+            VKVM.VM.vmSetMaxMultiDrawCount (!!pMultiDraw).maxMultiDrawCount
+
     let mutable queueFamilies : DeviceQueueFamily[] = null
     let mutable graphicsFamily : DeviceQueueFamily option = None
     let mutable computeFamily : DeviceQueueFamily option = None
@@ -320,6 +358,7 @@ type Device private (physicalDevice: PhysicalDevice, wantedExtensions: string se
                 onDispose.Trigger()
                 memoryAllocator.Dispose()
                 for f in queueFamilies do f.Dispose()
+                VKVM.VM.vmRelease device
                 VkRaw.vkDestroyDevice(device, NativePtr.zero)
                 device <- VkDevice.Zero
 
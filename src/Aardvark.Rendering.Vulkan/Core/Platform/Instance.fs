@@ -42,6 +42,8 @@ module Instance =
 
         let MemoryPriority                  = EXTMemoryPriority.Name
 
+        let MultiDraw                       = EXTMultiDraw.Name
+
         let Shader8Bit16Bit = [
             KHR8bitStorage.Name
             KHRShaderFloat16Int8.Name
@@ -18,6 +18,13 @@ open EXTCustomBorderColor
 open EXTDescriptorIndexing
 open EXTMemoryPriority
 open EXTDeviceFault
+open EXTMultiDraw
+open EXTExtendedDynamicState
+open EXTExtendedDynamicState2
+open EXTExtendedDynamicState3
+open EXTMeshShader
+open KHRSynchronization2
+open KHRDynamicRendering
 open NVRayTracingInvocationReorder
 open NVRayTracingValidation
 
@@ -73,7 +80,7 @@ type PhysicalDevice internal(instance: IVulkanInstance, handle: VkPhysicalDevice
         globalExtensions |> Array.exists (fun e -> e.name = name)
 
     let queryFeatures (hasExtension: string -> bool) =
-        let f, pm, memp, ycbcr, cbc, s8, s16, f16i8, vp, sdp, idx, rtp, rtpos, rtir, rtv, acc, omm, rq, bda, dflt =
+        let f, pm, memp, ycbcr, cbc, s8, s16, f16i8, vp, sdp, idx, rtp, rtpos, rtir, rtv, acc, omm, rq, bda, dflt, md, sync2, dr, eds, eds2, eds3, mesh =
             use chain = new VkStructChain()
             let pMem        = chain.Add<VkPhysicalDeviceProtectedMemoryFeatures>()
             let pMemPrior   = chain.Add<VkPhysicalDeviceMemoryPriorityFeaturesEXT>             (hasExtension EXTMemoryPriority.Name)
@@ -94,6 +101,13 @@ type PhysicalDevice internal(instance: IVulkanInstance, handle: VkPhysicalDevice
             let pRQ         = chain.Add<VkPhysicalDeviceRayQueryFeaturesKHR>                   (hasExtension KHRRayQuery.Name)
             let pDevAddr    = chain.Add<VkPhysicalDeviceBufferDeviceAddressFeaturesKHR>        (hasExtension KHRBufferDeviceAddress.Name)
             let pDevFault   = chain.Add<VkPhysicalDeviceFaultFeaturesEXT>                      (hasExtension EXTDeviceFault.Name)
+            let pMultiDraw  = chain.Add<VkPhysicalDeviceMultiDrawFeaturesEXT>                  (hasExtension EXTMultiDraw.Name)
+            let pSync2      = chain.Add<VkPhysicalDeviceSynchronization2FeaturesKHR>           (hasExtension KHRSynchronization2.Name)
+            let pDynRender  = chain.Add<VkPhysicalDeviceDynamicRenderingFeaturesKHR>           (hasExtension KHRDynamicRendering.Name)
+            let pEds        = chain.Add<VkPhysicalDeviceExtendedDynamicStateFeaturesEXT>       (hasExtension EXTExtendedDynamicState.Name)
+            let pEds2       = chain.Add<VkPhysicalDeviceExtendedDynamicState2FeaturesEXT>      (hasExtension EXTExtendedDynamicState2.Name)
+            let pEds3       = chain.Add<VkPhysicalDeviceExtendedDynamicState3FeaturesEXT>      (hasExtension EXTExtendedDynamicState3.Name)
+            let pMesh       = chain.Add<VkPhysicalDeviceMeshShaderFeaturesEXT>                 (hasExtension EXTMeshShader.Name)
             let pFeatures   = chain.Add<VkPhysicalDeviceFeatures2>()
 
             VkRaw.vkGetPhysicalDeviceFeatures2(handle, VkStructChain.toNativePtr chain)
@@ -102,9 +116,11 @@ type PhysicalDevice internal(instance: IVulkanInstance, handle: VkPhysicalDevice
             NativePtr.readOrEmpty p8bit, !!p16bit, NativePtr.readOrEmpty pf16i8,
             !!pVarPtrs, !!pDrawParams, NativePtr.readOrEmpty pIdx, NativePtr.readOrEmpty pRTP, NativePtr.readOrEmpty pRTPos,
             NativePtr.readOrEmpty pRTIR, NativePtr.readOrEmpty pRTV, NativePtr.readOrEmpty pAcc, NativePtr.readOrEmpty pOmm, NativePtr.readOrEmpty pRQ,
-            NativePtr.readOrEmpty pDevAddr, NativePtr.readOrEmpty pDevFault
+            NativePtr.readOrEmpty pDevAddr, NativePtr.readOrEmpty pDevFault, NativePtr.readOrEmpty pMultiDraw,
+            NativePtr.readOrEmpty pSync2, NativePtr.readOrEmpty pDynRender, NativePtr.readOrEmpty pEds,
+            NativePtr.readOrEmpty pEds2, NativePtr.readOrEmpty pEds3, NativePtr.readOrEmpty pMesh
 
-        f |> DeviceFeatures.create pm memp ycbcr cbc s8 s16 f16i8 vp sdp idx rtp rtpos rtir rtv acc omm rq bda dflt
+        f |> DeviceFeatures.create pm memp ycbcr cbc s8 s16 f16i8 vp sdp idx rtp rtpos rtir rtv acc omm rq bda dflt md sync2 dr eds eds2 eds3 mesh
 
     let features =
         queryFeatures hasExtension
@@ -26,6 +26,7 @@ type HeadlessVulkanApplication(debug: IDebugConfig,
             yield Instance.Extensions.MemoryBudget
             yield Instance.Extensions.MemoryPriority
             yield Instance.Extensions.DeviceFault
+            yield Instance.Extensions.MultiDraw
 
             yield! Instance.Extensions.Maintenance
             yield! Instance.Extensions.Raytracing debug.RaytracingValidationEnabled
@@ -57,6 +57,7 @@ type VulkanApplication(debug: IDebugConfig,
             yield Instance.Extensions.MemoryBudget
             yield Instance.Extensions.MemoryPriority
             yield Instance.Extensions.DeviceFault
+            yield Instance.Extensions.MultiDraw
 
             yield! Instance.Extensions.Maintenance
             yield! Instance.Extensions.Raytracing debug.RaytracingValidationEnabled
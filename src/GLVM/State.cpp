@@ -19,7 +19,9 @@ State::State()
 	hMultisample = nullptr;
 
 	currentColorMask = std::unordered_map<intptr_t, int>();
-	currentDrawBuffers = std::vector<GLenum>();
+	currentDrawBuffers = std::unordered_map<intptr_t, std::vector<GLenum>>();
+	currentFramebuffer = std::unordered_map<GLenum, intptr_t>();
+	texParameters = std::unordered_map<intptr_t, std::unordered_map<intptr_t, intptr_t>>();
 
 	currentSampler = std::unordered_map<int, intptr_t>();
 	currentTexture = std::unordered_map<GLenum, std::unordered_map<int, intptr_t>>();
@@ -33,7 +35,13 @@ State::State()
 	blendColor = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
 	stencilFunc = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
 	stencilOp = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);	
-	
+	currentViewport = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	currentScissor = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	clearColor = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	clearDepth = -1;
+	hStencilFunc[0] = hStencilFunc[1] = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
+	hStencilOp[0] = hStencilOp[1] = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
+	hPolygonOffset = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
 }
 
 State::~State()
@@ -55,6 +63,13 @@ void State::Reset()
 
 	currentColorMask.clear();
 	currentDrawBuffers.clear();
+	currentFramebuffer.clear();
+	hBlendEnabled.clear();
+	hBlendFunc.clear();
+	hBlendEquation.clear();
+	hVertexBuffers.clear();
+	hVertexAttribValues.clear();
+	texParameters.clear();
 
 	currentSampler.clear();
 	currentTexture.clear();
@@ -68,12 +83,17 @@ void State::Reset()
 	blendColor = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
 	stencilFunc = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
 	stencilOp = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	currentViewport = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	currentScissor = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	clearColor = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	clearDepth = -1;
+	hStencilFunc[0] = hStencilFunc[1] = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
+	hStencilOp[0] = hStencilOp[1] = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
+	hPolygonOffset = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
 
 	hDepthTest = nullptr;
 	hCullFace = nullptr;
 	hPolygonMode = nullptr;
-	hStencilModeFront = nullptr;
-	hStencilModeBack = nullptr;
 	hConservativeRaster = nullptr;
 	hMultisample = nullptr;
 }
@@ -152,17 +172,122 @@ bool State::HShouldSetPolygonMode(GLenum* test)
 
 bool State::HShouldSetBlendModes(int count, BlendMode** test)
 {
-	// TODO: Implement or remove because interpreter is dead?
+	// redundancies are removed per attachment by hglSetBlendModes
 	return true;
 }
 
-bool State::HShouldSetStencilMode(StencilMode* front, StencilMode* back)
+bool State::HShouldSetBlendEnable(int index, int count, int enabled)
 {
-	if (hStencilModeFront == nullptr || memcmp(hStencilModeFront, front, sizeof(StencilMode)) != 0 ||
-		hStencilModeBack == nullptr || memcmp(hStencilModeBack, back, sizeof(StencilMode)) != 0)
+	intptr_t value = enabled ? 1 : 0;
+	if (index >= 0)
 	{
-		hStencilModeFront = front;
-		hStencilModeBack = back;
+		if ((int)hBlendEnabled.size() <= index) hBlendEnabled.resize(index + 1, -1);
+		if (hBlendEnabled[index] == value)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		hBlendEnabled[index] = value;
+		modes.erase(GL_BLEND);
+		return true;
+	}
+	else
+	{
+		bool equal = (int)hBlendEnabled.size() >= count;
+		for (int i = 0; equal && i < count; i++) equal = hBlendEnabled[i] == value;
+		if (equal)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		hBlendEnabled.assign(count, value);
+		modes[GL_BLEND] = value != 0;
+		return true;
+	}
+}
+
+bool State::HShouldSetBlendFunc(int index, int count, GLenum src, GLenum dst, GLenum srcAlpha, GLenum dstAlpha)
+{
+	auto value = std::make_tuple((intptr_t)src, (intptr_t)dst, (intptr_t)srcAlpha, (intptr_t)dstAlpha);
+	auto unknown = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+	if (index >= 0)
+	{
+		if ((int)hBlendFunc.size() <= index) hBlendFunc.resize(index + 1, unknown);
+		if (hBlendFunc[index] == value)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		hBlendFunc[index] = value;
+		blendFunc = unknown;
+		return true;
+	}
+	else
+	{
+		bool equal = (int)hBlendFunc.size() >= count;
+		for (int i = 0; equal && i < count; i++) equal = hBlendFunc[i] == value;
+		if (equal)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		hBlendFunc.assign(count, value);
+		blendFunc = value;
+		return true;
+	}
+}
+
+bool State::HShouldSetBlendEquation(int index, int count, GLenum op, GLenum opAlpha)
+{
+	auto value = std::make_tuple((intptr_t)op, (intptr_t)opAlpha);
+	auto unknown = std::tuple<intptr_t, intptr_t>(-1, -1);
+	if (index >= 0)
+	{
+		if ((int)hBlendEquation.size() <= index) hBlendEquation.resize(index + 1, unknown);
+		if (hBlendEquation[index] == value)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		hBlendEquation[index] = value;
+		blendEquation = unknown;
+		return true;
+	}
+	else
+	{
+		bool equal = (int)hBlendEquation.size() >= count;
+		for (int i = 0; equal && i < count; i++) equal = hBlendEquation[i] == value;
+		if (equal)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		hBlendEquation.assign(count, value);
+		blendEquation = value;
+		return true;
+	}
+}
+
+static intptr_t floatBits(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(float));
+	return (intptr_t)bits;
+}
+
+bool State::HShouldSetStencilFunc(int face, GLenum cmp, GLint reference, GLuint mask)
+{
+	auto value = std::make_tuple((intptr_t)cmp, (intptr_t)reference, (intptr_t)mask);
+	if (hStencilFunc[face] != value)
+	{
+		hStencilFunc[face] = value;
+		stencilFunc = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
 		return true;
 	}
 	else
@@ -172,7 +297,36 @@ bool State::HShouldSetStencilMode(StencilMode* front, StencilMode* back)
 	}
 }
 
+bool State::HShouldSetStencilOp(int face, GLenum stencilFail, GLenum depthFail, GLenum pass)
+{
+	auto value = std::make_tuple((intptr_t)stencilFail, (intptr_t)depthFail, (intptr_t)pass);
+	if (hStencilOp[face] != value)
+	{
+		hStencilOp[face] = value;
+		stencilOp = std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>(-1, -1, -1, -1);
+		return true;
+	}
+	else
+	{
+		removedInstructions++;
+		return false;
+	}
+}
 
+bool State::HShouldSetPolygonOffset(float factor, float units, float clamp)
+{
+	auto value = std::make_tuple(floatBits(factor), floatBits(units), floatBits(clamp));
+	if (hPolygonOffset != value)
+	{
+		hPolygonOffset = value;
+		return true;
+	}
+	else
+	{
+		removedInstructions++;
+		return false;
+	}
+}
 
 bool State::ShouldSetProgram(intptr_t program)
 {
@@ -193,6 +347,7 @@ bool State::ShouldSetVertexArray(intptr_t vao)
 	if (currentVertexArray != vao)
 	{
 		currentVertexArray = vao;
+		currentVertexInput = nullptr;
 		return true;
 	}
 	else
@@ -246,12 +401,17 @@ bool State::ShouldSetDepthMask(intptr_t mask)
 
 bool State::ShouldSetDrawBuffers(GLuint n, const GLenum* buffers)
 {
-	if (currentDrawBuffers.size() == n)
+	// draw buffers are framebuffer state, so track them per draw framebuffer
+	auto fbo = currentFramebuffer.find(GL_DRAW_FRAMEBUFFER);
+	auto key = fbo != currentFramebuffer.end() ? fbo->second : -1;
+	auto& current = currentDrawBuffers[key];
+
+	if (current.size() == n)
 	{
 		bool equal = true;
 		for (GLuint i = 0; i < n; i++)
 		{
-			if (buffers[i] != currentDrawBuffers[i])
+			if (buffers[i] != current[i])
 			{
 				equal = false;
 				break;
@@ -265,17 +425,133 @@ bool State::ShouldSetDrawBuffers(GLuint n, const GLenum* buffers)
 
 	}
 
-	currentDrawBuffers.clear();
+	current.clear();
 	for (GLuint i = 0; i < n; i++)
 	{
-		currentDrawBuffers.push_back(buffers[i]);
+		current.push_back(buffers[i]);
 	}
 	return true;
 }
 
+bool State::ShouldSetFramebuffer(GLenum target, intptr_t framebuffer)
+{
+	if (target == GL_FRAMEBUFFER)
+	{
+		auto draw = currentFramebuffer.find(GL_DRAW_FRAMEBUFFER);
+		auto read = currentFramebuffer.find(GL_READ_FRAMEBUFFER);
+		if (draw != currentFramebuffer.end() && draw->second == framebuffer &&
+			read != currentFramebuffer.end() && read->second == framebuffer)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		currentFramebuffer[GL_DRAW_FRAMEBUFFER] = framebuffer;
+		currentFramebuffer[GL_READ_FRAMEBUFFER] = framebuffer;
+		return true;
+	}
+	else
+	{
+		auto res = currentFramebuffer.find(target);
+		if (res != currentFramebuffer.end() && res->second == framebuffer)
+		{
+			removedInstructions++;
+			return false;
+		}
+
+		currentFramebuffer[target] = framebuffer;
+		return true;
+	}
+}
+
+bool State::ShouldSetViewport(intptr_t x, intptr_t y, intptr_t w, intptr_t h)
+{
+	if (std::get<0>(currentViewport) != x || std::get<1>(currentViewport) != y || std::get<2>(currentViewport) != w || std::get<3>(currentViewport) != h)
+	{
+		currentViewport = std::make_tuple(x, y, w, h);
+		return true;
+	}
+	else
+	{
+		removedInstructions++;
+		return false;
+	}
+}
+
+bool State::ShouldSetScissor(intptr_t x, intptr_t y, intptr_t w, intptr_t h)
+{
+	if (std::get<0>(currentScissor) != x || std::get<1>(currentScissor) != y || std::get<2>(currentScissor) != w || std::get<3>(currentScissor) != h)
+	{
+		currentScissor = std::make_tuple(x, y, w, h);
+		return true;
+	}
+	else
+	{
+		removedInstructions++;
+		return false;
+	}
+}
+
+bool State::ShouldSetClearColor(intptr_t r, intptr_t g, intptr_t b, intptr_t a)
+{
+	if (std::get<0>(clearColor) != r || std::get<1>(clearColor) != g || std::get<2>(clearColor) != b || std::get<3>(clearColor) != a)
+	{
+		clearColor = std::make_tuple(r, g, b, a);
+		return true;
+	}
+	else
+	{
+		removedInstructions++;
+		return false;
+	}
+}
+
+bool State::ShouldSetClearDepth(intptr_t depth)
+{
+	if (clearDepth != depth)
+	{
+		clearDepth = depth;
+		return true;
+	}
+	else
+	{
+		removedInstructions++;
+		return false;
+	}
+}
+
+bool State::ShouldSetTexParameter(GLenum target, intptr_t name, intptr_t value)
+{
+	// texture parameters are stored in the texture object, so we can only
+	// track them when the currently bound texture is known.
+	auto res = currentTexture.find(target);
+	if (res == currentTexture.end()) return true;
+	auto tex = res->second.find((int)currentActiveTexture);
+	if (tex == res->second.end()) return true;
+
+	auto& parameters = texParameters[tex->second];
+	auto p = parameters.find(name);
+	if (p != parameters.end() && p->second == value)
+	{
+		removedInstructions++;
+		return false;
+	}
+	else
+	{
+		parameters[name] = value;
+		return true;
+	}
+}
+
+void State::InvalidateTextures()
+{
+	currentActiveTexture = -1;
+	currentTexture.clear();
+}
+
 bool State::ShouldSetColorMask(intptr_t index, intptr_t r, intptr_t g, intptr_t b, intptr_t a)
 {
-	int mask = ((r & 1) << 3) | ((g & 1 << 2)) | ((b & 1) << 1) | (a & 1);
+	int mask = ((r & 1) << 3) | ((g & 1) << 2) | ((b & 1) << 1) | (a & 1);
 
 	auto res = currentColorMask.find(index);
 	if (res != currentColorMask.end())
@@ -381,12 +657,18 @@ bool State::ShouldSetBuffer(GLenum target, int index, intptr_t buffer, intptr_t
 	}
 }
 
+void State::InvalidateBuffer(int index)
+{
+	currentBuffer.erase(index);
+}
+
 bool State::ShouldEnable(intptr_t flag)
 {
 	auto res = modes.find(flag);
 	if (res == modes.end() || res->second != true)
 	{
 		modes[flag] = true;
+		if (flag == GL_BLEND) hBlendEnabled.clear();
 		return true;
 	}
 	else
@@ -402,6 +684,7 @@ bool State::ShouldDisable(intptr_t flag)
 	if (res == modes.end() || res->second != false)
 	{
 		modes[flag] = false;
+		if (flag == GL_BLEND) hBlendEnabled.clear();
 		return true;
 	}
 	else
@@ -458,6 +741,7 @@ bool State::ShouldSetBlendFunc(intptr_t srcRgb, intptr_t dstRgb, intptr_t srcAlp
 	if (std::get<0>(blendFunc) != srcRgb || std::get<1>(blendFunc) != dstRgb || std::get<2>(blendFunc) != srcAlpha || std::get<3>(blendFunc) != dstAlpha)
 	{
 		blendFunc = std::make_tuple(srcRgb, dstRgb, srcAlpha, dstAlpha);
+		hBlendFunc.clear();
 		return true;
 	}
 	else
@@ -472,6 +756,7 @@ bool State::ShouldSetBlendEquation(intptr_t arg0, intptr_t arg1)
 	if (std::get<0>(blendEquation) != arg0 || std::get<1>(blendEquation) != arg1)
 	{
 		blendEquation = std::make_tuple(arg0, arg1);
+		hBlendEquation.clear();
 		return true;
 	}
 	else
@@ -500,6 +785,7 @@ bool State::ShouldSetStencilFunc(intptr_t arg0, intptr_t arg1, intptr_t arg2, in
 	if (std::get<0>(stencilFunc) != arg0 || std::get<1>(stencilFunc) != arg1 || std::get<2>(stencilFunc) != arg2 || std::get<3>(stencilFunc) != arg3)
 	{
 		stencilFunc = std::make_tuple(arg0, arg1, arg2, arg3);
+		hStencilFunc[0] = hStencilFunc[1] = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
 		return true;
 	}
 	else
@@ -514,6 +800,7 @@ bool State::ShouldSetStencilOp(intptr_t arg0, intptr_t arg1, intptr_t arg2, intp
 	if (std::get<0>(stencilOp) != arg0 || std::get<1>(stencilOp) != arg1 || std::get<2>(stencilOp) != arg2 || std::get<3>(stencilOp) != arg3)
 	{
 		stencilOp = std::make_tuple(arg0, arg1, arg2, arg3);
+		hStencilOp[0] = hStencilOp[1] = std::tuple<intptr_t, intptr_t, intptr_t>(-1, -1, -1);
 		return true;
 	}
 	else
@@ -547,7 +834,9 @@ bool State::HShouldBindVertexAttributes(VertexInputBinding* binding)
 {
 	if (currentVertexInput != binding)
 	{
+		// the helper binds the vertex array of the binding
 		currentVertexInput = binding;
+		currentVertexArray = -1;
 		return true;
 	}
 	else
@@ -556,3 +845,47 @@ bool State::HShouldBindVertexAttributes(VertexInputBinding* binding)
 		return false;
 	}
 }
+
+bool State::HShouldBindVertexBuffers(intptr_t vao, VertexInputBinding* binding)
+{
+	auto res = hVertexBuffers.find(vao);
+	if (res != hVertexBuffers.end() && res->second == binding)
+	{
+		removedInstructions++;
+		return false;
+	}
+	else
+	{
+		hVertexBuffers[vao] = binding;
+		return true;
+	}
+}
+
+void State::InvalidateVertexArray()
+{
+	if (currentVertexArray >= 0) hVertexBuffers.erase(currentVertexArray);
+	else hVertexBuffers.clear();
+	currentVertexInput = nullptr;
+}
+
+bool State::HShouldSetVertexAttribValue(const VertexValueBinding& value)
+{
+	auto res = hVertexAttribValues.find(value.Index);
+	if (res != hVertexAttribValues.end() &&
+		res->second.Type == value.Type && res->second.Format == value.Format &&
+		memcmp(&res->second.Value, &value.Value, sizeof(VertexAttribValue)) == 0)
+	{
+		removedInstructions++;
+		return false;
+	}
+	else
+	{
+		hVertexAttribValues[value.Index] = value;
+		return true;
+	}
+}
+
+void State::InvalidateVertexAttribValue(uint32_t index)
+{
+	hVertexAttribValues.erase(index);
+}
@@ -143,7 +143,13 @@ private:
 	intptr_t currentDepthMask;
 	intptr_t currentStencilMask;
 	std::unordered_map<intptr_t, int> currentColorMask;
-	std::vector<GLenum> currentDrawBuffers;
+	std::unordered_map<intptr_t, std::vector<GLenum>> currentDrawBuffers;
+	std::unordered_map<GLenum, intptr_t> currentFramebuffer;
+	std::tuple<intptr_t, intptr_t, intptr_t, intptr_t> currentViewport;
+	std::tuple<intptr_t, intptr_t, intptr_t, intptr_t> currentScissor;
+	std::tuple<intptr_t, intptr_t, intptr_t, intptr_t> clearColor;
+	intptr_t clearDepth;
+	std::unordered_map<intptr_t, std::unordered_map<intptr_t, intptr_t>> texParameters;
 
 	std::tuple<intptr_t, intptr_t> currentPolygonMode;
 	std::tuple<intptr_t, intptr_t, intptr_t, intptr_t> blendFunc;
@@ -158,11 +164,19 @@ private:
 	std::unordered_map<int, std::tuple<intptr_t, intptr_t, intptr_t>> currentBuffer;
 	std::unordered_map<intptr_t, bool> modes;
 	
+	std::vector<intptr_t> hBlendEnabled;
+	std::vector<std::tuple<intptr_t, intptr_t, intptr_t, intptr_t>> hBlendFunc;
+	std::vector<std::tuple<intptr_t, intptr_t>> hBlendEquation;
+	std::tuple<intptr_t, intptr_t, intptr_t> hStencilFunc[2];
+	std::tuple<intptr_t, intptr_t, intptr_t> hStencilOp[2];
+	std::tuple<intptr_t, intptr_t, intptr_t> hPolygonOffset;
+
+	std::unordered_map<intptr_t, VertexInputBinding*> hVertexBuffers;
+	std::unordered_map<uint32_t, VertexValueBinding> hVertexAttribValues;
+
 	int* hDepthTest;
 	GLenum* hCullFace;
 	GLenum* hPolygonMode;
-	StencilMode* hStencilModeFront;
-	StencilMode* hStencilModeBack;
 	int* hConservativeRaster;
 	int* hMultisample;
 	VertexInputBinding* currentVertexInput;
@@ -180,6 +194,7 @@ public:
 	bool ShouldSetSampler(int index, intptr_t sampler);
 	bool ShouldSetTexture(GLenum target, intptr_t sampler);
 	bool ShouldSetBuffer(GLenum target, int index, intptr_t buffer, intptr_t offset, intptr_t size);
+	void InvalidateBuffer(int index);
 	bool ShouldEnable(intptr_t flag);
 	bool ShouldDisable(intptr_t flag);
 	bool ShouldSetDepthFunc(intptr_t func);
@@ -195,13 +210,32 @@ public:
 	bool ShouldSetStencilMask(intptr_t depthMask);
 	bool ShouldSetColorMask(intptr_t index, intptr_t r, intptr_t g, intptr_t b, intptr_t a);
 	bool ShouldSetDrawBuffers(GLuint n, const GLenum* buffers);
+	bool ShouldSetFramebuffer(GLenum target, intptr_t framebuffer);
+	bool ShouldSetViewport(intptr_t x, intptr_t y, intptr_t w, intptr_t h);
+	bool ShouldSetScissor(intptr_t x, intptr_t y, intptr_t w, intptr_t h);
+	bool ShouldSetClearColor(intptr_t r, intptr_t g, intptr_t b, intptr_t a);
+	bool ShouldSetClearDepth(intptr_t depth);
+	bool ShouldSetTexParameter(GLenum target, intptr_t name, intptr_t value);
+	void InvalidateTextures();
 
 	bool HShouldSetDepthTest(int* test);
 	bool HShouldSetCullFace(GLenum* face);
 	bool HShouldSetPolygonMode(GLenum* mode);
 	bool HShouldSetBlendModes(int count, BlendMode** mode);
-	bool HShouldSetStencilMode(StencilMode* front, StencilMode* back);
+	// per-attachment blend state, an index < 0 addresses the first count attachments at once
+	bool HShouldSetBlendEnable(int index, int count, int enabled);
+	bool HShouldSetBlendFunc(int index, int count, GLenum src, GLenum dst, GLenum srcAlpha, GLenum dstAlpha);
+	bool HShouldSetBlendEquation(int index, int count, GLenum op, GLenum opAlpha);
+	// per-face stencil state (0 = front, 1 = back)
+	bool HShouldSetStencilFunc(int face, GLenum cmp, GLint reference, GLuint mask);
+	bool HShouldSetStencilOp(int face, GLenum stencilFail, GLenum depthFail, GLenum pass);
+	bool HShouldSetPolygonOffset(float factor, float units, float clamp);
 	bool HShouldBindVertexAttributes(VertexInputBinding* binding);
+	bool HShouldBindVertexBuffers(intptr_t vao, VertexInputBinding* binding);
+	// raw instructions changed the attributes of the bound vertex array
+	void InvalidateVertexArray();
+	bool HShouldSetVertexAttribValue(const VertexValueBinding& value);
+	void InvalidateVertexAttribValue(uint32_t index);
 	bool HShouldSetConservativeRaster(int* enabled);
 	bool HShouldSetMultisample(int* enabled);
 
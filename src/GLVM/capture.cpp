@@ -0,0 +1,581 @@
+#ifndef __GNUC__
+#include "stdafx.h"
+#endif
+
+#include "State.h"
+#include "glvm.h"
+#include <string.h>
+#include <stddef.h>
+#include <unordered_map>
+
+// capture file layout: header, instructions, blobs, relocations, blob data.
+// pointer arguments of the instructions (marked in PointerMask) hold the index of the
+// blob containing the referenced data, pointers inside blobs are described by relocations.
+#define CAPTURE_MAGIC 0x43564C47 // "GLVC"
+#define CAPTURE_VERSION 1
+
+typedef enum {
+	BlobData = 0,		// plain data
+	BlobContext = 1,	// a VAO context handle (void*), replaced by the replay context
+	BlobRing = 2		// a UniformRing, recreated with the captured segment size
+} CaptureBlobKind;
+
+typedef struct {
+	uint32_t	Magic;
+	uint32_t	Version;
+	uint32_t	PointerSize;
+	uint32_t	InstructionCount;
+	uint32_t	BlobCount;
+	uint32_t	RelocationCount;
+	uint64_t	DataSize;
+} CaptureHeader;
+
+typedef struct {
+	uint32_t	Code;
+	uint32_t	PointerMask;
+	int64_t		Args[6];
+} CapturedInstruction;
+
+typedef struct {
+	uint32_t	Kind;
+	uint32_t	Padding;
+	uint64_t	Offset;
+	uint64_t	Size;
+} CapturedBlob;
+
+// the pointer at Offset in Blob points to Target
+typedef struct {
+	uint32_t	Blob;
+	uint32_t	Target;
+	uint64_t	Offset;
+} CapturedRelocation;
+
+class CaptureWriter
+{
+public:
+	std::vector<CapturedInstruction> Instructions;
+	std::vector<CapturedBlob> Blobs;
+	std::vector<CapturedRelocation> Relocations;
+	std::vector<char> Data;
+	bool Created;	// whether the last call to Blob created a new blob
+
+	// returns the blob for the given memory, blobs are shared by all arguments with the same address
+	uint32_t Blob(const void* ptr, size_t size, CaptureBlobKind kind = BlobData)
+	{
+		auto it = indices.find(ptr);
+		Created = it == indices.end();
+		if (!Created) return it->second;
+
+		auto index = (uint32_t)Blobs.size();
+		auto offset = (Data.size() + 15) & ~(size_t)15;
+		Data.resize(offset + size);
+		if (kind == BlobData) memcpy(Data.data() + offset, ptr, size);
+
+		Blobs.push_back({ (uint32_t)kind, 0, (uint64_t)offset, (uint64_t)size });
+		indices[ptr] = index;
+		return index;
+	}
+
+	// captures the memory referenced by the pointer at offset in a newly created blob
+	uint32_t Pointer(uint32_t blob, size_t offset, size_t size)
+	{
+		auto field = (void**)(Data.data() + Blobs[blob].Offset + offset);
+		if (*field == nullptr) return 0;
+
+		auto target = Blob(*field, size);
+		field = (void**)(Data.data() + Blobs[blob].Offset + offset);
+		*field = (void*)(intptr_t)target;
+		Relocations.push_back({ blob, target, (uint64_t)offset });
+		return target;
+	}
+
+	template<typename T>
+	T* Get(uint32_t blob)
+	{
+		return (T*)(Data.data() + Blobs[blob].Offset);
+	}
+
+private:
+	std::unordered_map<const void*, uint32_t> indices;
+};
+
+// captures the pointer arguments (and everything they reference) of the instruction
+static bool captureArguments(CaptureWriter& w, const Instruction* i, CapturedInstruction& c)
+{
+	auto args = &i->Arg0;
+	// captures the argument and returns whether it references data not captured yet
+	uint32_t blob = 0;
+	auto arg = [&](int index, size_t size, CaptureBlobKind kind = BlobData) {
+		if (args[index] == 0) return false;
+		blob = w.Blob((const void*)args[index], size, kind);
+		c.Args[index] = blob;
+		c.PointerMask |= 1u << index;
+		return w.Created;
+	};
+
+	switch (i->Code)
+	{
+	case BindVertexArray:
+		arg(0, sizeof(GLuint));
+		return true;
+
+	case Uniform1fv: case Uniform1iv: arg(2, (size_t)i->Arg1 * 4); return true;
+	case Uniform2fv: case Uniform2iv: arg(2, (size_t)i->Arg1 * 8); return true;
+	case Uniform3fv: case Uniform3iv: arg(2, (size_t)i->Arg1 * 12); return true;
+	case Uniform4fv: case Uniform4iv: arg(2, (size_t)i->Arg1 * 16); return true;
+	case UniformMatrix2fv: arg(3, (size_t)i->Arg1 * 4 * sizeof(GLfloat)); return true;
+	case UniformMatrix3fv: arg(3, (size_t)i->Arg1 * 9 * sizeof(GLfloat)); return true;
+	case UniformMatrix4fv: arg(3, (size_t)i->Arg1 * 16 * sizeof(GLfloat)); return true;
+
+	case MultiDrawArraysIndirect:
+		arg(2, sizeof(GLsizei));
+		return true;
+	case MultiDrawElementsIndirect:
+		arg(3, sizeof(GLsizei));
+		return true;
+	case DrawBuffers:
+		arg(1, (size_t)i->Arg0 * sizeof(GLenum));
+		return true;
+
+	case HDrawArrays:
+	case HDrawElements:
+	{
+		arg(0, sizeof(RuntimeStats));
+		arg(1, sizeof(int));
+		arg(2, sizeof(BeginMode));
+		auto index = i->Code == HDrawArrays ? 3 : 4;
+		auto list = (const DrawCallInfoList*)args[index];
+		if (arg(index, sizeof(DrawCallInfoList)))
+		{
+			w.Pointer(blob, offsetof(DrawCallInfoList, Infos), (size_t)list->Count * sizeof(DrawCallInfo));
+		}
+		return true;
+	}
+	case HDrawArraysIndirect:
+	case HDrawElementsIndirect:
+		arg(0, sizeof(RuntimeStats));
+		arg(1, sizeof(int));
+		arg(2, sizeof(BeginMode));
+		arg(i->Code == HDrawArraysIndirect ? 3 : 4, sizeof(IndirectDrawArgs));
+		return true;
+
+	case HSetDepthTest:
+	case HSetConservativeRaster:
+	case HSetMultisample:
+		arg(0, sizeof(int));
+		return true;
+	case HSetDepthBias:
+		arg(0, sizeof(DepthBiasInfo));
+		return true;
+	case HSetCullFace:
+	case HSetPolygonMode:
+		arg(0, sizeof(GLenum));
+		return true;
+	case HSetBlendModes:
+		if (arg(1, sizeof(BlendMode*))) w.Pointer(blob, 0, (size_t)i->Arg0 * sizeof(BlendMode));
+		return true;
+	case HSetStencilMode:
+		arg(0, sizeof(StencilMode));
+		arg(1, sizeof(StencilMode));
+		return true;
+
+	case HBindVertexAttributes:
+	{
+		arg(0, sizeof(void*), BlobContext);
+		auto binding = (const VertexInputBinding*)args[1];
+		if (!arg(1, sizeof(VertexInputBinding))) return true;
+		w.Pointer(blob, offsetof(VertexInputBinding, BufferBindings), (size_t)binding->BufferBindingCount * sizeof(VertexBufferBinding));
+		w.Pointer(blob, offsetof(VertexInputBinding, ValueBindings), (size_t)binding->ValueBindingCount * sizeof(VertexValueBinding));
+
+		// the VAO is created again for the replay context
+		auto captured = w.Get<VertexInputBinding>(blob);
+		captured->VAO = 0;
+		captured->VAOContext = nullptr;
+		return true;
+	}
+
+	case HBindTextures:
+		arg(2, (size_t)i->Arg1 * sizeof(GLenum));
+		arg(3, (size_t)i->Arg1 * sizeof(GLuint));
+		return true;
+	case HBindSamplers:
+		arg(2, (size_t)i->Arg1 * sizeof(GLuint));
+		return true;
+
+	case HUploadUniformBlocks:
+	{
+		auto ring = (const UniformRing*)i->Arg0;
+		if (arg(0, sizeof(GLsizeiptr), BlobRing)) *w.Get<GLsizeiptr>(blob) = ring->SegmentSize;
+
+		auto blocks = (const UniformBlockUpload*)args[2];
+		if (!arg(2, (size_t)i->Arg1 * sizeof(UniformBlockUpload))) return true;
+		for (int b = 0; b < (int)i->Arg1; b++)
+		{
+			w.Pointer(blob, b * sizeof(UniformBlockUpload) + offsetof(UniformBlockUpload, Data), (size_t)blocks[b].Size);
+		}
+		return true;
+	}
+	case HUniformRingNextFrame:
+	{
+		auto ring = (const UniformRing*)i->Arg0;
+		if (arg(0, sizeof(GLsizeiptr), BlobRing)) *w.Get<GLsizeiptr>(blob) = ring->SegmentSize;
+		return true;
+	}
+
+	default:
+		// all other instructions only have value arguments
+		return i->Code > 0 && i->Code <= Scissor;
+	}
+}
+
+// captures the committed state of the fragment chain
+DllExport(int) vmCapture(const char* path, Fragment* frag)
+{
+	CaptureWriter w;
+
+	for (auto current = frag; current != nullptr; current = current->Next.load(std::memory_order_acquire))
+	{
+		auto version = current->Published.load(std::memory_order_acquire);
+		if (version == nullptr) continue;
+
+		for (auto block : version->Blocks)
+		{
+			for (const auto& i : *block)
+			{
+				CapturedInstruction c;
+				c.Code = (uint32_t)i.Code;
+				c.PointerMask = 0;
+				c.Args[0] = i.Arg0; c.Args[1] = i.Arg1; c.Args[2] = i.Arg2;
+				c.Args[3] = i.Arg3; c.Args[4] = i.Arg4; c.Args[5] = i.Arg5;
+
+				if (!captureArguments(w, &i, c))
+				{
+					printf("[GLVM] cannot capture instruction %d\n", (int)i.Code);
+					return 0;
+				}
+				w.Instructions.push_back(c);
+			}
+		}
+	}
+
+	CaptureHeader header;
+	header.Magic = CAPTURE_MAGIC;
+	header.Version = CAPTURE_VERSION;
+	header.PointerSize = (uint32_t)sizeof(void*);
+	header.InstructionCount = (uint32_t)w.Instructions.size();
+	header.BlobCount = (uint32_t)w.Blobs.size();
+	header.RelocationCount = (uint32_t)w.Relocations.size();
+	header.DataSize = w.Data.size();
+
+	auto file = fopen(path, "wb");
+	if (file == nullptr)
+	{
+		printf("[GLVM] cannot open %s\n", path);
+		return 0;
+	}
+
+	fwrite(&header, sizeof(CaptureHeader), 1, file);
+	fwrite(w.Instructions.data(), sizeof(CapturedInstruction), w.Instructions.size(), file);
+	fwrite(w.Blobs.data(), sizeof(CapturedBlob), w.Blobs.size(), file);
+	fwrite(w.Relocations.data(), sizeof(CapturedRelocation), w.Relocations.size(), file);
+	fwrite(w.Data.data(), 1, w.Data.size(), file);
+	auto failed = ferror(file) != 0;
+	fclose(file);
+
+	return failed ? 0 : 1;
+}
+
+template<typename T>
+static bool readArray(FILE* file, std::vector<T>& dst, uint32_t count, uint64_t& remaining)
+{
+	// a corrupt count must not make us allocate more than the file can hold
+	if (count > remaining / sizeof(T)) return false;
+	remaining -= (uint64_t)count * sizeof(T);
+	dst.resize(count);
+	return count == 0 || fread(dst.data(), sizeof(T), count, file) == count;
+}
+
+static bool knownCode(uint32_t code)
+{
+	// needs to follow the ranges of InstructionCode
+	return (code >= BindVertexArray && code <= Scissor) || (code >= HDrawArrays && code <= HUniformRingNextFrame);
+}
+
+// a pointer argument of an instruction: the kind of blob it needs to reference and the minimum
+// size of that blob (Size, or Size times the value of argument CountArg if CountArg >= 0)
+typedef struct {
+	uint32_t	Kind;
+	uint64_t	Size;
+	int			CountArg;
+} PointerArgument;
+
+// returns the mask of pointer arguments of code and fills their requirements, needs to follow captureArguments
+static uint32_t pointerArguments(uint32_t code, PointerArgument args[6])
+{
+	uint32_t mask = 0;
+	auto arg = [&](int index, uint64_t size, int countArg = -1, CaptureBlobKind kind = BlobData) {
+		args[index].Kind = kind;
+		args[index].Size = size;
+		args[index].CountArg = countArg;
+		mask |= 1u << index;
+	};
+
+	switch (code)
+	{
+	case BindVertexArray: arg(0, sizeof(GLuint)); break;
+
+	case Uniform1fv: case Uniform1iv: arg(2, 4, 1); break;
+	case Uniform2fv: case Uniform2iv: arg(2, 8, 1); break;
+	case Uniform3fv: case Uniform3iv: arg(2, 12, 1); break;
+	case Uniform4fv: case Uniform4iv: arg(2, 16, 1); break;
+	case UniformMatrix2fv: arg(3, 4 * sizeof(GLfloat), 1); break;
+	case UniformMatrix3fv: arg(3, 9 * sizeof(GLfloat), 1); break;
+	case UniformMatrix4fv: arg(3, 16 * sizeof(GLfloat), 1); break;
+
+	case MultiDrawArraysIndirect: arg(2, sizeof(GLsizei)); break;
+	case MultiDrawElementsIndirect: arg(3, sizeof(GLsizei)); break;
+	case DrawBuffers: arg(1, sizeof(GLenum), 0); break;
+
+	case HDrawArrays:
+	case HDrawElements:
+		arg(0, sizeof(RuntimeStats));
+		arg(1, sizeof(int));
+		arg(2, sizeof(BeginMode));
+		arg(code == HDrawArrays ? 3 : 4, sizeof(DrawCallInfoList));
+		break;
+	case HDrawArraysIndirect:
+	case HDrawElementsIndirect:
+		arg(0, sizeof(RuntimeStats));
+		arg(1, sizeof(int));
+		arg(2, sizeof(BeginMode));
+		arg(code == HDrawArraysIndirect ? 3 : 4, sizeof(IndirectDrawArgs));
+		break;
+
+	case HSetDepthTest:
+	case HSetConservativeRaster:
+	case HSetMultisample:
+		arg(0, sizeof(int));
+		break;
+	case HSetDepthBias: arg(0, sizeof(DepthBiasInfo)); break;
+	case HSetCullFace:
+	case HSetPolygonMode:
+		arg(0, sizeof(GLenum));
+		break;
+	case HSetBlendModes: arg(1, sizeof(BlendMode*)); break;
+	case HSetStencilMode:
+		arg(0, sizeof(StencilMode));
+		arg(1, sizeof(StencilMode));
+		break;
+
+	case HBindVertexAttributes:
+		arg(0, sizeof(void*), -1, BlobContext);
+		arg(1, sizeof(VertexInputBinding));
+		break;
+	case HBindTextures:
+		arg(2, sizeof(GLenum), 1);
+		arg(3, sizeof(GLuint), 1);
+		break;
+	case HBindSamplers: arg(2, sizeof(GLuint), 1); break;
+
+	case HUploadUniformBlocks:
+		arg(0, sizeof(GLsizeiptr), -1, BlobRing);
+		arg(2, sizeof(UniformBlockUpload), 1);
+		break;
+	case HUniformRingNextFrame: arg(0, sizeof(GLsizeiptr), -1, BlobRing); break;
+
+	default:
+		break;
+	}
+	return mask;
+}
+
+// checks all indices, ranges and codes read from the file before anything is resolved
+static bool validCapture(const CaptureHeader& header, const std::vector<CapturedInstruction>& instructions,
+						 const std::vector<CapturedBlob>& blobs, const std::vector<CapturedRelocation>& relocations)
+{
+	for (const auto& b : blobs)
+	{
+		if (b.Offset > header.DataSize || b.Size > header.DataSize - b.Offset) return false;
+		switch (b.Kind)
+		{
+		case BlobData:
+			break;
+		case BlobContext:
+		case BlobRing:
+			if ((b.Offset & 7) != 0 || b.Size < sizeof(void*)) return false;
+			break;
+		default:
+			return false;
+		}
+	}
+
+	for (const auto& r : relocations)
+	{
+		if (r.Blob >= header.BlobCount || r.Target >= header.BlobCount) return false;
+		const auto& b = blobs[r.Blob];
+		if (b.Size < sizeof(void*) || r.Offset > b.Size - sizeof(void*) || ((b.Offset + r.Offset) & (sizeof(void*) - 1)) != 0)
+			return false;
+	}
+
+	for (const auto& c : instructions)
+	{
+		if (!knownCode(c.Code)) return false;
+
+		// only pointer arguments may reference blobs
+		PointerArgument pointers[6];
+		auto mask = pointerArguments(c.Code, pointers);
+		if ((c.PointerMask & ~mask) != 0) return false;
+
+		for (int a = 0; a < 6; a++)
+		{
+			if ((mask & (1u << a)) == 0) continue;
+
+			// pointer arguments reference a suitable blob or are null, never a raw address
+			if ((c.PointerMask & (1u << a)) == 0)
+			{
+				if (c.Args[a] != 0) return false;
+				continue;
+			}
+
+			if (c.Args[a] < 0 || (uint64_t)c.Args[a] >= header.BlobCount) return false;
+			const auto& b = blobs[(size_t)c.Args[a]];
+			const auto& p = pointers[a];
+			if (b.Kind != p.Kind) return false;
+
+			uint64_t count = 1;
+			if (p.CountArg >= 0)
+			{
+				if (c.Args[p.CountArg] < 0) return false;
+				count = (uint64_t)c.Args[p.CountArg];
+			}
+			if (b.Size / p.Size < count) return false;
+		}
+	}
+
+	return true;
+}
+
+// loads a capture for replay. needs to be called with the replay context current
+// since uniform rings are created while loading.
+DllExport(Capture*) vmLoadCapture(const char* path, void* context)
+{
+	auto file = fopen(path, "rb");
+	if (file == nullptr)
+	{
+		printf("[GLVM] cannot open %s\n", path);
+		return nullptr;
+	}
+
+	fseek(file, 0, SEEK_END);
+	auto fileSize = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	uint64_t remaining = fileSize > 0 ? (uint64_t)fileSize : 0;
+
+	CaptureHeader header;
+	memset(&header, 0, sizeof(CaptureHeader));
+	std::vector<CapturedInstruction> instructions;
+	std::vector<CapturedBlob> blobs;
+	std::vector<CapturedRelocation> relocations;
+
+	bool ok =
+		remaining >= sizeof(CaptureHeader) &&
+		fread(&header, sizeof(CaptureHeader), 1, file) == 1 &&
+		header.Magic == CAPTURE_MAGIC && header.Version == CAPTURE_VERSION &&
+		header.PointerSize == (uint32_t)sizeof(void*);
+
+	if (ok) remaining -= sizeof(CaptureHeader);
+	ok = ok &&
+		readArray(file, instructions, header.InstructionCount, remaining) &&
+		readArray(file, blobs, header.BlobCount, remaining) &&
+		readArray(file, relocations, header.RelocationCount, remaining) &&
+		header.DataSize <= remaining &&
+		validCapture(header, instructions, blobs, relocations);
+
+	Capture* capture = nullptr;
+	if (ok)
+	{
+		capture = new Capture();
+		capture->Data = new uint64_t[(size_t)(header.DataSize + 7) / 8 + 1];
+		capture->Context = context;
+		capture->Chain = nullptr;
+		ok = header.DataSize == 0 || fread(capture->Data, 1, (size_t)header.DataSize, file) == header.DataSize;
+	}
+	fclose(file);
+
+	if (!ok)
+	{
+		printf("[GLVM] invalid capture %s\n", path);
+		vmDeleteCapture(capture);
+		return nullptr;
+	}
+
+	auto base = (char*)capture->Data;
+	for (const auto& b : blobs)
+	{
+		void* ptr = base + b.Offset;
+		switch (b.Kind)
+		{
+		case BlobContext:
+			*(void**)ptr = context;
+			break;
+		case BlobRing:
+		{
+			auto ring = hglCreateUniformRing(*(GLsizeiptr*)ptr);
+			capture->Rings.push_back(ring);
+			ptr = ring;
+			break;
+		}
+		default:
+			break;
+		}
+		capture->Blobs.push_back(ptr);
+	}
+
+	for (const auto& r : relocations)
+	{
+		*(void**)(base + blobs[r.Blob].Offset + r.Offset) = capture->Blobs[r.Target];
+	}
+
+	auto frag = vmCreate();
+	auto block = vmNewBlock(frag);
+	for (const auto& c : instructions)
+	{
+		intptr_t args[6];
+		for (int a = 0; a < 6; a++)
+		{
+			auto isPointer = (c.PointerMask & (1u << a)) != 0;
+			args[a] = isPointer ? (intptr_t)capture->Blobs[(size_t)c.Args[a]] : (intptr_t)c.Args[a];
+		}
+		vmAppend6(frag, block, (InstructionCode)c.Code, args[0], args[1], args[2], args[3], args[4], args[5]);
+	}
+	vmCommit(frag);
+	capture->Chain = frag;
+
+	return capture;
+}
+
+DllExport(void) vmReplayCapture(Capture* capture, VMMode mode, Statistics& stats)
+{
+	vmRun(capture->Chain, mode, stats);
+}
+
+// passes every captured instruction to the visitor instead of executing it (e.g. for mock dispatch)
+DllExport(void) vmVisitCapture(Capture* capture, void (*visit)(const Instruction*, void*), void* userData)
+{
+	auto version = capture->Chain->Published.load(std::memory_order_acquire);
+	if (version == nullptr) return;
+
+	for (auto block : version->Blocks)
+	{
+		for (const auto& i : *block) visit(&i, userData);
+	}
+}
+
+DllExport(void) vmDeleteCapture(Capture* capture)
+{
+	if (capture == nullptr) return;
+	if (capture->Chain != nullptr) vmDelete(capture->Chain);
+	for (auto ring : capture->Rings) hglDeleteUniformRing(ring);
+	delete[] capture->Data;
+	delete capture;
+}
@@ -5,6 +5,116 @@
 #include "State.h"
 #include "glvm.h"
 
+#ifndef __GNUC__
+#ifndef AMD_INTEGRATED
+extern "C"
+{
+	__declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
+}
+#define AMD_INTEGRATED
+#endif // !AMD_INTEGRATED
+#endif
+
+// GL entry points, loaded by vmInit. defined here rather than in glvm.h so that other
+// translation units (capture.cpp) do not get unused copies.
+#ifndef __APPLE__
+#ifndef __GNUC__
+static PFNGLACTIVETEXTUREPROC							glActiveTexture;
+static PFNGLBLENDCOLORPROC								glBlendColor;
+#endif
+static PFNGLBINDVERTEXARRAYPROC							glBindVertexArray;
+static PFNGLUSEPROGRAMPROC								glUseProgram;
+static PFNGLBINDSAMPLERPROC								glBindSampler;
+static PFNGLBINDBUFFERPROC								glBindBuffer;
+static PFNGLBINDBUFFERBASEPROC							glBindBufferBase;
+static PFNGLBINDBUFFERRANGEPROC							glBindBufferRange;
+static PFNGLBINDFRAMEBUFFERPROC							glBindFramebuffer;
+static PFNGLBLENDFUNCSEPARATEPROC						glBlendFuncSeparate;
+static PFNGLBLENDFUNCSEPARATEIPROC						glBlendFuncSeparatei;
+static PFNGLBLENDEQUATIONSEPARATEPROC					glBlendEquationSeparate;
+static PFNGLBLENDEQUATIONSEPARATEIPROC					glBlendEquationSeparatei;
+static PFNGLENABLEIPROC									glEnablei;
+static PFNGLDISABLEIPROC								glDisablei;
+static PFNGLSTENCILFUNCSEPARATEPROC						glStencilFuncSeparate;
+static PFNGLSTENCILOPSEPARATEPROC						glStencilOpSeparate;
+static PFNGLPATCHPARAMETERIPROC							glPatchParameteri;
+static PFNGLDRAWARRAYSINSTANCEDPROC						glDrawArraysInstanced;
+static PFNGLVERTEXATTRIBPOINTERPROC						glVertexAttribPointer;
+static PFNGLVERTEXATTRIBLPOINTERPROC					glVertexAttribLPointer;
+static PFNGLVERTEXATTRIBIPOINTERPROC					glVertexAttribIPointer;
+static PFNGLUNIFORM1FVPROC								glUniform1fv;
+static PFNGLUNIFORM1IVPROC								glUniform1iv;
+static PFNGLUNIFORM2FVPROC								glUniform2fv;
+static PFNGLUNIFORM2IVPROC								glUniform2iv;
+static PFNGLUNIFORM3FVPROC								glUniform3fv;
+static PFNGLUNIFORM3IVPROC								glUniform3iv;
+static PFNGLUNIFORM4FVPROC								glUniform4fv;
+static PFNGLUNIFORM4IVPROC								glUniform4iv;
+static PFNGLUNIFORMMATRIX2FVPROC						glUniformMatrix2fv;
+static PFNGLUNIFORMMATRIX3FVPROC						glUniformMatrix3fv;
+static PFNGLUNIFORMMATRIX4FVPROC						glUniformMatrix4fv;
+static PFNGLVERTEXATTRIB1FPROC							glVertexAttrib1f;
+static PFNGLVERTEXATTRIB2FPROC							glVertexAttrib2f;
+static PFNGLVERTEXATTRIB3FPROC							glVertexAttrib3f;
+static PFNGLVERTEXATTRIB4FPROC							glVertexAttrib4f;
+static PFNGLVERTEXATTRIB4FVPROC							glVertexAttrib4fv;
+static PFNGLVERTEXATTRIBL4DVPROC						glVertexAttribL4dv;
+static PFNGLVERTEXATTRIB4SVPROC							glVertexAttrib4sv;
+static PFNGLVERTEXATTRIB4IVPROC							glVertexAttrib4iv;
+static PFNGLVERTEXATTRIB4BVPROC							glVertexAttrib4bv;
+static PFNGLVERTEXATTRIB4USVPROC						glVertexAttrib4usv;
+static PFNGLVERTEXATTRIB4UIVPROC						glVertexAttrib4uiv;
+static PFNGLVERTEXATTRIB4UBVPROC						glVertexAttrib4ubv;
+static PFNGLVERTEXATTRIBI4SVPROC						glVertexAttribI4sv;
+static PFNGLVERTEXATTRIBI4IVPROC						glVertexAttribI4iv;
+static PFNGLVERTEXATTRIBI4BVPROC						glVertexAttribI4bv;
+static PFNGLVERTEXATTRIBI4USVPROC						glVertexAttribI4usv;
+static PFNGLVERTEXATTRIBI4UIVPROC						glVertexAttribI4uiv;
+static PFNGLVERTEXATTRIBI4UBVPROC						glVertexAttribI4ubv;
+static PFNGLVERTEXATTRIB4NSVPROC						glVertexAttrib4Nsv;
+static PFNGLVERTEXATTRIB4NIVPROC						glVertexAttrib4Niv;
+static PFNGLVERTEXATTRIB4NBVPROC						glVertexAttrib4Nbv;
+static PFNGLVERTEXATTRIB4NUSVPROC						glVertexAttrib4Nusv;
+static PFNGLVERTEXATTRIB4NUIVPROC						glVertexAttrib4Nuiv;
+static PFNGLVERTEXATTRIB4NUBVPROC						glVertexAttrib4Nubv;
+static PFNGLCOLORMASKIPROC								glColorMaski;
+static PFNGLDRAWBUFFERSPROC								glDrawBuffers;
+static PFNGLMAPBUFFERRANGEPROC							glMapBufferRange;
+static PFNGLUNMAPBUFFERPROC								glUnmapBuffer;
+static PFNGLGETBUFFERPARAMETERIVPROC					glGetBufferParameteriv;
+static PFNGLDRAWELEMENTSBASEVERTEXPROC					glDrawElementsBaseVertex;
+static PFNGLDRAWELEMENTSINSTANCEDPROC					glDrawElementsInstanced;
+static PFNGLGENVERTEXARRAYSPROC							glGenVertexArrays;
+static PFNGLDELETEVERTEXARRAYSPROC						glDeleteVertexArrays;
+static PFNGLENABLEVERTEXATTRIBARRAYPROC					glEnableVertexAttribArray;
+static PFNGLDISABLEVERTEXATTRIBARRAYPROC				glDisableVertexAttribArray;
+static PFNGLVERTEXATTRIBDIVISORPROC						glVertexAttribDivisor;
+static PFNGLDRAWARRAYSINDIRECTPROC                      glDrawArraysIndirect;
+static PFNGLDRAWELEMENTSINDIRECTPROC                    glDrawElementsIndirect;
+static PFNGLGENBUFFERSPROC								glGenBuffers;
+static PFNGLDELETEBUFFERSPROC							glDeleteBuffers;
+static PFNGLFENCESYNCPROC								glFenceSync;
+static PFNGLCLIENTWAITSYNCPROC							glClientWaitSync;
+static PFNGLDELETESYNCPROC								glDeleteSync;
+#endif
+
+static PFNGLDRAWARRAYSINSTANCEDBASEINSTANCEPROC			glDrawArraysInstancedBaseInstance;
+static PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEPROC		glDrawElementsInstancedBaseVertexBaseInstance;
+static PFNGLMULTIDRAWARRAYSINDIRECTPROC					glMultiDrawArraysIndirect;
+static PFNGLMULTIDRAWELEMENTSINDIRECTPROC				glMultiDrawElementsIndirect;
+
+static PFNGLBINDTEXTURESPROC glBindTextures;
+static PFNGLBINDSAMPLERSPROC glBindSamplers;
+static PFNGLPOLYGONOFFSETCLAMP glPolygonOffsetClamp;
+static PFNGLBUFFERSTORAGEPROC glBufferStorage;
+static PFNGLVERTEXATTRIBFORMATPROC glVertexAttribFormat;
+static PFNGLVERTEXATTRIBIFORMATPROC glVertexAttribIFormat;
+static PFNGLVERTEXATTRIBLFORMATPROC glVertexAttribLFormat;
+static PFNGLVERTEXATTRIBBINDINGPROC glVertexAttribBinding;
+static PFNGLVERTEXBINDINGDIVISORPROC glVertexBindingDivisor;
+static PFNGLBINDVERTEXBUFFERPROC glBindVertexBuffer;
+static PFNGLBINDVERTEXBUFFERSPROC glBindVertexBuffers;
+
 #ifdef __APPLE__
 #import <mach-o/dyld.h>
 #import <stdlib.h>
@@ -56,6 +166,15 @@ static PROC getProc(LPCSTR name)
 
 static bool initialized = false;
 
+// the state cache consulted by the high-level helpers on the current thread.
+// set by hglMakeCurrent (called by the managed ContextHandle whenever a context is made current)
+// and temporarily replaced while the interpreter runs with redundancy checks.
+// when null the helpers issue all their GL calls unconditionally.
+static thread_local State* currentState = nullptr;
+
+static std::unordered_map<void*, State*> contextStates;
+static std::mutex stateMtx;
+
 DllExport(void) vmInit()
 {
 	//printf("asdasd\n");
@@ -73,6 +192,15 @@ DllExport(void) vmInit()
 
 	glBindTextures = (PFNGLBINDTEXTURESPROC)getProc("glBindTextures");
 	glBindSamplers = (PFNGLBINDTEXTURESPROC)getProc("glBindSamplers");
+	glBufferStorage = (PFNGLBUFFERSTORAGEPROC)getProc("glBufferStorage");
+
+	glVertexAttribFormat = (PFNGLVERTEXATTRIBFORMATPROC)getProc("glVertexAttribFormat");
+	glVertexAttribIFormat = (PFNGLVERTEXATTRIBIFORMATPROC)getProc("glVertexAttribIFormat");
+	glVertexAttribLFormat = (PFNGLVERTEXATTRIBLFORMATPROC)getProc("glVertexAttribLFormat");
+	glVertexAttribBinding = (PFNGLVERTEXATTRIBBINDINGPROC)getProc("glVertexAttribBinding");
+	glVertexBindingDivisor = (PFNGLVERTEXBINDINGDIVISORPROC)getProc("glVertexBindingDivisor");
+	glBindVertexBuffer = (PFNGLBINDVERTEXBUFFERPROC)getProc("glBindVertexBuffer");
+	glBindVertexBuffers = (PFNGLBINDVERTEXBUFFERSPROC)getProc("glBindVertexBuffers");
 
 
 	#ifndef __APPLE__
@@ -162,6 +290,12 @@ DllExport(void) vmInit()
     glDrawArraysIndirect = (PFNGLDRAWARRAYSINDIRECTPROC)getProc("glDrawArraysIndirect");
     glDrawElementsIndirect = (PFNGLDRAWELEMENTSINDIRECTPROC)getProc("glDrawElementsIndirect");
 
+	glGenBuffers = (PFNGLGENBUFFERSPROC)getProc("glGenBuffers");
+	glDeleteBuffers = (PFNGLDELETEBUFFERSPROC)getProc("glDeleteBuffers");
+	glFenceSync = (PFNGLFENCESYNCPROC)getProc("glFenceSync");
+	glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)getProc("glClientWaitSync");
+	glDeleteSync = (PFNGLDELETESYNCPROC)getProc("glDeleteSync");
+
 	#endif
 
 }
@@ -180,88 +314,245 @@ static size_t getIndexSize(GLenum indexType)
 	}
 }
 
+// epoch based reclamation of fragment data retired while a vmRun may still read it.
+// every running VM occupies a reader slot holding the epoch it started in (0 = free),
+// retired data is freed once all readers started in a later epoch.
+#define EPOCH_READER_SLOTS 64
+
+typedef struct {
+	uint64_t	Epoch;
+	void*		Ptr;
+	void		(*Free)(void*);
+} RetiredPtr;
+
+static std::atomic<uint64_t> globalEpoch(1);
+static std::atomic<uint64_t> readerEpochs[EPOCH_READER_SLOTS];
+static std::vector<RetiredPtr> retiredPtrs;
+static std::mutex retiredMtx;
+
+static void freeBlock(void* ptr) { delete (Block*)ptr; }
+static void freeVersion(void* ptr) { delete (FragmentVersion*)ptr; }
+static void freeFragment(void* ptr) { delete (Fragment*)ptr; }
+
+static int enterEpoch()
+{
+	while (true)
+	{
+		auto epoch = globalEpoch.load();
+		for (int i = 0; i < EPOCH_READER_SLOTS; i++)
+		{
+			uint64_t expected = 0;
+			if (readerEpochs[i].compare_exchange_strong(expected, epoch)) return i;
+		}
+		std::this_thread::yield();
+	}
+}
+
+static void leaveEpoch(int slot)
+{
+	readerEpochs[slot].store(0, std::memory_order_release);
+}
+
+static void retire(void* ptr, void (*free)(void*))
+{
+	auto epoch = globalEpoch.fetch_add(1);
+	retiredMtx.lock();
+	retiredPtrs.push_back({ epoch, ptr, free });
+	retiredMtx.unlock();
+}
+
+DllExport(void) vmReclaim()
+{
+	uint64_t minEpoch = UINT64_MAX;
+	for (int i = 0; i < EPOCH_READER_SLOTS; i++)
+	{
+		auto e = readerEpochs[i].load();
+		if (e != 0 && e < minEpoch) minEpoch = e;
+	}
+
+	retiredMtx.lock();
+	size_t kept = 0;
+	for (size_t i = 0; i < retiredPtrs.size(); i++)
+	{
+		auto& r = retiredPtrs[i];
+		if (r.Epoch < minEpoch) r.Free(r.Ptr);
+		else retiredPtrs[kept++] = r;
+	}
+	retiredPtrs.resize(kept);
+	retiredMtx.unlock();
+}
+
 DllExport(Fragment*) vmCreate()
 {
 	Fragment* ptr = new Fragment();
-	ptr->Instructions = std::vector<std::vector<Instruction>>();
-	ptr->Next = nullptr;
+	ptr->Dirty = false;
+	ptr->Published.store(nullptr);
+	ptr->Next.store(nullptr);
 	return ptr;
 }
 
 DllExport(void) vmDelete(Fragment* frag)
 {
-	frag->Instructions.clear();
-	frag->Next = nullptr;
-	delete frag;
+	for (size_t i = 0; i < frag->Blocks.size(); i++)
+	{
+		if (frag->Owned[i]) delete frag->Blocks[i];
+	}
+	frag->Blocks.clear();
+	frag->Owned.clear();
+	frag->Replaced.clear();
+
+	// the published version may still be read by running VMs
+	auto version = frag->Published.exchange(nullptr);
+	if (version != nullptr)
+	{
+		for (auto block : version->Blocks) retire(block, freeBlock);
+		retire(version, freeVersion);
+	}
+	retire(frag, freeFragment);
+	vmReclaim();
 }
 
 DllExport(bool) vmHasNext(Fragment* frag)
 {
-	return frag->Next != nullptr;
+	return frag->Next.load(std::memory_order_acquire) != nullptr;
 }
 
 DllExport(Fragment*) vmGetNext(Fragment* frag)
 {
-	return frag->Next;
+	return frag->Next.load(std::memory_order_acquire);
 }
 
+// the chain may be modified while VMs are running it: every operation publishes
+// fully linked fragments with a single release store, so a running VM either sees the
+// old or the new chain. unlinked fragments keep their Next pointer, a VM currently
+// executing them continues with the rest of the chain. they must be freed via vmDelete
+// which defers freeing until all running VMs are done.
 
 DllExport(void) vmLink(Fragment* left, Fragment* right)
 {
-	left->Next = right;
+	left->Next.store(right, std::memory_order_release);
 }
 
 DllExport(void) vmUnlink(Fragment* left)
 {
-	left->Next = nullptr;
+	left->Next.store(nullptr, std::memory_order_release);
 }
 
+// inserts the chain first..last after left
+DllExport(void) vmInsertAfter(Fragment* left, Fragment* first, Fragment* last)
+{
+	last->Next.store(left->Next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	left->Next.store(first, std::memory_order_release);
+}
+
+// removes the chain left->Next..last
+DllExport(void) vmRemoveAfter(Fragment* left, Fragment* last)
+{
+	left->Next.store(last->Next.load(std::memory_order_relaxed), std::memory_order_release);
+}
+
+// returns the draft block for modification, copying it if it is published
+static Block* editBlock(Fragment* frag, int block, bool copy)
+{
+	frag->Dirty = true;
+	if (!frag->Owned[block])
+	{
+		auto published = frag->Blocks[block];
+		frag->Replaced.push_back(published);
+		frag->Blocks[block] = copy ? new Block(*published) : new Block();
+		frag->Owned[block] = true;
+	}
+	return frag->Blocks[block];
+}
 
 DllExport(int) vmNewBlock(Fragment* frag)
 {
-	int s = (int)frag->Instructions.size();
-	frag->Instructions.push_back(std::vector<Instruction>());
+	int s = (int)frag->Blocks.size();
+	frag->Blocks.push_back(new Block());
+	frag->Owned.push_back(true);
+	frag->Dirty = true;
 	return s;
 }
 
 DllExport(void) vmClearBlock(Fragment* frag, int block)
 {
-	frag->Instructions[block].clear();
+	editBlock(frag, block, false)->clear();
 }
 
 DllExport(void) vmAppend1(Fragment* frag, int block, InstructionCode code, intptr_t arg0)
 {
-	frag->Instructions[block].push_back({ code, arg0, 0, 0, 0, 0, 0 });
+	editBlock(frag, block, true)->push_back({ code, arg0, 0, 0, 0, 0, 0 });
 }
 
 DllExport(void) vmAppend2(Fragment* frag, int block, InstructionCode code, intptr_t arg0, intptr_t arg1)
 {
-	frag->Instructions[block].push_back({ code, arg0, arg1, 0, 0, 0, 0 });
+	editBlock(frag, block, true)->push_back({ code, arg0, arg1, 0, 0, 0, 0 });
 }
 
 DllExport(void) vmAppend3(Fragment* frag, int block, InstructionCode code, intptr_t arg0, intptr_t arg1, intptr_t arg2)
 {
-	frag->Instructions[block].push_back({ code, arg0, arg1, arg2, 0, 0, 0 });
+	editBlock(frag, block, true)->push_back({ code, arg0, arg1, arg2, 0, 0, 0 });
 }
 
 DllExport(void) vmAppend4(Fragment* frag, int block, InstructionCode code, intptr_t arg0, intptr_t arg1, intptr_t arg2, intptr_t arg3)
 {
-	frag->Instructions[block].push_back({ code, arg0, arg1, arg2, arg3, 0, 0 });
+	editBlock(frag, block, true)->push_back({ code, arg0, arg1, arg2, arg3, 0, 0 });
 }
 
 DllExport(void) vmAppend5(Fragment* frag, int block, InstructionCode code, intptr_t arg0, intptr_t arg1, intptr_t arg2, intptr_t arg3, intptr_t arg4)
 {
-	frag->Instructions[block].push_back({ code, arg0, arg1, arg2, arg3, arg4, 0 });
+	editBlock(frag, block, true)->push_back({ code, arg0, arg1, arg2, arg3, arg4, 0 });
 }
 
 DllExport(void) vmAppend6(Fragment* frag, int block, InstructionCode code, intptr_t arg0, intptr_t arg1, intptr_t arg2, intptr_t arg3, intptr_t arg4, intptr_t arg5)
 {
-	frag->Instructions[block].push_back({ code, arg0, arg1, arg2, arg3, arg4, arg5 });
+	editBlock(frag, block, true)->push_back({ code, arg0, arg1, arg2, arg3, arg4, arg5 });
 }
 
 DllExport(void) vmClear(Fragment* frag)
 {
-	frag->Instructions.clear();
+	for (size_t i = 0; i < frag->Blocks.size(); i++)
+	{
+		if (frag->Owned[i]) delete frag->Blocks[i];
+		else frag->Replaced.push_back(frag->Blocks[i]);
+	}
+	frag->Blocks.clear();
+	frag->Owned.clear();
+	frag->Dirty = true;
+}
+
+DllExport(void) vmCommit(Fragment* frag)
+{
+	if (!frag->Dirty) return;
+
+	auto version = new FragmentVersion();
+	version->Blocks = frag->Blocks;
+	auto old = frag->Published.exchange(version);
+
+	// the draft blocks are shared with the published version from now on
+	frag->Owned.assign(frag->Owned.size(), false);
+	frag->Dirty = false;
+
+	for (auto block : frag->Replaced) retire(block, freeBlock);
+	frag->Replaced.clear();
+	if (old != nullptr) retire(old, freeVersion);
+
+	vmReclaim();
+}
+
+// float arguments are stored bitwise in the integer argument slots
+static inline GLfloat floatArg(intptr_t arg)
+{
+	GLfloat value;
+	memcpy(&value, &arg, sizeof(GLfloat));
+	return value;
+}
+
+static inline GLdouble doubleArg(intptr_t arg)
+{
+	GLdouble value;
+	memcpy(&value, &arg, sizeof(GLdouble));
+	return value;
 }
 
 void runInstruction(Instruction* i)
@@ -383,19 +674,19 @@ void runInstruction(Instruction* i)
 		glTexParameteri((GLenum)i->Arg0, (GLenum)i->Arg1, (GLint)i->Arg2);
 		break;
 	case TexParameterf:
-		glTexParameterf((GLenum)i->Arg0, (GLenum)i->Arg1, *((GLfloat*)&i->Arg2));
+		glTexParameterf((GLenum)i->Arg0, (GLenum)i->Arg1, floatArg(i->Arg2));
 		break;
 	case VertexAttrib1f:
-		glVertexAttrib1f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1));
+		glVertexAttrib1f((GLuint)i->Arg0, floatArg(i->Arg1));
 		break;
 	case VertexAttrib2f:
-		glVertexAttrib2f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1), *((GLfloat*)&i->Arg2));
+		glVertexAttrib2f((GLuint)i->Arg0, floatArg(i->Arg1), floatArg(i->Arg2));
 		break;
 	case VertexAttrib3f:
-		glVertexAttrib3f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1), *((GLfloat*)&i->Arg2), *((GLfloat*)&i->Arg3));
+		glVertexAttrib3f((GLuint)i->Arg0, floatArg(i->Arg1), floatArg(i->Arg2), floatArg(i->Arg3));
 		break;
 	case VertexAttrib4f:
-		glVertexAttrib4f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1), *((GLfloat*)&i->Arg2), *((GLfloat*)&i->Arg3), *((GLfloat*)&i->Arg4));
+		glVertexAttrib4f((GLuint)i->Arg0, floatArg(i->Arg1), floatArg(i->Arg2), floatArg(i->Arg3), floatArg(i->Arg4));
 		break;
 	case BindBuffer:
 		glBindBuffer((GLenum)i->Arg0, (GLuint)i->Arg1);
@@ -418,6 +709,15 @@ void runInstruction(Instruction* i)
 	case DrawBuffers:
 		glDrawBuffers((GLuint)i->Arg0, (const GLenum*)i->Arg1);
 		break;
+	case Scissor:
+		glScissor((GLint)i->Arg0, (GLint)i->Arg1, (GLint)i->Arg2, (GLint)i->Arg3);
+		break;
+	case ClearColor:
+		glClearColor(floatArg(i->Arg0), floatArg(i->Arg1), floatArg(i->Arg2), floatArg(i->Arg3));
+		break;
+	case ClearDepth:
+		glClearDepth(doubleArg(i->Arg0));
+		break;
 
 	case HDrawArrays:
 		hglDrawArrays((RuntimeStats*)i->Arg0, (int*)i->Arg1, (BeginMode*)i->Arg2, (DrawCallInfoList*)i->Arg3);
@@ -464,6 +764,12 @@ void runInstruction(Instruction* i)
 	case HBindSamplers:
 		hglBindSamplers((GLuint)i->Arg0, (GLsizei)i->Arg1, (const GLuint*)i->Arg2);
 		break;
+	case HUploadUniformBlocks:
+		hglUploadUniformBlocks((UniformRing*)i->Arg0, (int)i->Arg1, (const UniformBlockUpload*)i->Arg2);
+		break;
+	case HUniformRingNextFrame:
+		hglUniformRingNextFrame((UniformRing*)i->Arg0);
+		break;
 	default:
 		printf("unknown instruction code: %d\n", i->Code);
 		break;
@@ -472,21 +778,32 @@ void runInstruction(Instruction* i)
 
 Statistics runNoRedundancyChecks(Fragment* frag)
 {
+	// raw instructions bypass the cache of the context, so the helpers must not consult it during the run
+	auto previousState = currentState;
+	currentState = nullptr;
+
 	int total = 0;
 	Fragment* current = frag;
 	while (current != nullptr)
 	{
-		for (auto itb = current->Instructions.begin(); itb != current->Instructions.end(); ++itb)
+		auto version = current->Published.load(std::memory_order_acquire);
+		if (version != nullptr)
 		{
-			for (auto it = itb->begin(); it != itb->end(); ++it)
+			for (auto block : version->Blocks)
 			{
-				runInstruction(&(*it));
-				total++;
+				for (auto it = block->begin(); it != block->end(); ++it)
+				{
+					runInstruction(&(*it));
+					total++;
+				}
 			}
 		}
-		current = current->Next;
+		current = current->Next.load(std::memory_order_acquire);
 	}
 
+	currentState = previousState;
+	if (previousState != nullptr) previousState->Reset();
+
 	return { total, 0 };
 }
 
@@ -495,12 +812,18 @@ Statistics runRedundancyChecks(Fragment* frag)
 	State state;
 	int totalInstructions = 0;
 
+	auto previousState = currentState;
+	currentState = &state;
+
 	Fragment* current = frag;
 	while (current != nullptr)
 	{
-		for (auto itb = current->Instructions.begin(); itb != current->Instructions.end(); ++itb)
+		auto version = current->Published.load(std::memory_order_acquire);
+		auto blockCount = version != nullptr ? version->Blocks.size() : 0;
+		for (size_t b = 0; b < blockCount; b++)
 		{
-			for (auto it = itb->begin(); it != itb->end(); ++it)
+			auto block = version->Blocks[b];
+			for (auto it = block->begin(); it != block->end(); ++it)
 			{
 				totalInstructions++;
 				Instruction* i = &(*it);
@@ -645,10 +968,34 @@ Statistics runRedundancyChecks(Fragment* frag)
 					break;
 
 				case BindFramebuffer:
-					glBindFramebuffer((GLenum)i->Arg0, (GLuint)i->Arg1);
+					if (state.ShouldSetFramebuffer((GLenum)arg0, i->Arg1))
+					{
+						glBindFramebuffer((GLenum)arg0, (GLuint)i->Arg1);
+					}
 					break;
 				case Viewport:
-					glViewport((GLint)i->Arg0, (GLint)i->Arg1, (GLint)i->Arg2, (GLint)i->Arg3);
+					if (state.ShouldSetViewport(arg0, i->Arg1, i->Arg2, i->Arg3))
+					{
+						glViewport((GLint)arg0, (GLint)i->Arg1, (GLint)i->Arg2, (GLint)i->Arg3);
+					}
+					break;
+				case Scissor:
+					if (state.ShouldSetScissor(arg0, i->Arg1, i->Arg2, i->Arg3))
+					{
+						glScissor((GLint)arg0, (GLint)i->Arg1, (GLint)i->Arg2, (GLint)i->Arg3);
+					}
+					break;
+				case ClearColor:
+					if (state.ShouldSetClearColor(arg0, i->Arg1, i->Arg2, i->Arg3))
+					{
+						glClearColor(floatArg(i->Arg0), floatArg(i->Arg1), floatArg(i->Arg2), floatArg(i->Arg3));
+					}
+					break;
+				case ClearDepth:
+					if (state.ShouldSetClearDepth(arg0))
+					{
+						glClearDepth(doubleArg(i->Arg0));
+					}
 					break;
 				case DrawElements:
 					glDrawElements((GLenum)i->Arg0, (GLsizei)i->Arg1, (GLenum)i->Arg2, (GLvoid*)i->Arg3);
@@ -667,6 +1014,7 @@ Statistics runRedundancyChecks(Fragment* frag)
 					break;
 				case VertexAttribPointer:
 					glVertexAttribPointer((GLuint)i->Arg0, (GLint)i->Arg1, (GLenum)i->Arg2, (GLboolean)i->Arg3, (GLsizei)i->Arg4, nullptr);
+					state.InvalidateVertexArray();
 					break;
 				case Uniform1fv:
 					glUniform1fv((GLint)i->Arg0, (GLsizei)i->Arg1, (GLfloat*)i->Arg2);
@@ -703,26 +1051,37 @@ Statistics runRedundancyChecks(Fragment* frag)
 					break;
 
 				case TexParameteri:
-					glTexParameteri((GLenum)i->Arg0, (GLenum)i->Arg1, (GLint)i->Arg2);
+					if (state.ShouldSetTexParameter((GLenum)arg0, i->Arg1, i->Arg2))
+					{
+						glTexParameteri((GLenum)i->Arg0, (GLenum)i->Arg1, (GLint)i->Arg2);
+					}
 					break;
 				case TexParameterf:
-					glTexParameterf((GLenum)i->Arg0, (GLenum)i->Arg1, *((GLfloat*)&i->Arg2));
+					if (state.ShouldSetTexParameter((GLenum)arg0, i->Arg1, i->Arg2))
+					{
+						glTexParameterf((GLenum)i->Arg0, (GLenum)i->Arg1, floatArg(i->Arg2));
+					}
 					break;
 				case VertexAttrib1f:
-					glVertexAttrib1f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1));
+					glVertexAttrib1f((GLuint)i->Arg0, floatArg(i->Arg1));
+					state.InvalidateVertexAttribValue((uint32_t)i->Arg0);
 					break;
 				case VertexAttrib2f:
-					glVertexAttrib2f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1), *((GLfloat*)&i->Arg2));
+					glVertexAttrib2f((GLuint)i->Arg0, floatArg(i->Arg1), floatArg(i->Arg2));
+					state.InvalidateVertexAttribValue((uint32_t)i->Arg0);
 					break;
 				case VertexAttrib3f:
-					glVertexAttrib3f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1), *((GLfloat*)&i->Arg2), *((GLfloat*)&i->Arg3));
+					glVertexAttrib3f((GLuint)i->Arg0, floatArg(i->Arg1), floatArg(i->Arg2), floatArg(i->Arg3));
+					state.InvalidateVertexAttribValue((uint32_t)i->Arg0);
 					break;
 				case VertexAttrib4f:
-					glVertexAttrib4f((GLuint)i->Arg0, *((GLfloat*)&i->Arg1), *((GLfloat*)&i->Arg2), *((GLfloat*)&i->Arg3), *((GLfloat*)&i->Arg4));
+					glVertexAttrib4f((GLuint)i->Arg0, floatArg(i->Arg1), floatArg(i->Arg2), floatArg(i->Arg3), floatArg(i->Arg4));
+					state.InvalidateVertexAttribValue((uint32_t)i->Arg0);
 					break;
 
 				case BindBuffer:
 					glBindBuffer((GLenum)i->Arg0, (GLuint)i->Arg1);
+					if ((GLenum)i->Arg0 == GL_ELEMENT_ARRAY_BUFFER) state.InvalidateVertexArray();
 					break;
 
 				case MultiDrawArraysIndirect:
@@ -753,6 +1112,9 @@ Statistics runRedundancyChecks(Fragment* frag)
 						hglSetDepthTest((int*)i->Arg0);
 					}
 					break;
+				case HSetDepthBias:
+					hglSetDepthBias((DepthBiasInfo*)i->Arg0);
+					break;
 				case HSetCullFace:
 					if (state.HShouldSetCullFace((GLenum*)i->Arg0))
 					{
@@ -772,10 +1134,8 @@ Statistics runRedundancyChecks(Fragment* frag)
 					}
 					break;
 				case HSetStencilMode:
-					if (state.HShouldSetStencilMode((StencilMode*)i->Arg0, (StencilMode*)i->Arg1))
-					{
-						hglSetStencilMode((StencilMode*)i->Arg0, (StencilMode*)i->Arg1);
-					}
+					// redundancies are removed per field by hglSetStencilMode
+					hglSetStencilMode((StencilMode*)i->Arg0, (StencilMode*)i->Arg1);
 					break;
 
 				case HBindVertexAttributes:
@@ -802,6 +1162,7 @@ Statistics runRedundancyChecks(Fragment* frag)
 				case HBindTextures:
 					// TODO: check redundancies
 					hglBindTextures((GLuint)i->Arg0, (GLsizei)i->Arg1, (const GLenum*)i->Arg2, (const GLuint*)i->Arg3);
+					state.InvalidateTextures();
 					break;
 
 				case HBindSamplers:
@@ -809,6 +1170,18 @@ Statistics runRedundancyChecks(Fragment* frag)
 					hglBindSamplers((GLuint)i->Arg0, (GLsizei)i->Arg1, (const GLuint*)i->Arg2);
 					break;
 
+				case HUploadUniformBlocks:
+					hglUploadUniformBlocks((UniformRing*)i->Arg0, (int)i->Arg1, (const UniformBlockUpload*)i->Arg2);
+					for (int b = 0; b < (int)i->Arg1; b++)
+					{
+						// the ring binds a new range on every upload
+						state.InvalidateBuffer((int)((const UniformBlockUpload*)i->Arg2)[b].Index);
+					}
+					break;
+				case HUniformRingNextFrame:
+					hglUniformRingNextFrame((UniformRing*)i->Arg0);
+					break;
+
 				default:
 					printf("unknown instruction code: %d\n", i->Code);
 					break;
@@ -816,9 +1189,13 @@ Statistics runRedundancyChecks(Fragment* frag)
 
 			}
 		}
-		current = current->Next;
+		current = current->Next.load(std::memory_order_acquire);
 	}
 
+	// the run changed GL state behind the back of the cache of the context
+	currentState = previousState;
+	if (previousState != nullptr) previousState->Reset();
+
 	int rem = state.GetRemovedInstructions();
 	state.Reset();
 	return { totalInstructions, rem };
@@ -833,13 +1210,25 @@ DllExport(void) vmRunSingle(Fragment* frag)
 		return;
 	}
 
-	for (auto itb = frag->Instructions.begin(); itb != frag->Instructions.end(); ++itb)
+	auto slot = enterEpoch();
+	auto previousState = currentState;
+	currentState = nullptr;
+
+	auto version = frag->Published.load(std::memory_order_acquire);
+	if (version != nullptr)
 	{
-		for (auto it = itb->begin(); it != itb->end(); ++it)
+		for (auto block : version->Blocks)
 		{
-			runInstruction(&(*it));
+			for (auto it = block->begin(); it != block->end(); ++it)
+			{
+				runInstruction(&(*it));
+			}
 		}
 	}
+
+	currentState = previousState;
+	if (previousState != nullptr) previousState->Reset();
+	leaveEpoch(slot);
 }
 
 DllExport(void) vmRun(Fragment* frag, VMMode mode, Statistics& stats)
@@ -850,6 +1239,8 @@ DllExport(void) vmRun(Fragment* frag, VMMode mode, Statistics& stats)
 		return;
 	}
 
+	// retired fragment data stays alive until the run is finished
+	auto slot = enterEpoch();
 	if ((mode & RuntimeRedundancyChecks) != 0)
 	{
 		auto s = runRedundancyChecks(frag);
@@ -860,9 +1251,67 @@ DllExport(void) vmRun(Fragment* frag, VMMode mode, Statistics& stats)
 		auto s = runNoRedundancyChecks(frag);
 		stats = s;
 	}
+	leaveEpoch(slot);
+}
+
+
+// selects the state cache of ctx (null for none) for the helpers called on this thread.
+// only valid as long as all state changes of the context go through the hgl helpers,
+// hglResetState needs to be called after other code changed the state of the context.
+DllExport(void) hglMakeCurrent(void* ctx)
+{
+	if (ctx == nullptr)
+	{
+		currentState = nullptr;
+		return;
+	}
+
+	stateMtx.lock();
+	auto it = contextStates.find(ctx);
+	if (it != contextStates.end())
+	{
+		currentState = it->second;
+	}
+	else
+	{
+		auto state = new State();
+		contextStates[ctx] = state;
+		currentState = state;
+	}
+	stateMtx.unlock();
 }
 
+DllExport(void) hglResetState(void* ctx)
+{
+	stateMtx.lock();
+	auto it = contextStates.find(ctx);
+	if (it != contextStates.end())
+	{
+		it->second->Reset();
+	}
+	stateMtx.unlock();
+}
+
+DllExport(void) hglDeleteState(void* ctx)
+{
+	stateMtx.lock();
+	auto it = contextStates.find(ctx);
+	if (it != contextStates.end())
+	{
+		if (currentState == it->second) currentState = nullptr;
+		delete it->second;
+		contextStates.erase(it);
+	}
+	stateMtx.unlock();
+}
 
+static void setPatchVertices(GLint vertices)
+{
+	if (currentState == nullptr || currentState->ShouldSetPatchParameter(GL_PATCH_VERTICES, vertices))
+	{
+		glPatchParameteri(GL_PATCH_VERTICES, vertices);
+	}
+}
 
 DllExport(void) hglDrawArrays(RuntimeStats* stats, int* isActive, BeginMode* mode, DrawCallInfoList* infos)
 {
@@ -873,7 +1322,7 @@ DllExport(void) hglDrawArrays(RuntimeStats* stats, int* isActive, BeginMode* mod
 	auto info = infos->Infos;
 	auto m = mode->Mode;
 	auto v = mode->PatchVertices;
-	if (m == GL_PATCHES) glPatchParameteri(GL_PATCH_VERTICES, v);
+	if (m == GL_PATCHES) setPatchVertices(v);
 
 	stats->DrawCalls+=cnt;
 
@@ -904,7 +1353,7 @@ DllExport(void) hglDrawElements(RuntimeStats* stats, int* isActive, BeginMode* m
 	auto info = infos->Infos;
 	auto m = mode->Mode;
 	auto v = mode->PatchVertices;
-	if (m == GL_PATCHES) glPatchParameteri(GL_PATCH_VERTICES, v);
+	if (m == GL_PATCHES) setPatchVertices(v);
 
 	auto indexSize = getIndexSize(indexType);
 
@@ -958,7 +1407,7 @@ DllExport(void) hglDrawArraysIndirect(RuntimeStats* stats, int* isActive, BeginM
 
 	auto m = mode->Mode;
 	auto v = mode->PatchVertices;
-	if (m == GL_PATCHES) glPatchParameteri(GL_PATCH_VERTICES, v);
+	if (m == GL_PATCHES) setPatchVertices(v);
 
 	if (glMultiDrawArraysIndirect == nullptr)
 	{	
@@ -1021,7 +1470,7 @@ DllExport(void) hglDrawElementsIndirect(RuntimeStats* stats, int* isActive, Begi
 
 	auto m = mode->Mode;
 	auto v = mode->PatchVertices;
-	if (m == GL_PATCHES) glPatchParameteri(GL_PATCH_VERTICES, v);
+	if (m == GL_PATCHES) setPatchVertices(v);
 
 	if (glMultiDrawElementsIndirect == nullptr)
 	{
@@ -1097,21 +1546,26 @@ DllExport(void) hglSetDepthBias(DepthBiasInfo* state)
 {
 	trace("hglSetDepthBias\n");
 	auto s = *state;
+	auto cache = currentState;
 	if (s.Constant != 0 || s.SlopeScale != 0)
 	{
-		glEnable(GL_POLYGON_OFFSET_FILL);
-		glEnable(GL_POLYGON_OFFSET_LINE);
-		glEnable(GL_POLYGON_OFFSET_POINT);
-		if (glPolygonOffsetClamp != NULL) // check if extensions is available
-			glPolygonOffsetClamp(s.SlopeScale, s.Constant, s.Clamp);
-		else
-			glPolygonOffset(s.SlopeScale, s.Constant);
+		if (cache == nullptr || cache->ShouldEnable(GL_POLYGON_OFFSET_FILL)) glEnable(GL_POLYGON_OFFSET_FILL);
+		if (cache == nullptr || cache->ShouldEnable(GL_POLYGON_OFFSET_LINE)) glEnable(GL_POLYGON_OFFSET_LINE);
+		if (cache == nullptr || cache->ShouldEnable(GL_POLYGON_OFFSET_POINT)) glEnable(GL_POLYGON_OFFSET_POINT);
+
+		if (cache == nullptr || cache->HShouldSetPolygonOffset(s.SlopeScale, s.Constant, s.Clamp))
+		{
+			if (glPolygonOffsetClamp != NULL) // check if extensions is available
+				glPolygonOffsetClamp(s.SlopeScale, s.Constant, s.Clamp);
+			else
+				glPolygonOffset(s.SlopeScale, s.Constant);
+		}
 	}
 	else
 	{
-		glDisable(GL_POLYGON_OFFSET_FILL);
-		glDisable(GL_POLYGON_OFFSET_LINE);
-		glDisable(GL_POLYGON_OFFSET_POINT);
+		if (cache == nullptr || cache->ShouldDisable(GL_POLYGON_OFFSET_FILL)) glDisable(GL_POLYGON_OFFSET_FILL);
+		if (cache == nullptr || cache->ShouldDisable(GL_POLYGON_OFFSET_LINE)) glDisable(GL_POLYGON_OFFSET_LINE);
+		if (cache == nullptr || cache->ShouldDisable(GL_POLYGON_OFFSET_POINT)) glDisable(GL_POLYGON_OFFSET_POINT);
 	}
 	endtrace("a")
 }
@@ -1139,23 +1593,63 @@ DllExport(void) hglSetPolygonMode(GLenum* mode)
 	endtrace("a")
 }
 
+static bool blendModesEqual(const BlendMode& a, const BlendMode& b)
+{
+	if (a.Enabled != b.Enabled) return false;
+	if (!a.Enabled) return true;
+	return
+		a.SourceFactor == b.SourceFactor && a.DestFactor == b.DestFactor && a.Operation == b.Operation &&
+		a.SourceFactorAlpha == b.SourceFactorAlpha && a.DestFactorAlpha == b.DestFactorAlpha && a.OperationAlpha == b.OperationAlpha;
+}
+
 DllExport(void) hglSetBlendModes(int count, BlendMode** ptr)
 {
 	trace("hglSetBlendMode\n");
 
 	const BlendMode* modes = *ptr;
+	auto s = currentState;
 
-	for (int i = 0; i < count; i++)
+	bool uniform = true;
+	for (int i = 1; uniform && i < count; i++) uniform = blendModesEqual(modes[0], modes[i]);
+
+	if (uniform && count > 0)
 	{
-		if (modes[i].Enabled)
+		// all attachments agree, use the non-indexed variants
+		const auto& m = modes[0];
+		if (m.Enabled)
 		{
-			glEnablei(GL_BLEND, i);
-			glBlendFuncSeparatei(i, modes[i].SourceFactor, modes[i].DestFactor, modes[i].SourceFactorAlpha, modes[i].DestFactorAlpha);
-			glBlendEquationSeparatei(i, modes[i].Operation, modes[i].OperationAlpha);
+			if (s == nullptr || s->HShouldSetBlendEnable(-1, count, 1))
+				glEnable(GL_BLEND);
+			if (s == nullptr || s->HShouldSetBlendFunc(-1, count, m.SourceFactor, m.DestFactor, m.SourceFactorAlpha, m.DestFactorAlpha))
+				glBlendFuncSeparate(m.SourceFactor, m.DestFactor, m.SourceFactorAlpha, m.DestFactorAlpha);
+			if (s == nullptr || s->HShouldSetBlendEquation(-1, count, m.Operation, m.OperationAlpha))
+				glBlendEquationSeparate(m.Operation, m.OperationAlpha);
 		}
 		else
 		{
-			glDisablei(GL_BLEND, i);
+			if (s == nullptr || s->HShouldSetBlendEnable(-1, count, 0))
+				glDisable(GL_BLEND);
+		}
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const auto& m = modes[i];
+			if (m.Enabled)
+			{
+				if (s == nullptr || s->HShouldSetBlendEnable(i, count, 1))
+					glEnablei(GL_BLEND, i);
+				if (s == nullptr || s->HShouldSetBlendFunc(i, count, m.SourceFactor, m.DestFactor, m.SourceFactorAlpha, m.DestFactorAlpha))
+					glBlendFuncSeparatei(i, m.SourceFactor, m.DestFactor, m.SourceFactorAlpha, m.DestFactorAlpha);
+				if (s == nullptr || s->HShouldSetBlendEquation(i, count, m.Operation, m.OperationAlpha))
+					glBlendEquationSeparatei(i, m.Operation, m.OperationAlpha);
+			}
+			else
+			{
+				if (s == nullptr || s->HShouldSetBlendEnable(i, count, 0))
+					glDisablei(GL_BLEND, i);
+			}
 		}
 	}
 
@@ -1180,19 +1674,42 @@ DllExport(void) hglSetColorMasks(int count, int** ptr)
 DllExport(void) hglSetStencilMode(StencilMode* front, StencilMode* back)
 {
 	trace("hglSetStencilMode\n");
+	auto s = currentState;
 	if (!front->Enabled && !back->Enabled)
 	{
-		glDisable(GL_STENCIL_TEST);
+		if (s == nullptr || s->ShouldDisable(GL_STENCIL_TEST)) glDisable(GL_STENCIL_TEST);
 	}
 	else
 	{
-		glEnable(GL_STENCIL_TEST);
+		if (s == nullptr || s->ShouldEnable(GL_STENCIL_TEST)) glEnable(GL_STENCIL_TEST);
+
+		auto setFrontFunc = s == nullptr || s->HShouldSetStencilFunc(0, front->Cmp, front->Reference, front->Mask);
+		auto setBackFunc = s == nullptr || s->HShouldSetStencilFunc(1, back->Cmp, back->Reference, back->Mask);
+		auto sameFunc = front->Cmp == back->Cmp && front->Reference == back->Reference && front->Mask == back->Mask;
+
+		if (setFrontFunc && setBackFunc && sameFunc)
+		{
+			glStencilFuncSeparate(GL_FRONT_AND_BACK, front->Cmp, front->Reference, front->Mask);
+		}
+		else
+		{
+			if (setFrontFunc) glStencilFuncSeparate(GL_FRONT, front->Cmp, front->Reference, front->Mask);
+			if (setBackFunc) glStencilFuncSeparate(GL_BACK, back->Cmp, back->Reference, back->Mask);
+		}
 
-		glStencilFuncSeparate(GL_FRONT, front->Cmp, front->Reference, front->Mask);
-		glStencilOpSeparate(GL_FRONT, front->OpStencilFail, front->OpDepthFail, front->OpPass);
+		auto setFrontOp = s == nullptr || s->HShouldSetStencilOp(0, front->OpStencilFail, front->OpDepthFail, front->OpPass);
+		auto setBackOp = s == nullptr || s->HShouldSetStencilOp(1, back->OpStencilFail, back->OpDepthFail, back->OpPass);
+		auto sameOp = front->OpStencilFail == back->OpStencilFail && front->OpDepthFail == back->OpDepthFail && front->OpPass == back->OpPass;
 
-		glStencilFuncSeparate(GL_BACK, back->Cmp, back->Reference, back->Mask);
-		glStencilOpSeparate(GL_BACK, back->OpStencilFail, back->OpDepthFail, back->OpPass);
+		if (setFrontOp && setBackOp && sameOp)
+		{
+			glStencilOpSeparate(GL_FRONT_AND_BACK, front->OpStencilFail, front->OpDepthFail, front->OpPass);
+		}
+		else
+		{
+			if (setFrontOp) glStencilOpSeparate(GL_FRONT, front->OpStencilFail, front->OpDepthFail, front->OpPass);
+			if (setBackOp) glStencilOpSeparate(GL_BACK, back->OpStencilFail, back->OpDepthFail, back->OpPass);
+		}
 	}
 	endtrace("a")
 }
@@ -1202,39 +1719,869 @@ DllExport(void) hglBindVertexArray(int* vao)
 	glBindVertexArray(*vao);
 }
 
-static std::unordered_map<void*, std::vector<GLuint>> deadVAOs;
+// VAOs released via hglDeleteVAO are pushed onto a lock-free stack of their context by any thread (e.g. finalizers).
+// hglCleanup takes the whole stack of its context, applies the releases and recycles or deletes the dead VAOs.
+typedef struct DeadVAONodeStruct {
+	GLuint						VAO;
+	struct DeadVAONodeStruct*	Next;
+} DeadVAONode;
+
+typedef struct {
+	std::atomic<DeadVAONode*>	Head;
+} DeadVAOQueue;
+
+// a released VAO together with its enabled attributes, needed to reset it for reuse.
+// VAOs unknown to the cache cannot be reset and are deleted.
+typedef struct {
+	GLuint					VAO;
+	bool					Recyclable;
+	std::vector<GLuint>		Attributes;
+} DeadVertexArray;
+
+// guards the VAO caches, only used by render threads
 static std::mutex mtx;
 
+// maximum number of VAOs deleted per hglCleanup call (<= 0 means unbounded).
+// set from any thread, read by the render threads.
+static std::atomic<int> cleanupBudget(1024);
+
+// maximum number of VAOs kept for reuse per context
+static std::atomic<int> vaoPoolCapacity(256);
+
+// a VAO of a context together with its layout, shared by all VertexInputBindings with the same layout.
+// format-only VAOs (hglUseSeparateVertexFormats) only depend on the vertex format, other VAOs capture the
+// buffers and become stale when one of them is deleted (its name may be reused for another buffer).
+typedef struct {
+	bool								SeparateFormat;
+	bool								Stale;
+	int									IndexBuffer;
+	std::vector<VertexBufferBinding>	BufferBindings;
+	GLuint								VAO;
+	int									RefCount;
+} SharedVertexArray;
+
+// the VAOs of a context. ctx is a key chosen by the caller (ContextHandle), which must not be reused
+// after hglDeleteContextCache, so that late releases of a deleted context can be told apart.
+typedef struct {
+	std::unordered_map<size_t, std::vector<SharedVertexArray>>	Layouts;
+	std::unordered_map<GLuint, size_t>							Hashes;
+	std::vector<DeadVertexArray>								Pool;
+	std::vector<DeadVertexArray>								Dead;
+	DeadVAOQueue*												Queue;
+	VertexArrayPoolStats										Stats;
+	bool														SeparateFormats;
+} VertexArrayCache;
+
+static std::unordered_map<void*, VertexArrayCache> vaoCaches;
+
+// the release queues of the live contexts (also referenced by their caches). guarded by its own lock,
+// so releasing threads never wait for a render thread working on the caches.
+static std::unordered_map<void*, DeadVAOQueue*> deadVAOQueues;
+static std::mutex queueMtx;
+
+// returns the cache of ctx, creating it if necessary. needs to be called while holding mtx.
+static VertexArrayCache& getVertexArrayCache(void* ctx)
+{
+	auto& cache = vaoCaches[ctx];
+	if (cache.Queue == nullptr)
+	{
+		cache.Queue = new DeadVAOQueue();
+		cache.Queue->Head.store(nullptr, std::memory_order_relaxed);
+
+		queueMtx.lock();
+		deadVAOQueues[ctx] = cache.Queue;
+		queueMtx.unlock();
+	}
+	return cache;
+}
+
+// bumped whenever the vertex format mode of a context may have changed, invalidates the per-thread lookups
+static std::atomic<int> separateFormatsVersion(0);
+
+// number of non-stale shared VAOs (of all contexts) capturing a buffer, lets hglInvalidateBuffer skip unused buffers
+static std::unordered_map<GLuint, int> vaoBufferRefs;
+
+// calls f once per buffer captured by a shared VAO
+template<typename F>
+static void forEachCapturedBuffer(const SharedVertexArray& shared, F f)
+{
+	if (shared.SeparateFormat) return;
+	if (shared.IndexBuffer != 0) f((GLuint)shared.IndexBuffer);
+	for (const auto& b : shared.BufferBindings)
+	{
+		if (b.Buffer != 0) f((GLuint)b.Buffer);
+	}
+}
+
+// needs to be called while holding mtx
+static void addBufferRefs(const SharedVertexArray& shared)
+{
+	forEachCapturedBuffer(shared, [](GLuint buffer) { vaoBufferRefs[buffer]++; });
+}
+
+// needs to be called while holding mtx
+static void removeBufferRefs(const SharedVertexArray& shared)
+{
+	forEachCapturedBuffer(shared, [](GLuint buffer)
+	{
+		auto it = vaoBufferRefs.find(buffer);
+		if (it != vaoBufferRefs.end() && --it->second <= 0) vaoBufferRefs.erase(it);
+	});
+}
+
+// decrements the reference count of a shared VAO and returns whether it is dead.
+// needs to be called while holding mtx.
+static bool releaseVertexArray(VertexArrayCache& cache, DeadVertexArray& dead)
+{
+	dead.Recyclable = false;
+
+	auto h = cache.Hashes.find(dead.VAO);
+	if (h == cache.Hashes.end()) return true;
+
+	auto hash = h->second;
+	auto& bucket = cache.Layouts[hash];
+	for (auto it = bucket.begin(); it != bucket.end(); ++it)
+	{
+		if (it->VAO == dead.VAO)
+		{
+			if (--it->RefCount > 0) return false;
+
+			dead.Recyclable = true;
+			for (const auto& b : it->BufferBindings) dead.Attributes.push_back(b.Index);
+
+			if (!it->Stale) removeBufferRefs(*it);
+			bucket.erase(it);
+			break;
+		}
+	}
+
+	if (bucket.empty()) cache.Layouts.erase(hash);
+	cache.Hashes.erase(h);
+	return true;
+}
+
+DllExport(void) hglSetCleanupBudget(int maxDeletions)
+{
+	cleanupBudget.store(maxDeletions, std::memory_order_relaxed);
+}
+
+DllExport(void) hglSetVertexArrayPoolCapacity(int capacity)
+{
+	vaoPoolCapacity.store(capacity < 0 ? 0 : capacity, std::memory_order_relaxed);
+}
+
+DllExport(void) hglGetVertexArrayPoolStats(void* ctx, VertexArrayPoolStats* stats)
+{
+	mtx.lock();
+	auto c = vaoCaches.find(ctx);
+	if (c != vaoCaches.end())
+	{
+		*stats = c->second.Stats;
+		stats->Pooled = (int)c->second.Pool.size();
+	}
+	else
+	{
+		*stats = VertexArrayPoolStats();
+	}
+	mtx.unlock();
+}
+
+// applies the pending releases and recycles or deletes at most budget (<= 0 means all) dead VAOs of ctx
+static void cleanup(void* ctx, int budget)
+{
+	static thread_local std::vector<GLuint> toDelete;
+	toDelete.clear();
+
+	mtx.lock();
+	auto c = vaoCaches.find(ctx);
+	if (c != vaoCaches.end())
+	{
+		auto& cache = c->second;
+
+		// only the render thread of the context takes from its queue
+		auto node = cache.Queue->Head.exchange(nullptr, std::memory_order_acquire);
+		while (node != nullptr)
+		{
+			DeadVertexArray dead;
+			dead.VAO = node->VAO;
+			if (releaseVertexArray(cache, dead))
+			{
+				cache.Dead.push_back(std::move(dead));
+			}
+
+			auto next = node->Next;
+			delete node;
+			node = next;
+		}
+
+		auto& list = cache.Dead;
+		auto capacity = (size_t)vaoPoolCapacity.load(std::memory_order_relaxed);
+		auto count = list.size();
+		if (budget > 0 && count > (size_t)budget) count = (size_t)budget;
+
+		// handle the back, the remaining ones are handled by the next calls
+		for (size_t i = list.size() - count; i < list.size(); i++)
+		{
+			auto& dead = list[i];
+			if (dead.Recyclable && cache.Pool.size() < capacity)
+			{
+				cache.Pool.push_back(std::move(dead));
+				cache.Stats.Recycled++;
+			}
+			else
+			{
+				toDelete.push_back(dead.VAO);
+				cache.Stats.Deleted++;
+			}
+		}
+
+		list.resize(list.size() - count);
+	}
+	mtx.unlock();
+
+	if (!toDelete.empty()) glDeleteVertexArrays((GLsizei)toDelete.size(), toDelete.data());
+}
+
 DllExport(void) hglCleanup(void* ctx)
 {
+	cleanup(ctx, cleanupBudget.load(std::memory_order_relaxed));
+}
+
+// like hglCleanup but ignores the budget, used when a context is disposed
+DllExport(void) hglCleanupAll(void* ctx)
+{
+	cleanup(ctx, 0);
+}
+
+// releases everything GLVM keeps for a context that is about to be destroyed (needs to be current):
+// deletes the dead, pooled and cached VAOs and forgets the VAO cache and state cache of the context.
+// later releases for the context are dropped, its VAOs die with it.
+DllExport(void) hglDeleteContextCache(void* ctx)
+{
+	cleanup(ctx, 0);
+
+	std::vector<GLuint> vaos;
 	mtx.lock();
-	auto it = deadVAOs.find(ctx);
-	if (it != deadVAOs.end())
+	auto c = vaoCaches.find(ctx);
+	if (c != vaoCaches.end())
 	{
-		glDeleteVertexArrays((GLsizei)it->second.size(), it->second.data());
-		deadVAOs.erase(ctx);
+		// no release can be pushed after the queue is unregistered
+		queueMtx.lock();
+		deadVAOQueues.erase(ctx);
+		queueMtx.unlock();
+
+		auto node = c->second.Queue->Head.exchange(nullptr, std::memory_order_acquire);
+		while (node != nullptr)
+		{
+			auto next = node->Next;
+			delete node;
+			node = next;
+		}
+		delete c->second.Queue;
+
+		for (const auto& dead : c->second.Pool) vaos.push_back(dead.VAO);
+		for (const auto& bucket : c->second.Layouts)
+		{
+			for (const auto& shared : bucket.second)
+			{
+				if (!shared.Stale) removeBufferRefs(shared);
+				vaos.push_back(shared.VAO);
+			}
+		}
+		vaoCaches.erase(c);
+	}
+	mtx.unlock();
+	separateFormatsVersion.fetch_add(1, std::memory_order_release);
+
+	if (!vaos.empty()) glDeleteVertexArrays((GLsizei)vaos.size(), vaos.data());
+	hglDeleteState(ctx);
+}
+
+// needs to be called when a buffer is deleted, VAOs capturing it are no longer handed out.
+// bindings still using them keep them until they are released.
+DllExport(void) hglInvalidateBuffer(GLuint buffer)
+{
+	mtx.lock();
+	if (vaoBufferRefs.erase(buffer) > 0)
+	{
+		for (auto& c : vaoCaches)
+		{
+			for (auto& bucket : c.second.Layouts)
+			{
+				for (auto& shared : bucket.second)
+				{
+					if (shared.Stale) continue;
+
+					bool captured = false;
+					forEachCapturedBuffer(shared, [&](GLuint b) { captured = captured || b == buffer; });
+					if (!captured) continue;
+
+					shared.Stale = true;
+					removeBufferRefs(shared);
+				}
+			}
+		}
 	}
 	mtx.unlock();
 }
 
 DllExport(void) hglDeleteVAO(void* ctx, GLuint vao)
 {
+	queueMtx.lock();
+	auto q = deadVAOQueues.find(ctx);
+	if (q != deadVAOQueues.end())
+	{
+		auto queue = q->second;
+		auto node = new DeadVAONode();
+		node->VAO = vao;
+
+		auto head = queue->Head.load(std::memory_order_relaxed);
+		do
+		{
+			node->Next = head;
+		} while (!queue->Head.compare_exchange_weak(head, node, std::memory_order_release, std::memory_order_relaxed));
+	}
+	queueMtx.unlock();
+}
+
+static void waitForFence(GLsync fence)
+{
+	// 1 second timeout, retry until the segment is no longer in use by the GPU
+	const GLuint64 timeout = 1000000000;
+	while (true)
+	{
+		auto res = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, timeout);
+		if (res == GL_ALREADY_SIGNALED || res == GL_CONDITION_SATISFIED) break;
+		if (res == GL_WAIT_FAILED)
+		{
+			printf("[GLVM] uniform ring: glClientWaitSync failed\n");
+			break;
+		}
+	}
+}
+
+DllExport(UniformRing*) hglCreateUniformRing(GLsizeiptr segmentSize)
+{
+	if (glBufferStorage == nullptr)
+	{
+		printf("[GLVM] uniform ring requires glBufferStorage\n");
+		return nullptr;
+	}
+
+	GLint align = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	if (align <= 0) align = 256;
+	segmentSize = ((segmentSize + align - 1) / align) * align;
+
+	GLsizeiptr totalSize = segmentSize * UNIFORM_RING_SEGMENTS;
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+	glBufferStorage(GL_UNIFORM_BUFFER, totalSize, nullptr, flags);
+	auto data = (char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, totalSize, flags);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+	if (data == nullptr)
+	{
+		printf("[GLVM] could not map uniform ring\n");
+		glDeleteBuffers(1, &buffer);
+		return nullptr;
+	}
+
+	auto ring = new UniformRing();
+	ring->Buffer = buffer;
+	ring->Data = data;
+	ring->SegmentSize = segmentSize;
+	ring->Alignment = align;
+	ring->Segment = 0;
+	ring->Offset = 0;
+	for (int i = 0; i < UNIFORM_RING_SEGMENTS; i++) ring->Fences[i] = nullptr;
+	return ring;
+}
+
+DllExport(void) hglDeleteUniformRing(UniformRing* ring)
+{
+	if (ring == nullptr) return;
+
+	for (int i = 0; i < UNIFORM_RING_SEGMENTS; i++)
+	{
+		if (ring->Fences[i] != nullptr) glDeleteSync(ring->Fences[i]);
+	}
+
+	glBindBuffer(GL_UNIFORM_BUFFER, ring->Buffer);
+	glUnmapBuffer(GL_UNIFORM_BUFFER);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	glDeleteBuffers(1, &ring->Buffer);
+	delete ring;
+}
+
+DllExport(void) hglUniformRingNextFrame(UniformRing* ring)
+{
+	trace("hglUniformRingNextFrame\n");
+
+	// guard the segment written so far
+	auto& current = ring->Fences[ring->Segment];
+	if (current != nullptr) glDeleteSync(current);
+	current = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+	// wait until the GPU is done with the next segment
+	ring->Segment = (ring->Segment + 1) % UNIFORM_RING_SEGMENTS;
+	ring->Offset = 0;
+	auto& next = ring->Fences[ring->Segment];
+	if (next != nullptr)
+	{
+		waitForFence(next);
+		glDeleteSync(next);
+		next = nullptr;
+	}
+	endtrace("a")
+}
+
+DllExport(void) hglUploadUniformBlocks(UniformRing* ring, int count, const UniformBlockUpload* blocks)
+{
+	trace("hglUploadUniformBlocks\n");
+	for (int i = 0; i < count; i++)
+	{
+		const auto& b = blocks[i];
+		if (b.Size > ring->SegmentSize)
+		{
+			printf("[GLVM] uniform block too large for ring: %d\n", (int)b.Size);
+			continue;
+		}
+
+		// the current segment is exhausted, continue in the next one
+		if (ring->Offset + b.Size > ring->SegmentSize) hglUniformRingNextFrame(ring);
+
+		auto offset = ring->Segment * ring->SegmentSize + ring->Offset;
+		memcpy(ring->Data + offset, b.Data, b.Size);
+		glBindBufferRange(GL_UNIFORM_BUFFER, b.Index, ring->Buffer, offset, b.Size);
+
+		ring->Offset += ((b.Size + ring->Alignment - 1) / ring->Alignment) * ring->Alignment;
+	}
+	endtrace("a")
+}
+
+
+// whether ctx uses format-only VAOs (see hglUseSeparateVertexFormats).
+// memoized per thread, since bindings are bound far more often than the current context changes.
+static bool usesSeparateVertexFormats(void* ctx)
+{
+	static thread_local void* lastContext = nullptr;
+	static thread_local int lastVersion = -1;
+	static thread_local bool lastValue = false;
+
+	auto version = separateFormatsVersion.load(std::memory_order_acquire);
+	if (ctx != lastContext || version != lastVersion)
+	{
+		mtx.lock();
+		auto c = vaoCaches.find(ctx);
+		lastValue = c != vaoCaches.end() && c->second.SeparateFormats;
+		mtx.unlock();
+
+		lastContext = ctx;
+		lastVersion = version;
+	}
+	return lastValue;
+}
+
+static size_t hashVertexLayout(const VertexInputBinding* binding, bool separate)
+{
+	// FNV-1a over the vertex format (or all buffer bindings and the index buffer)
+	uint64_t hash = 14695981039346656037ull;
+	auto add = [&hash](const void* data, size_t size)
+	{
+		auto bytes = (const unsigned char*)data;
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+	};
+
+	if (separate)
+	{
+		// buffers, offsets, strides and the index buffer are not part of the format
+		for (int i = 0; i < binding->BufferBindingCount; i++)
+		{
+			const auto& b = binding->BufferBindings[i];
+			add(&b.Index, sizeof(uint32_t));
+			add(&b.Size, sizeof(int));
+			add(&b.Divisor, sizeof(int));
+			add(&b.Type, sizeof(GLenum));
+			add(&b.Format, sizeof(VertexAttribFormat));
+		}
+	}
+	else
+	{
+		add(&binding->IndexBuffer, sizeof(int));
+		add(binding->BufferBindings, sizeof(VertexBufferBinding) * binding->BufferBindingCount);
+	}
+	return (size_t)hash;
+}
+
+static bool sameVertexLayout(const SharedVertexArray& shared, const VertexInputBinding* binding, bool separate)
+{
+	auto count = (size_t)binding->BufferBindingCount;
+	if (shared.Stale || shared.SeparateFormat != separate || shared.BufferBindings.size() != count) return false;
+
+	if (shared.SeparateFormat)
+	{
+		for (size_t i = 0; i < count; i++)
+		{
+			const auto& a = shared.BufferBindings[i];
+			const auto& b = binding->BufferBindings[i];
+			if (a.Index != b.Index || a.Size != b.Size || a.Divisor != b.Divisor || a.Type != b.Type || a.Format != b.Format) return false;
+		}
+		return true;
+	}
+	else
+	{
+		return
+			shared.IndexBuffer == binding->IndexBuffer &&
+			memcmp(shared.BufferBindings.data(), binding->BufferBindings, sizeof(VertexBufferBinding) * count) == 0;
+	}
+}
+
+static GLsizei getAttributeSize(const VertexBufferBinding& b)
+{
+	switch (b.Type)
+	{
+	case GL_BYTE:
+	case GL_UNSIGNED_BYTE: return b.Size;
+	case GL_SHORT:
+	case GL_UNSIGNED_SHORT: return b.Size * 2;
+	case GL_DOUBLE: return b.Size * 8;
+	default: return b.Size * 4;
+	}
+}
+
+// binds a pooled VAO (disabling attributes not used by the binding) or a new one
+static GLuint bindNewVertexArray(const DeadVertexArray* pooled, const VertexInputBinding* binding)
+{
+	uint32_t vao = 0u;
+	if (pooled != nullptr)
+	{
+		vao = pooled->VAO;
+		glBindVertexArray(vao);
+
+		for (auto index : pooled->Attributes)
+		{
+			bool used = false;
+			for (int i = 0; i < binding->BufferBindingCount; i++)
+			{
+				if (binding->BufferBindings[i].Index == index) { used = true; break; }
+			}
+			if (!used) glDisableVertexAttribArray(index);
+		}
+	}
+	else
+	{
+		glGenVertexArrays(1, &vao);
+		glBindVertexArray(vao);
+	}
+	return vao;
+}
+
+static GLuint createVertexFormat(const DeadVertexArray* pooled, const VertexInputBinding* binding)
+{
+	auto vao = bindNewVertexArray(pooled, binding);
+
+	for (uint32_t i = 0; i < (uint32_t)binding->BufferBindingCount; i++)
+	{
+		const auto& b = binding->BufferBindings[i];
+
+		glEnableVertexAttribArray(b.Index);
+
+		switch (b.Type)
+		{
+			case GL_FLOAT:
+				glVertexAttribFormat(b.Index, b.Size, b.Type, GL_FALSE, 0);
+				break;
+
+			case GL_DOUBLE:
+				glVertexAttribLFormat(b.Index, b.Size, b.Type, 0);
+				break;
+
+			case GL_BYTE:
+			case GL_UNSIGNED_BYTE:
+			case GL_SHORT:
+			case GL_UNSIGNED_SHORT:
+			case GL_INT:
+			case GL_UNSIGNED_INT:
+				if (b.Format == VertexAttribFormat::Default)
+				{
+					glVertexAttribIFormat(b.Index, b.Size, b.Type, 0);
+				}
+				else
+				{
+					auto norm = (b.Format == VertexAttribFormat::Normalized);
+					glVertexAttribFormat(b.Index, b.Size, b.Type, norm, 0);
+				}
+				break;
+
+			default:
+				printf("[GLVM] unsupported attribute type: %d\n", (int)b.Type);
+				break;
+		}
+
+		// every attribute gets its own binding point with the same index
+		glVertexAttribBinding(b.Index, b.Index);
+		glVertexBindingDivisor(b.Index, (uint32_t)b.Divisor);
+	}
+
+	return vao;
+}
+
+// binds the buffers of the binding to the currently bound format VAO
+static void bindVertexBuffers(const VertexInputBinding* binding)
+{
+	auto count = binding->BufferBindingCount;
+
+	if (glBindVertexBuffers != nullptr && count > 0)
+	{
+		static thread_local std::vector<GLuint> buffers;
+		static thread_local std::vector<GLintptr> offsets;
+		static thread_local std::vector<GLsizei> strides;
+
+		// multi-bind needs a contiguous range of binding points, unused ones are bound to 0
+		uint32_t first = binding->BufferBindings[0].Index;
+		uint32_t last = first;
+		for (int i = 1; i < count; i++)
+		{
+			auto index = binding->BufferBindings[i].Index;
+			if (index < first) first = index;
+			if (index > last) last = index;
+		}
+
+		auto n = last - first + 1;
+		buffers.assign(n, 0);
+		offsets.assign(n, 0);
+		strides.assign(n, 0);
+
+		for (int i = 0; i < count; i++)
+		{
+			const auto& b = binding->BufferBindings[i];
+			auto slot = b.Index - first;
+			buffers[slot] = (GLuint)b.Buffer;
+			offsets[slot] = (GLintptr)b.Offset;
+			strides[slot] = b.Stride != 0 ? b.Stride : getAttributeSize(b);
+		}
+
+		glBindVertexBuffers(first, (GLsizei)n, buffers.data(), offsets.data(), strides.data());
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			const auto& b = binding->BufferBindings[i];
+			auto stride = b.Stride != 0 ? b.Stride : getAttributeSize(b);
+			glBindVertexBuffer(b.Index, (GLuint)b.Buffer, (GLintptr)b.Offset, stride);
+		}
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, binding->IndexBuffer);
+}
+
+// when enabled, the VAOs of ctx only hold the vertex format (ARB_vertex_attrib_binding) and are shared
+// by all bindings with the same format. buffers and the index buffer are bound per binding.
+// needs to be selected before the first vertex input binding is bound in ctx.
+DllExport(int) hglUseSeparateVertexFormats(void* ctx, int enable)
+{
+	bool separate =
+		enable &&
+		glVertexAttribFormat != nullptr && glVertexAttribIFormat != nullptr && glVertexAttribLFormat != nullptr &&
+		glVertexAttribBinding != nullptr && glVertexBindingDivisor != nullptr && glBindVertexBuffer != nullptr;
+
+	mtx.lock();
+	getVertexArrayCache(ctx).SeparateFormats = separate;
+	mtx.unlock();
+	separateFormatsVersion.fetch_add(1, std::memory_order_release);
+
+	return separate ? 1 : 0;
+}
+
+static GLuint createVertexArray(const DeadVertexArray* pooled, const VertexInputBinding* binding)
+{
+	auto vao = bindNewVertexArray(pooled, binding);
+
+	for (uint32_t i = 0; i < (uint32_t)binding->BufferBindingCount; i++)
+	{
+		const auto& b = binding->BufferBindings[i];
+
+		glEnableVertexAttribArray(b.Index);
+		glBindBuffer(GL_ARRAY_BUFFER, b.Buffer);
+
+		switch (b.Type)
+		{
+			case GL_FLOAT:
+				glVertexAttribPointer(b.Index, b.Size, b.Type, 0, b.Stride, (void*)(size_t)b.Offset);
+				break;
+
+			case GL_DOUBLE:
+				glVertexAttribLPointer(b.Index, b.Size, b.Type, b.Stride, (void*)(size_t)b.Offset);
+				break;
+
+			case GL_BYTE:
+			case GL_UNSIGNED_BYTE:
+			case GL_SHORT:
+			case GL_UNSIGNED_SHORT:
+			case GL_INT:
+			case GL_UNSIGNED_INT:
+				if (b.Format == VertexAttribFormat::Default)
+				{
+					glVertexAttribIPointer(b.Index, b.Size, b.Type, b.Stride, (void*)(size_t)b.Offset);
+				}
+				else
+				{
+					auto norm = (b.Format == VertexAttribFormat::Normalized);
+					glVertexAttribPointer(b.Index, b.Size, b.Type, norm, b.Stride, (void*)(size_t)b.Offset);
+				}
+				break;
+
+			default:
+				printf("[GLVM] unsupported attribute type: %d\n", (int)b.Type);
+				break;
+
+		}
+		glVertexAttribDivisor(b.Index, (uint32_t)b.Divisor);
+	}
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, binding->IndexBuffer);
+	return vao;
+}
+
+// returns a VAO for the layout of the given binding, shared with all other bindings of identical
+// layout in the context. the VAO is bound afterwards.
+static GLuint acquireVertexArray(void* ctx, const VertexInputBinding* binding)
+{
+	auto separate = usesSeparateVertexFormats(ctx);
+	auto hash = hashVertexLayout(binding, separate);
+
 	mtx.lock();
-	auto it = deadVAOs.find(ctx);
-	if (it != deadVAOs.end())
+	auto& layouts = getVertexArrayCache(ctx).Layouts;
+	auto bucket = layouts.find(hash);
+	if (bucket != layouts.end())
+	{
+		for (auto& shared : bucket->second)
+		{
+			if (sameVertexLayout(shared, binding, separate))
+			{
+				shared.RefCount++;
+				auto vao = shared.VAO;
+				mtx.unlock();
+				glBindVertexArray(vao);
+				return vao;
+			}
+		}
+	}
+
+	// reuse a released VAO of the context if possible
+	DeadVertexArray pooled;
+	bool hasPooled = false;
+	auto& cache = getVertexArrayCache(ctx);
+	if (!cache.Pool.empty())
 	{
-		it->second.push_back(vao);
+		pooled = std::move(cache.Pool.back());
+		cache.Pool.pop_back();
+		cache.Stats.Hits++;
+		hasPooled = true;
 	}
 	else
 	{
-		std::vector<GLuint> res;
-		res.push_back(vao);
-		deadVAOs[ctx] = res;
+		cache.Stats.Misses++;
 	}
 	mtx.unlock();
+
+	auto p = hasPooled ? &pooled : nullptr;
+	auto vao = separate ? createVertexFormat(p, binding) : createVertexArray(p, binding);
+
+	SharedVertexArray shared;
+	shared.SeparateFormat = separate;
+	shared.Stale = false;
+	shared.IndexBuffer = binding->IndexBuffer;
+	shared.BufferBindings.assign(binding->BufferBindings, binding->BufferBindings + binding->BufferBindingCount);
+	shared.VAO = vao;
+	shared.RefCount = 1;
+
+	mtx.lock();
+	auto& entry = getVertexArrayCache(ctx);
+	addBufferRefs(shared);
+	entry.Layouts[hash].push_back(shared);
+	entry.Hashes[vao] = hash;
+	mtx.unlock();
+
+	return vao;
 }
 
+static void setVertexAttribValue(const VertexValueBinding& b)
+{
+	switch (b.Type)
+	{
+		case GL_FLOAT:
+			glVertexAttrib4fv(b.Index, (GLfloat*)&b.Value);
+			break;
+
+		case GL_DOUBLE:
+			glVertexAttribL4dv(b.Index, (GLdouble*)&b.Value);
+			break;
+
+		case GL_BYTE:
+			if (b.Format == VertexAttribFormat::Default) glVertexAttribI4bv(b.Index, (GLbyte*)&b.Value);
+			else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nbv(b.Index, (GLbyte*)&b.Value);
+			else glVertexAttrib4bv(b.Index, (GLbyte*)&b.Value);
+			break;
+
+		case GL_UNSIGNED_BYTE:
+			if (b.Format == VertexAttribFormat::Default) glVertexAttribI4ubv(b.Index, (GLubyte*)&b.Value);
+			else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nubv(b.Index, (GLubyte*)&b.Value);
+			else glVertexAttrib4ubv(b.Index, (GLubyte*)&b.Value);
+			break;
+
+		case GL_SHORT:
+			if (b.Format == VertexAttribFormat::Default) glVertexAttribI4sv(b.Index, (GLshort*)&b.Value);
+			else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nsv(b.Index, (GLshort*)&b.Value);
+			else glVertexAttrib4sv(b.Index, (GLshort*)&b.Value);
+			break;
+
+		case GL_UNSIGNED_SHORT:
+			if (b.Format == VertexAttribFormat::Default) glVertexAttribI4usv(b.Index, (GLushort*)&b.Value);
+			else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nusv(b.Index, (GLushort*)&b.Value);
+			else glVertexAttrib4usv(b.Index, (GLushort*)&b.Value);
+			break;
+
+		case GL_INT:
+			if (b.Format == VertexAttribFormat::Default) glVertexAttribI4iv(b.Index, (GLint*)&b.Value);
+			else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Niv(b.Index, (GLint*)&b.Value);
+			else glVertexAttrib4iv(b.Index, (GLint*)&b.Value);
+			break;
+
+		case GL_UNSIGNED_INT:
+			if (b.Format == VertexAttribFormat::Default) glVertexAttribI4uiv(b.Index, (GLuint*)&b.Value);
+			else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nuiv(b.Index, (GLuint*)&b.Value);
+			else glVertexAttrib4uiv(b.Index, (GLuint*)&b.Value);
+			break;
+
+		default:
+			printf("[GLVM] unsupported attribute type: %d\n", (int)b.Type);
+			break;
+	}
+}
 
+DllExport(void) hglSetVertexAttribValues(int count, const VertexValueBinding* values)
+{
+	// generic attribute values are context state, so skip the ones that did not change
+	auto s = currentState;
+	for (int i = 0; i < count; i++)
+	{
+		const auto& b = values[i];
+		if (s == nullptr || s->HShouldSetVertexAttribValue(b))
+		{
+			setVertexAttribValue(b);
+		}
+	}
+}
 
 DllExport(void) hglBindVertexAttributes(void** contextHandle, VertexInputBinding* binding)
 {
@@ -1245,6 +2592,7 @@ DllExport(void) hglBindVertexAttributes(void** contextHandle, VertexInputBinding
 	else
 	{
 		auto currentContext = *contextHandle;
+		auto separate = usesSeparateVertexFormats(currentContext);
 		if (currentContext != binding->VAOContext)
 		{
 			if (binding->VAO > 0)
@@ -1260,117 +2608,36 @@ DllExport(void) hglBindVertexAttributes(void** contextHandle, VertexInputBinding
 				}
 			}
 
-			uint32_t vao = 0u;
-			glGenVertexArrays(1, &vao);
-			glBindVertexArray(vao);
+			binding->VAOContext = currentContext;
+			binding->VAO = acquireVertexArray(currentContext, binding);
 
-			for (uint32_t i = 0; i < (uint32_t)binding->BufferBindingCount; i++)
+			if (separate)
 			{
-				const auto& b = binding->BufferBindings[i];
-
-				glEnableVertexAttribArray(b.Index);
-				glBindBuffer(GL_ARRAY_BUFFER, b.Buffer);
-
-				switch (b.Type)
-				{
-					case GL_FLOAT:
-						glVertexAttribPointer(b.Index, b.Size, b.Type, 0, b.Stride, (void*)(size_t)b.Offset);
-						break;
-
-					case GL_DOUBLE:
-						glVertexAttribLPointer(b.Index, b.Size, b.Type, b.Stride, (void*)(size_t)b.Offset);
-						break;
-
-					case GL_BYTE:
-					case GL_UNSIGNED_BYTE:
-					case GL_SHORT:
-					case GL_UNSIGNED_SHORT:
-					case GL_INT:
-					case GL_UNSIGNED_INT:
-						if (b.Format == VertexAttribFormat::Default)
-						{
-							glVertexAttribIPointer(b.Index, b.Size, b.Type, b.Stride, (void*)(size_t)b.Offset);
-						}
-						else
-						{
-							auto norm = (b.Format == VertexAttribFormat::Normalized);
-							glVertexAttribPointer(b.Index, b.Size, b.Type, norm, b.Stride, (void*)(size_t)b.Offset);
-						}
-						break;
-
-					default:
-						printf("[GLVM] unsupported attribute type: %d\n", (int)b.Type);
-						break;
-
-				}
-				glVertexAttribDivisor(b.Index, (uint32_t)b.Divisor);
+				if (currentState != nullptr) currentState->HShouldBindVertexBuffers(binding->VAO, binding);
+				bindVertexBuffers(binding);
 			}
-
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, binding->IndexBuffer);
-
-			binding->VAOContext = currentContext;
-			binding->VAO = vao;
 		}
 		else
 		{
 			glBindVertexArray((uint32_t)binding->VAO);
+
+			// the format VAO is shared, so rebind the buffers unless this binding was the last one applied to it
+			if (separate && (currentState == nullptr || currentState->HShouldBindVertexBuffers(binding->VAO, binding)))
+			{
+				bindVertexBuffers(binding);
+			}
 		}
 
-		for (uint32_t i = 0; i < (uint32_t)binding->ValueBindingCount; i++)
+		// arrays enabled by the binding may leave the generic values of their attributes undefined
+		if (currentState != nullptr)
 		{
-			const auto& b = binding->ValueBindings[i];
-
-			switch (b.Type)
+			for (uint32_t i = 0; i < (uint32_t)binding->BufferBindingCount; i++)
 			{
-				case GL_FLOAT:
-					glVertexAttrib4fv(b.Index, (GLfloat*)&b.Value);
-					break;
-
-				case GL_DOUBLE:
-					glVertexAttribL4dv(b.Index, (GLdouble*)&b.Value);
-					break;
-
-				case GL_BYTE:
-					if (b.Format == VertexAttribFormat::Default) glVertexAttribI4bv(b.Index, (GLbyte*)&b.Value);
-					else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nbv(b.Index, (GLbyte*)&b.Value);
-					else glVertexAttrib4bv(b.Index, (GLbyte*)&b.Value);
-					break;
-
-				case GL_UNSIGNED_BYTE:
-					if (b.Format == VertexAttribFormat::Default) glVertexAttribI4ubv(b.Index, (GLubyte*)&b.Value);
-					else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nubv(b.Index, (GLubyte*)&b.Value);
-					else glVertexAttrib4ubv(b.Index, (GLubyte*)&b.Value);
-					break;
-
-				case GL_SHORT:
-					if (b.Format == VertexAttribFormat::Default) glVertexAttribI4sv(b.Index, (GLshort*)&b.Value);
-					else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nsv(b.Index, (GLshort*)&b.Value);
-					else glVertexAttrib4sv(b.Index, (GLshort*)&b.Value);
-					break;
-
-				case GL_UNSIGNED_SHORT:
-					if (b.Format == VertexAttribFormat::Default) glVertexAttribI4usv(b.Index, (GLushort*)&b.Value);
-					else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nusv(b.Index, (GLushort*)&b.Value);
-					else glVertexAttrib4usv(b.Index, (GLushort*)&b.Value);
-					break;
-
-				case GL_INT:
-					if (b.Format == VertexAttribFormat::Default) glVertexAttribI4iv(b.Index, (GLint*)&b.Value);
-					else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Niv(b.Index, (GLint*)&b.Value);
-					else glVertexAttrib4iv(b.Index, (GLint*)&b.Value);
-					break;
-
-				case GL_UNSIGNED_INT:
-					if (b.Format == VertexAttribFormat::Default) glVertexAttribI4uiv(b.Index, (GLuint*)&b.Value);
-					else if (b.Format == VertexAttribFormat::Normalized) glVertexAttrib4Nuiv(b.Index, (GLuint*)&b.Value);
-					else glVertexAttrib4uiv(b.Index, (GLuint*)&b.Value);
-					break;
-
-				default:
-					printf("[GLVM] unsupported attribute type: %d\n", (int)b.Type);
-					break;
+				currentState->InvalidateVertexAttribValue(binding->BufferBindings[i].Index);
 			}
 		}
+
+		hglSetVertexAttribValues(binding->ValueBindingCount, binding->ValueBindings);
 	}
 
 }
@@ -1,15 +1,5 @@
 #pragma once
 
-#ifndef __GNUC__
-#ifndef AMD_INTEGRATED
-extern "C"
-{
-	__declspec(dllexport) int AmdPowerXpressRequestHighPerformance = 1;
-}
-#define AMD_INTEGRATED
-#endif // !AMD_INTEGRATED
-#endif
-
 #ifdef __APPLE__
 #include <opengl/gl3.h>
 #define DllExport(t) extern "C" t
@@ -27,82 +17,10 @@ extern "C"
 
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <thread>
 
-#ifndef __APPLE__
-#ifndef __GNUC__
-static PFNGLACTIVETEXTUREPROC							glActiveTexture;
-static PFNGLBLENDCOLORPROC								glBlendColor;
-#endif
-static PFNGLBINDVERTEXARRAYPROC							glBindVertexArray;
-static PFNGLUSEPROGRAMPROC								glUseProgram;
-static PFNGLBINDSAMPLERPROC								glBindSampler;
-static PFNGLBINDBUFFERPROC								glBindBuffer;
-static PFNGLBINDBUFFERBASEPROC							glBindBufferBase;
-static PFNGLBINDBUFFERRANGEPROC							glBindBufferRange;
-static PFNGLBINDFRAMEBUFFERPROC							glBindFramebuffer;
-static PFNGLBLENDFUNCSEPARATEPROC						glBlendFuncSeparate;
-static PFNGLBLENDFUNCSEPARATEIPROC						glBlendFuncSeparatei;
-static PFNGLBLENDEQUATIONSEPARATEPROC					glBlendEquationSeparate;
-static PFNGLBLENDEQUATIONSEPARATEIPROC					glBlendEquationSeparatei;
-static PFNGLENABLEIPROC									glEnablei;
-static PFNGLDISABLEIPROC								glDisablei;
-static PFNGLSTENCILFUNCSEPARATEPROC						glStencilFuncSeparate;
-static PFNGLSTENCILOPSEPARATEPROC						glStencilOpSeparate;
-static PFNGLPATCHPARAMETERIPROC							glPatchParameteri;
-static PFNGLDRAWARRAYSINSTANCEDPROC						glDrawArraysInstanced;
-static PFNGLVERTEXATTRIBPOINTERPROC						glVertexAttribPointer;
-static PFNGLVERTEXATTRIBLPOINTERPROC					glVertexAttribLPointer;
-static PFNGLVERTEXATTRIBIPOINTERPROC					glVertexAttribIPointer;
-static PFNGLUNIFORM1FVPROC								glUniform1fv;
-static PFNGLUNIFORM1IVPROC								glUniform1iv;
-static PFNGLUNIFORM2FVPROC								glUniform2fv;
-static PFNGLUNIFORM2IVPROC								glUniform2iv;
-static PFNGLUNIFORM3FVPROC								glUniform3fv;
-static PFNGLUNIFORM3IVPROC								glUniform3iv;
-static PFNGLUNIFORM4FVPROC								glUniform4fv;
-static PFNGLUNIFORM4IVPROC								glUniform4iv;
-static PFNGLUNIFORMMATRIX2FVPROC						glUniformMatrix2fv;
-static PFNGLUNIFORMMATRIX3FVPROC						glUniformMatrix3fv;
-static PFNGLUNIFORMMATRIX4FVPROC						glUniformMatrix4fv;
-static PFNGLVERTEXATTRIB1FPROC							glVertexAttrib1f;
-static PFNGLVERTEXATTRIB2FPROC							glVertexAttrib2f;
-static PFNGLVERTEXATTRIB3FPROC							glVertexAttrib3f;
-static PFNGLVERTEXATTRIB4FPROC							glVertexAttrib4f;
-static PFNGLVERTEXATTRIB4FVPROC							glVertexAttrib4fv;
-static PFNGLVERTEXATTRIBL4DVPROC						glVertexAttribL4dv;
-static PFNGLVERTEXATTRIB4SVPROC							glVertexAttrib4sv;
-static PFNGLVERTEXATTRIB4IVPROC							glVertexAttrib4iv;
-static PFNGLVERTEXATTRIB4BVPROC							glVertexAttrib4bv;
-static PFNGLVERTEXATTRIB4USVPROC						glVertexAttrib4usv;
-static PFNGLVERTEXATTRIB4UIVPROC						glVertexAttrib4uiv;
-static PFNGLVERTEXATTRIB4UBVPROC						glVertexAttrib4ubv;
-static PFNGLVERTEXATTRIBI4SVPROC						glVertexAttribI4sv;
-static PFNGLVERTEXATTRIBI4IVPROC						glVertexAttribI4iv;
-static PFNGLVERTEXATTRIBI4BVPROC						glVertexAttribI4bv;
-static PFNGLVERTEXATTRIBI4USVPROC						glVertexAttribI4usv;
-static PFNGLVERTEXATTRIBI4UIVPROC						glVertexAttribI4uiv;
-static PFNGLVERTEXATTRIBI4UBVPROC						glVertexAttribI4ubv;
-static PFNGLVERTEXATTRIB4NSVPROC						glVertexAttrib4Nsv;
-static PFNGLVERTEXATTRIB4NIVPROC						glVertexAttrib4Niv;
-static PFNGLVERTEXATTRIB4NBVPROC						glVertexAttrib4Nbv;
-static PFNGLVERTEXATTRIB4NUSVPROC						glVertexAttrib4Nusv;
-static PFNGLVERTEXATTRIB4NUIVPROC						glVertexAttrib4Nuiv;
-static PFNGLVERTEXATTRIB4NUBVPROC						glVertexAttrib4Nubv;
-static PFNGLCOLORMASKIPROC								glColorMaski;
-static PFNGLDRAWBUFFERSPROC								glDrawBuffers;
-static PFNGLMAPBUFFERRANGEPROC							glMapBufferRange;
-static PFNGLUNMAPBUFFERPROC								glUnmapBuffer;
-static PFNGLGETBUFFERPARAMETERIVPROC					glGetBufferParameteriv;
-static PFNGLDRAWELEMENTSBASEVERTEXPROC					glDrawElementsBaseVertex;
-static PFNGLDRAWELEMENTSINSTANCEDPROC					glDrawElementsInstanced;
-static PFNGLGENVERTEXARRAYSPROC							glGenVertexArrays;
-static PFNGLDELETEVERTEXARRAYSPROC						glDeleteVertexArrays;
-static PFNGLENABLEVERTEXATTRIBARRAYPROC					glEnableVertexAttribArray;
-static PFNGLDISABLEVERTEXATTRIBARRAYPROC				glDisableVertexAttribArray;
-static PFNGLVERTEXATTRIBDIVISORPROC						glVertexAttribDivisor;
-static PFNGLDRAWARRAYSINDIRECTPROC                      glDrawArraysIndirect;
-static PFNGLDRAWELEMENTSINDIRECTPROC                    glDrawElementsIndirect;
-#else
+#ifdef __APPLE__
 typedef void (APIENTRYP PFNGLDRAWARRAYSINSTANCEDBASEINSTANCEPROC) (GLenum mode, GLint first, GLsizei count, GLsizei primcount, GLuint baseinstance);
 typedef void (APIENTRYP PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEPROC) (GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei primcount, GLint basevertex, GLuint baseinstance);
 typedef void           (APIENTRYP PFNGLMULTIDRAWARRAYSINDIRECTPROC) (GLenum mode, const void *indirect, GLsizei drawcount, GLsizei stride);
@@ -110,19 +28,24 @@ typedef void           (APIENTRYP PFNGLMULTIDRAWELEMENTSINDIRECTPROC) (GLenum mo
 #endif
 
 
-static PFNGLDRAWARRAYSINSTANCEDBASEINSTANCEPROC			glDrawArraysInstancedBaseInstance;
-static PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXBASEINSTANCEPROC		glDrawElementsInstancedBaseVertexBaseInstance;
-static PFNGLMULTIDRAWARRAYSINDIRECTPROC					glMultiDrawArraysIndirect;
-static PFNGLMULTIDRAWELEMENTSINDIRECTPROC				glMultiDrawElementsIndirect;
-
-
 typedef void (APIENTRYP PFNGLBINDTEXTURESPROC) (GLuint first, GLsizei count, const GLuint *textures);
 typedef void (APIENTRYP PFNGLBINDSAMPLERSPROC) (GLuint first, GLsizei count, const GLuint *samplers);
 typedef void (APIENTRYP PFNGLPOLYGONOFFSETCLAMP) (GLfloat factor, GLfloat bias, GLfloat clamp);
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC) (GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+typedef void (APIENTRYP PFNGLVERTEXATTRIBFORMATPROC) (GLuint attribindex, GLint size, GLenum type, GLboolean normalized, GLuint relativeoffset);
+typedef void (APIENTRYP PFNGLVERTEXATTRIBIFORMATPROC) (GLuint attribindex, GLint size, GLenum type, GLuint relativeoffset);
+typedef void (APIENTRYP PFNGLVERTEXATTRIBLFORMATPROC) (GLuint attribindex, GLint size, GLenum type, GLuint relativeoffset);
+typedef void (APIENTRYP PFNGLVERTEXATTRIBBINDINGPROC) (GLuint attribindex, GLuint bindingindex);
+typedef void (APIENTRYP PFNGLVERTEXBINDINGDIVISORPROC) (GLuint bindingindex, GLuint divisor);
+typedef void (APIENTRYP PFNGLBINDVERTEXBUFFERPROC) (GLuint bindingindex, GLuint buffer, GLintptr offset, GLsizei stride);
+typedef void (APIENTRYP PFNGLBINDVERTEXBUFFERSPROC) (GLuint first, GLsizei count, const GLuint *buffers, const GLintptr *offsets, const GLsizei *strides);
 
-static PFNGLBINDTEXTURESPROC glBindTextures;
-static PFNGLBINDSAMPLERSPROC glBindSamplers;
-static PFNGLPOLYGONOFFSETCLAMP glPolygonOffsetClamp;
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#endif
+#ifndef GL_MAP_COHERENT_BIT
+#define GL_MAP_COHERENT_BIT 0x0080
+#endif
 
 // enum holding the available instruction codes
 typedef enum {
@@ -183,6 +106,7 @@ typedef enum {
 	ColorMask = 55,
 	StencilMask = 56,
 	DrawBuffers = 57,
+	Scissor = 58,
 
 	HDrawArrays = 100,
 	HDrawElements = 101,
@@ -199,6 +123,8 @@ typedef enum {
 	HBindTextures = 112,
 	HBindSamplers = 113,
 	HSetDepthBias = 114,
+	HUploadUniformBlocks = 115,
+	HUniformRingNextFrame = 116,
 
 } InstructionCode;
 
@@ -220,10 +146,25 @@ typedef struct {
 	intptr_t Arg5;
 } Instruction;
 
-// a fragment consists of a substructured vector of instructions
+// a block of instructions, immutable once published by vmCommit
+typedef std::vector<Instruction> Block;
+
+// a consistent snapshot of a fragment's blocks as seen by vmRun.
+// unchanged blocks are shared between consecutive versions.
+typedef struct {
+	std::vector<Block*> Blocks;
+} FragmentVersion;
+
+// a fragment consists of a substructured vector of instructions.
+// edits (vmNewBlock, vmClearBlock, vmAppendN, vmClear) modify a draft which is published
+// by vmCommit, so a single editing thread never blocks threads running the fragment.
 typedef struct FragStruct {
-	std::vector<std::vector<Instruction>> Instructions;
-	struct FragStruct* Next;
+	std::vector<Block*> Blocks;						// draft blocks
+	std::vector<bool> Owned;						// draft block is a private copy (not published yet)
+	std::vector<Block*> Replaced;					// published blocks no longer part of the draft
+	bool Dirty;
+	std::atomic<FragmentVersion*> Published;
+	std::atomic<struct FragStruct*> Next;			// written with release, read with acquire by running VMs
 } Fragment;
 
 // runtime statistics
@@ -232,6 +173,15 @@ typedef struct {
 	int RemovedInstructions;
 } Statistics;
 
+// statistics of the per-context VAO pool
+typedef struct {
+	int Hits;
+	int Misses;
+	int Recycled;
+	int Deleted;
+	int Pooled;
+} VertexArrayPoolStats;
+
 typedef struct IndirectDrawArgsStruct {
 	int Handle;
 	int Count;
@@ -239,6 +189,39 @@ typedef struct IndirectDrawArgsStruct {
 	int Stride;
 } IndirectDrawArgs;
 
+// number of frames that may be in flight for a uniform ring.
+#define UNIFORM_RING_SEGMENTS 3
+
+// a persistently mapped uniform buffer split into UNIFORM_RING_SEGMENTS segments.
+// uniform blocks are copied into the current segment and bound via glBindBufferRange.
+// when advancing, the finished segment is guarded by a fence and the next one
+// is only reused once its previous fence has been signaled.
+typedef struct {
+	GLuint		Buffer;
+	char*		Data;
+	GLsizeiptr	SegmentSize;
+	GLsizeiptr	Alignment;
+	int			Segment;
+	GLsizeiptr	Offset;
+	GLsync		Fences[UNIFORM_RING_SEGMENTS];
+} UniformRing;
+
+typedef struct {
+	GLuint		Index;
+	GLsizeiptr	Size;
+	const void*	Data;
+} UniformBlockUpload;
+
+
+// a captured fragment chain, loaded for replay. pointer arguments point into the
+// captured data, uniform rings and VAO context handles are recreated for the replay context.
+typedef struct {
+	uint64_t*					Data;
+	std::vector<void*>			Blobs;
+	std::vector<UniformRing*>	Rings;
+	void*						Context;
+	Fragment*					Chain;
+} Capture;
 
 DllExport(void) vmInit();
 DllExport(Fragment*) vmCreate();
@@ -247,6 +230,8 @@ DllExport(bool) vmHasNext(Fragment* frag);
 DllExport(Fragment*) vmGetNext(Fragment* frag);
 DllExport(void) vmLink(Fragment* left, Fragment* right);
 DllExport(void) vmUnlink(Fragment* left);
+DllExport(void) vmInsertAfter(Fragment* left, Fragment* first, Fragment* last);
+DllExport(void) vmRemoveAfter(Fragment* left, Fragment* last);
 DllExport(int) vmNewBlock(Fragment* frag);
 DllExport(void) vmClearBlock(Fragment* frag, int block);
 DllExport(void) vmAppend1(Fragment* frag, int block, InstructionCode code, intptr_t arg0);
@@ -256,11 +241,34 @@ DllExport(void) vmAppend4(Fragment* frag, int block, InstructionCode code, intpt
 DllExport(void) vmAppend5(Fragment* frag, int block, InstructionCode code, intptr_t arg0, intptr_t arg1, intptr_t arg2, intptr_t arg3, intptr_t arg4);
 DllExport(void) vmAppend6(Fragment* frag, int block, InstructionCode code, intptr_t arg0, intptr_t arg1, intptr_t arg2, intptr_t arg3, intptr_t arg4, intptr_t arg5);
 DllExport(void) vmClear(Fragment* frag);
+DllExport(void) vmCommit(Fragment* frag);
+DllExport(void) vmReclaim();
 DllExport(void) vmRunSingle(Fragment* frag);
 DllExport(void) vmRun(Fragment* frag, VMMode mode, Statistics& stats);
 
+DllExport(int) vmCapture(const char* path, Fragment* frag);
+DllExport(Capture*) vmLoadCapture(const char* path, void* context);
+DllExport(void) vmReplayCapture(Capture* capture, VMMode mode, Statistics& stats);
+DllExport(void) vmVisitCapture(Capture* capture, void (*visit)(const Instruction*, void*), void* userData);
+DllExport(void) vmDeleteCapture(Capture* capture);
+
 DllExport(void) hglDeleteVAO(void* ctx, GLuint vao);
+DllExport(void) hglInvalidateBuffer(GLuint buffer);
 DllExport(void) hglCleanup(void* ctx);
+DllExport(void) hglCleanupAll(void* ctx);
+DllExport(void) hglDeleteContextCache(void* ctx);
+DllExport(void) hglSetCleanupBudget(int maxDeletions);
+DllExport(void) hglSetVertexArrayPoolCapacity(int capacity);
+DllExport(void) hglGetVertexArrayPoolStats(void* ctx, VertexArrayPoolStats* stats);
+
+DllExport(void) hglMakeCurrent(void* ctx);
+DllExport(void) hglResetState(void* ctx);
+DllExport(void) hglDeleteState(void* ctx);
+
+DllExport(UniformRing*) hglCreateUniformRing(GLsizeiptr segmentSize);
+DllExport(void) hglDeleteUniformRing(UniformRing* ring);
+DllExport(void) hglUniformRingNextFrame(UniformRing* ring);
+DllExport(void) hglUploadUniformBlocks(UniformRing* ring, int count, const UniformBlockUpload* blocks);
 
 DllExport(void) hglDrawArrays(RuntimeStats* stats, int* isActive, BeginMode* mode, DrawCallInfoList* infos);
 DllExport(void) hglDrawElements(RuntimeStats* stats, int* isActive, BeginMode* mode, GLenum indexType, DrawCallInfoList* infos);
@@ -276,6 +284,8 @@ DllExport(void) hglSetColorMasks(int count, int** ptr);
 DllExport(void) hglSetStencilMode(StencilMode* front, StencilMode* back);
 DllExport(void) hglBindVertexArray(int* vao);
 DllExport(void) hglBindVertexAttributes(void** contextHandle, VertexInputBinding* binding);
+DllExport(int) hglUseSeparateVertexFormats(void* ctx, int enable);
+DllExport(void) hglSetVertexAttribValues(int count, const VertexValueBinding* values);
 DllExport(void) hglSetConservativeRaster(int* enable);
 DllExport(void) hglSetMultisample(int* enable);
 
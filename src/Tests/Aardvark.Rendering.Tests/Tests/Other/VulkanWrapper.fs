@@ -1,13 +1,18 @@
 ﻿namespace Aardvark.Rendering.Tests
 
+open System
+open System.IO
 open Aardvark.Rendering.Vulkan
 open Aardvark.Rendering.Vulkan.Memory
 open Aardvark.Rendering.Vulkan.Vulkan14
 open KHRAccelerationStructure
 open KHRFragmentShadingRate
 open NVClusterAccelerationStructure
+open Microsoft.FSharp.NativeInterop
 open Expecto
 
+#nowarn "9"
+
 module ``Vulkan Wrapper Tests`` =
 
     module Arrays =
@@ -187,6 +192,41 @@ module ``Vulkan Wrapper Tests`` =
                 Expect.equal inst.opacityMicromapIndexType opacityMicromapIndexType "bad index type after setter"
             }
 
+    module Serialization =
+
+        let roundtrip =
+            test "Roundtrip" {
+                let path = Path.GetTempFileName()
+                let stream = new VKVM.CommandStream()
+
+                try
+                    // SetLineWidth is 12 bytes, so the handle of BindPipeline is not 8-byte aligned
+                    stream.SetLineWidth(2.0f)
+                    stream.BindPipeline(VkPipelineBindPoint.Graphics, VkPipeline(0x1234UL))
+                    Expect.notEqual (VKVM.vmExport(path, stream.Handle)) 0 "export failed"
+
+                    let imported = VKVM.vmImport path
+                    Expect.notEqual imported 0n "import failed"
+                    Expect.equal (VKVM.vmImportHandleCount imported) 1u "bad handle count"
+                    Expect.equal (NativePtr.read (VKVM.vmImportHandles imported)).Handle 0x1234UL "bad handle"
+
+                    let fragment = NativePtr.read (VKVM.vmImportFragment imported)
+                    Expect.equal fragment.CommandCount 2u "bad command count"
+                    Expect.notEqual fragment.Compiled 0n "imported fragment not compiled"
+                    VKVM.vmImportClose imported
+
+                    // CallFragment references memory outside of the file and must not be imported
+                    let data = File.ReadAllBytes path
+                    let dataOffset = BitConverter.ToUInt64(data, 48) |> int
+                    BitConverter.GetBytes(int VKVM.CommandType.CallFragment).CopyTo(data, dataOffset + 4)
+                    File.WriteAllBytes(path, data)
+                    Expect.equal (VKVM.vmImport path) 0n "corrupted file imported"
+
+                finally
+                    stream.Dispose()
+                    File.Delete path
+            }
+
     [<Tests>]
     let tests =
         testList "VulkanWrapper" [
@@ -211,4 +251,8 @@ module ``Vulkan Wrapper Tests`` =
                 Bitfields.VkAccelerationStructureInstanceKHR
                 Bitfields.VkClusterAccelerationStructureBuildTriangleClusterInfoNV
             ]
+
+            testList "Serialization" [
+                Serialization.roundtrip
+            ]
         ]
\ No newline at end of file
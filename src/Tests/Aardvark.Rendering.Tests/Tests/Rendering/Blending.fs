@@ -151,10 +151,84 @@ module Blending =
             finally
                 r0.Release(); r1.Release(); r2.Release()
 
+        // blend state is diffed against the state of the previous run, so switch between per-attachment and global modes
+        let perAttachmentBlendChanged (runtime : IRuntime) =
+            let clearColor = C4f(0.1, 0.2, 0.3, 0.4)
+            let blendedColor0 = C4f(0.1, 0.1, 0.1, 0.1)
+            let blendedColor1 = C4f.White
+            let blendedColor2 = C4f(0.5, 0.5, 0.5, 0.5)
+
+            use signature =
+                runtime.CreateFramebufferSignature([
+                    Semantic.Output0, TextureFormat.Rgba32f
+                    Semantic.Output1, TextureFormat.Rgba32f
+                    Semantic.Output2, TextureFormat.Rgba32f
+                ])
+
+            let perAttachment =
+                Map.ofList [
+                    Semantic.Output0, BlendMode.Add
+                    Semantic.Output1, BlendMode.None
+                    Semantic.Output2, BlendMode.Multiply
+                ]
+
+            let uniform =
+                Map.ofList [
+                    Semantic.Output0, BlendMode.Add
+                    Semantic.Output1, BlendMode.Add
+                    Semantic.Output2, BlendMode.Add
+                ]
+
+            let modes = AVal.init perAttachment
+
+            use task =
+                Sg.fullScreenQuad
+                |> Sg.shader {
+                    do! Shader.output0 blendedColor0
+                    do! Shader.output1 blendedColor1
+                    do! Shader.output2 blendedColor2
+                }
+                |> Sg.blendModes modes
+                |> Sg.compile runtime signature
+
+            let r0, r1, r2 =
+                let fbo = runtime.CreateFramebuffer(signature, ~~V2i(256))
+                let clear = clear { color clearColor }
+                let output = task |> RenderTask.renderToWithClear fbo clear
+                let o0 = output.GetOutputTexture(Semantic.Output0)
+                let o1 = output.GetOutputTexture(Semantic.Output1)
+                let o2 = output.GetOutputTexture(Semantic.Output2)
+                o0, o1, o2
+
+            r0.Acquire(); r1.Acquire(); r2.Acquire()
+
+            let check (expected0 : C4f) (expected1 : C4f) (expected2 : C4f) =
+                let p0 = r0.GetValue().Download().AsPixImage<float32>()
+                p0 |> PixImage.isColor32f Accuracy.medium (expected0.ToArray())
+
+                let p1 = r1.GetValue().Download().AsPixImage<float32>()
+                p1 |> PixImage.isColor32f Accuracy.medium (expected1.ToArray())
+
+                let p2 = r2.GetValue().Download().AsPixImage<float32>()
+                p2 |> PixImage.isColor32f Accuracy.medium (expected2.ToArray())
+
+            try
+                check (clearColor + blendedColor0) blendedColor1 (clearColor * blendedColor2)
+
+                transact (fun _ -> modes.Value <- uniform)
+                check (clearColor + blendedColor0) (clearColor + blendedColor1) (clearColor + blendedColor2)
+
+                transact (fun _ -> modes.Value <- perAttachment)
+                check (clearColor + blendedColor0) blendedColor1 (clearColor * blendedColor2)
+
+            finally
+                r0.Release(); r1.Release(); r2.Release()
+
     let tests (backend : Backend) =
         [
             "Global (add)",                       Cases.globalBlend BlendMode.Add (+) (+)
             "Global (color multiply, alpha add)", Cases.globalBlend BlendMode.ColorMulAlphaAdd (*) (+)
             "Per attachment",                     Cases.perAttachmentBlend
+            "Per attachment (changed)",           Cases.perAttachmentBlendChanged
         ]
         |> prepareCases backend "Blending"
\ No newline at end of file
@@ -8,6 +8,7 @@ module ``Rendering Tests`` =
 
     let private tests = [
         Blending.tests
+        Stencil.tests
         ColorMasks.tests
         Culling.tests
         RenderTasks.tests
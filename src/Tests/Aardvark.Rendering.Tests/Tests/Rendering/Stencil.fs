@@ -0,0 +1,74 @@
+﻿namespace Aardvark.Rendering.Tests.Rendering
+
+open Aardvark.Base
+open Aardvark.Rendering
+open Aardvark.Rendering.Tests
+open Aardvark.SceneGraph
+open Aardvark.Application
+open FSharp.Data.Adaptive
+open FSharp.Data.Adaptive.Operators
+open Expecto
+
+module Stencil =
+
+    module Cases =
+
+        // stencil state is diffed against the state of the previous run, so change the reference between runs
+        let referenceChanged (runtime : IRuntime) =
+            let clearColor = C4f(0.1, 0.2, 0.3, 0.4)
+            let quadColor = C4f.White
+
+            use signature =
+                runtime.CreateFramebufferSignature([
+                    DefaultSemantic.Colors, TextureFormat.Rgba32f
+                    DefaultSemantic.DepthStencil, TextureFormat.Depth24Stencil8
+                ])
+
+            let reference = AVal.init 1
+
+            let mode =
+                reference |> AVal.map (
+                    StencilMode.simple StencilOperation.Keep StencilOperation.Keep StencilOperation.Keep ComparisonFunction.Equal
+                )
+
+            use task =
+                Sg.fullScreenQuad
+                |> Sg.shader {
+                    do! DefaultSurfaces.constantColor quadColor
+                }
+                |> Sg.stencilMode mode
+                |> Sg.compile runtime signature
+
+            let output =
+                let fbo = runtime.CreateFramebuffer(signature, ~~V2i(256))
+                let clear =
+                    clear {
+                        color clearColor
+                        stencil 1
+                    }
+                let output = task |> RenderTask.renderToWithClear fbo clear
+                output.GetOutputTexture(DefaultSemantic.Colors)
+
+            output.Acquire()
+
+            let check (expected : C4f) =
+                let result = output.GetValue().Download().AsPixImage<float32>()
+                result |> PixImage.isColor32f Accuracy.medium (expected.ToArray())
+
+            try
+                check quadColor
+
+                transact (fun _ -> reference.Value <- 2)
+                check clearColor
+
+                transact (fun _ -> reference.Value <- 1)
+                check quadColor
+
+            finally
+                output.Release()
+
+    let tests (backend : Backend) =
+        [
+            "Reference changed", Cases.referenceChanged
+        ]
+        |> prepareCases backend "Stencil"
@@ -4,27 +4,218 @@
 
 #include "commands.h"
 #include <stdio.h>
-#include <tuple>
-#include <unordered_set>
+#include <string.h>
+#include <thread>
+#include <mutex>
 
 #define get(t,v) ((t##Command*)(v)) 
 #define getptr(t,v,r) (r*)(((char*)((t##Command*)data)->v) + (intptr_t)data) 
 
-typedef struct {
+#ifdef _MSC_VER
+#define FORCEINLINE __forceinline
+#else
+#define FORCEINLINE inline __attribute__((always_inline))
+#endif
+
+// extended dynamic state tracked by CommandState (stencil ops and per-attachment states are not tracked)
+enum DynamicState {
+	DynamicCullMode,
+	DynamicFrontFace,
+	DynamicPrimitiveTopology,
+	DynamicDepthTestEnable,
+	DynamicDepthWriteEnable,
+	DynamicDepthCompareOp,
+	DynamicDepthBoundsTestEnable,
+	DynamicStencilTestEnable,
+	DynamicRasterizerDiscardEnable,
+	DynamicDepthBiasEnable,
+	DynamicPrimitiveRestartEnable,
+	DynamicPatchControlPoints,
+	DynamicLogicOp,
+	DynamicPolygonMode,
+	DynamicRasterizationSamples,
+	DynamicDepthClampEnable,
+	DynamicStencilOpFront,
+	DynamicStencilOpBack,
+	DynamicStateCount
+};
+
+struct CommandState_ {
 	VkPipeline CurrentPipeline;
-} CommandState;
 
-static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, CommandType op, void* data)
+	// values of the dynamic states set in this run, a state is only known if its bit is set.
+	// binding another pipeline (which may have the state static) or running a custom or
+	// secondary command buffer makes them unknown.
+	uint32_t DynamicStateKnown;
+	uint32_t DynamicStates[DynamicStateCount];
+};
+
+static inline void invalidateDynamicState(CommandState* state)
+{
+	state->DynamicStateKnown = 0;
+}
+
+// returns false if the state already has the value
+static inline bool changeDynamicState(CommandState* state, DynamicState index, uint32_t value)
+{
+	auto bit = 1u << index;
+	if ((state->DynamicStateKnown & bit) && state->DynamicStates[index] == value) return false;
+	state->DynamicStateKnown |= bit;
+	state->DynamicStates[index] = value;
+	return true;
+}
+
+// reports each missing function once, the commands using it are skipped on every run
+static void missingFunction(const char* name)
+{
+	static std::mutex reportedMtx;
+	static const char* reported[64];
+	static uint32_t reportedCount = 0;
+
+	std::lock_guard<std::mutex> lock(reportedMtx);
+	for (uint32_t i = 0; i < reportedCount; i++)
+	{
+		if (strcmp(reported[i], name) == 0) return;
+	}
+	if (reportedCount < sizeof(reported) / sizeof(reported[0])) reported[reportedCount++] = name;
+
+	printf("[VKVM] %s is not available (vmInit not called or not enabled on the device)\n", name);
+}
+
+static inline VkDependencyInfo toDependencyInfo(const DependencyInfoArgs* args, char* data)
+{
+	VkDependencyInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO;
+	info.dependencyFlags = args->DependencyFlags;
+	info.memoryBarrierCount = args->MemoryBarrierCount;
+	info.pMemoryBarriers = (VkMemoryBarrier2*)(data + (intptr_t)args->MemoryBarriers);
+	info.bufferMemoryBarrierCount = args->BufferMemoryBarrierCount;
+	info.pBufferMemoryBarriers = (VkBufferMemoryBarrier2*)(data + (intptr_t)args->BufferMemoryBarriers);
+	info.imageMemoryBarrierCount = args->ImageMemoryBarrierCount;
+	info.pImageMemoryBarriers = (VkImageMemoryBarrier2*)(data + (intptr_t)args->ImageMemoryBarriers);
+	return info;
+}
+
+static void pipelineBarrier2(VkCommandBuffer buffer, char* data)
+{
+	if (deviceFunctions.CmdPipelineBarrier2 == nullptr) return missingFunction("vkCmdPipelineBarrier2");
+	auto info = toDependencyInfo(&((PipelineBarrier2Command*)data)->DependencyInfo, data);
+	deviceFunctions.CmdPipelineBarrier2(buffer, &info);
+}
+
+static void setEvent2(VkCommandBuffer buffer, char* data)
+{
+	if (deviceFunctions.CmdSetEvent2 == nullptr) return missingFunction("vkCmdSetEvent2");
+	auto cmd = (SetEvent2Command*)data;
+	auto info = toDependencyInfo(&cmd->DependencyInfo, data);
+	deviceFunctions.CmdSetEvent2(buffer, cmd->Event, &info);
+}
+
+static void waitEvents2(VkCommandBuffer buffer, char* data)
+{
+	if (deviceFunctions.CmdWaitEvents2 == nullptr) return missingFunction("vkCmdWaitEvents2");
+	static thread_local std::vector<VkDependencyInfo> infos;
+
+	auto cmd = (WaitEvents2Command*)data;
+	auto args = (DependencyInfoArgs*)(data + (intptr_t)cmd->DependencyInfos);
+	infos.resize(cmd->EventCount);
+	for (uint32_t i = 0; i < cmd->EventCount; i++) infos[i] = toDependencyInfo(&args[i], data);
+
+	deviceFunctions.CmdWaitEvents2(buffer, cmd->EventCount, (VkEvent*)(data + (intptr_t)cmd->Events), infos.data());
+}
+
+static void writeTimestamp2(VkCommandBuffer buffer, char* data)
+{
+	if (deviceFunctions.CmdWriteTimestamp2 == nullptr) return missingFunction("vkCmdWriteTimestamp2");
+	auto cmd = (WriteTimestamp2Command*)data;
+	deviceFunctions.CmdWriteTimestamp2(buffer, cmd->Stage, cmd->QueryPool, cmd->Query);
+}
+
+static void beginRendering(VkCommandBuffer buffer, char* data)
+{
+	if (deviceFunctions.CmdBeginRendering == nullptr) return missingFunction("vkCmdBeginRendering");
+	auto cmd = (BeginRenderingCommand*)data;
+
+	VkRenderingInfo info = {};
+	info.sType = VK_STRUCTURE_TYPE_RENDERING_INFO;
+	info.flags = cmd->Flags;
+	info.renderArea = cmd->RenderArea;
+	info.layerCount = cmd->LayerCount;
+	info.viewMask = cmd->ViewMask;
+	info.colorAttachmentCount = cmd->ColorAttachmentCount;
+	info.pColorAttachments = (VkRenderingAttachmentInfo*)(data + (intptr_t)cmd->ColorAttachments);
+	info.pDepthAttachment = cmd->DepthAttachment ? (VkRenderingAttachmentInfo*)(data + (intptr_t)cmd->DepthAttachment) : nullptr;
+	info.pStencilAttachment = cmd->StencilAttachment ? (VkRenderingAttachmentInfo*)(data + (intptr_t)cmd->StencilAttachment) : nullptr;
+	deviceFunctions.CmdBeginRendering(buffer, &info);
+}
+
+static void endRendering(VkCommandBuffer buffer)
+{
+	if (deviceFunctions.CmdEndRendering == nullptr) return missingFunction("vkCmdEndRendering");
+	deviceFunctions.CmdEndRendering(buffer);
+}
+
+template<typename F, typename T>
+static inline void setDynamicState(CommandState* state, VkCommandBuffer buffer, F function, const char* name, DynamicState index, T value)
+{
+	if (function == nullptr) return missingFunction(name);
+	if (changeDynamicState(state, index, (uint32_t)value)) function(buffer, value);
+}
+
+static void setStencilOp(CommandState* state, VkCommandBuffer buffer, SetStencilOpCommand* cmd)
+{
+	if (deviceFunctions.CmdSetStencilOp == nullptr) return missingFunction("vkCmdSetStencilOp");
+
+	auto ops = (uint32_t)cmd->FailOp | ((uint32_t)cmd->PassOp << 8) | ((uint32_t)cmd->DepthFailOp << 16) | ((uint32_t)cmd->CompareOp << 24);
+	bool changed = false;
+	if (cmd->FaceMask & VK_STENCIL_FACE_FRONT_BIT) changed |= changeDynamicState(state, DynamicStencilOpFront, ops);
+	if (cmd->FaceMask & VK_STENCIL_FACE_BACK_BIT) changed |= changeDynamicState(state, DynamicStencilOpBack, ops);
+
+	if (changed) deviceFunctions.CmdSetStencilOp(buffer, cmd->FaceMask, cmd->FailOp, cmd->PassOp, cmd->DepthFailOp, cmd->CompareOp);
+}
+
+static void pushDescriptorSet(VkCommandBuffer buffer, char* data)
+{
+	if (deviceFunctions.CmdPushDescriptorSetKHR == nullptr) return missingFunction("vkCmdPushDescriptorSetKHR");
+	static thread_local std::vector<VkWriteDescriptorSet> writes;
+
+	auto cmd = (PushDescriptorSetCommand*)data;
+	auto src = (VkWriteDescriptorSet*)(data + (intptr_t)cmd->Writes);
+	writes.assign(src, src + cmd->WriteCount);
+	for (auto& w : writes)
+	{
+		if (w.pImageInfo) w.pImageInfo = (VkDescriptorImageInfo*)(data + (intptr_t)w.pImageInfo);
+		if (w.pBufferInfo) w.pBufferInfo = (VkDescriptorBufferInfo*)(data + (intptr_t)w.pBufferInfo);
+		if (w.pTexelBufferView) w.pTexelBufferView = (VkBufferView*)(data + (intptr_t)w.pTexelBufferView);
+	}
+
+	deviceFunctions.CmdPushDescriptorSetKHR(buffer, cmd->PipelineBindPoint, cmd->Layout, cmd->Set, cmd->WriteCount, writes.data());
+}
+
+static void pushDescriptorSetWithTemplate(VkCommandBuffer buffer, char* data)
+{
+	if (deviceFunctions.CmdPushDescriptorSetWithTemplateKHR == nullptr) return missingFunction("vkCmdPushDescriptorSetWithTemplateKHR");
+	auto cmd = (PushDescriptorSetWithTemplateCommand*)data;
+	deviceFunctions.CmdPushDescriptorSetWithTemplateKHR(buffer, cmd->Template, cmd->Layout, cmd->Set, data + (intptr_t)cmd->Data);
+}
+
+// inlined into the per-opcode handlers, where the switch on the constant opcode folds away
+static FORCEINLINE void enqueueCommand (CommandState* state, VkCommandBuffer buffer, CommandType op, void* data)
 {
 	VkPipeline pipe;
 
 	switch (op)
 	{
 	case CmdBindPipeline:
+		pipe = get(BindPipeline, data)->Pipeline;
+		if (state->CurrentPipeline != pipe) {
+			state->CurrentPipeline = pipe;
+			invalidateDynamicState(state);
+		}
 		vkCmdBindPipeline(
 			buffer,
 			get(BindPipeline, data)->PipelineBindPoint,
-			get(BindPipeline, data)->Pipeline
+			pipe
 		);
 		break;
 	case CmdSetViewport:
@@ -247,7 +438,7 @@ static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, Command
 			buffer,
 			get(ClearColorImage, data)->Image,
 			get(ClearColorImage, data)->ImageLayout,
-			get(ClearColorImage, data)->Color,
+			getptr(ClearColorImage, Color, VkClearColorValue),
 			get(ClearColorImage, data)->RangeCount,
 			getptr(ClearColorImage, Ranges, VkImageSubresourceRange)
 		);
@@ -257,7 +448,7 @@ static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, Command
 			buffer,
 			get(ClearDepthStencilImage, data)->Image,
 			get(ClearDepthStencilImage, data)->ImageLayout,
-			get(ClearDepthStencilImage, data)->DepthStencil,
+			getptr(ClearDepthStencilImage, DepthStencil, VkClearDepthStencilValue),
 			get(ClearDepthStencilImage, data)->RangeCount,
 			getptr(ClearDepthStencilImage, Ranges, VkImageSubresourceRange)
 		);
@@ -300,7 +491,7 @@ static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, Command
 		vkCmdWaitEvents(
 			buffer,
 			get(WaitEvents, data)->EventCount,
-			get(WaitEvents, data)->Events,
+			getptr(WaitEvents, Events, VkEvent),
 			get(WaitEvents, data)->SrcStageMask,
 			get(WaitEvents, data)->DstStageMask,
 			get(WaitEvents, data)->MemoryBarrierCount,
@@ -400,13 +591,149 @@ static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, Command
 			get(ExecuteCommands, data)->CommandBufferCount,
 			getptr(ExecuteCommands, CommandBuffers, VkCommandBuffer)
 		);
+		// the bound pipeline and dynamic state are undefined afterwards
+		state->CurrentPipeline = VK_NULL_HANDLE;
+		invalidateDynamicState(state);
 		break;
 
-	case CmdCallFragment:
-		vmRun(buffer, get(CallFragment, data)->FragmentToCall);
+	case CmdPipelineBarrier2:
+		pipelineBarrier2(buffer, (char*)data);
+		break;
+
+	case CmdSetEvent2:
+		setEvent2(buffer, (char*)data);
+		break;
+
+	case CmdWaitEvents2:
+		waitEvents2(buffer, (char*)data);
+		break;
+
+	case CmdWriteTimestamp2:
+		writeTimestamp2(buffer, (char*)data);
+		break;
+
+	case CmdBeginRendering:
+		beginRendering(buffer, (char*)data);
+		break;
+
+	case CmdEndRendering:
+		endRendering(buffer);
+		break;
+
+	case CmdSetCullMode:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetCullMode, "vkCmdSetCullMode", DynamicCullMode, get(SetCullMode, data)->CullMode);
+		break;
+	case CmdSetFrontFace:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetFrontFace, "vkCmdSetFrontFace", DynamicFrontFace, get(SetFrontFace, data)->FrontFace);
+		break;
+	case CmdSetPrimitiveTopology:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetPrimitiveTopology, "vkCmdSetPrimitiveTopology", DynamicPrimitiveTopology, get(SetPrimitiveTopology, data)->PrimitiveTopology);
+		break;
+	case CmdSetDepthTestEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetDepthTestEnable, "vkCmdSetDepthTestEnable", DynamicDepthTestEnable, get(SetDepthTestEnable, data)->DepthTestEnable);
+		break;
+	case CmdSetDepthWriteEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetDepthWriteEnable, "vkCmdSetDepthWriteEnable", DynamicDepthWriteEnable, get(SetDepthWriteEnable, data)->DepthWriteEnable);
+		break;
+	case CmdSetDepthCompareOp:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetDepthCompareOp, "vkCmdSetDepthCompareOp", DynamicDepthCompareOp, get(SetDepthCompareOp, data)->DepthCompareOp);
+		break;
+	case CmdSetDepthBoundsTestEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetDepthBoundsTestEnable, "vkCmdSetDepthBoundsTestEnable", DynamicDepthBoundsTestEnable, get(SetDepthBoundsTestEnable, data)->DepthBoundsTestEnable);
+		break;
+	case CmdSetStencilTestEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetStencilTestEnable, "vkCmdSetStencilTestEnable", DynamicStencilTestEnable, get(SetStencilTestEnable, data)->StencilTestEnable);
+		break;
+	case CmdSetRasterizerDiscardEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetRasterizerDiscardEnable, "vkCmdSetRasterizerDiscardEnable", DynamicRasterizerDiscardEnable, get(SetRasterizerDiscardEnable, data)->RasterizerDiscardEnable);
+		break;
+	case CmdSetDepthBiasEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetDepthBiasEnable, "vkCmdSetDepthBiasEnable", DynamicDepthBiasEnable, get(SetDepthBiasEnable, data)->DepthBiasEnable);
+		break;
+	case CmdSetPrimitiveRestartEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetPrimitiveRestartEnable, "vkCmdSetPrimitiveRestartEnable", DynamicPrimitiveRestartEnable, get(SetPrimitiveRestartEnable, data)->PrimitiveRestartEnable);
+		break;
+	case CmdSetPatchControlPoints:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetPatchControlPointsEXT, "vkCmdSetPatchControlPointsEXT", DynamicPatchControlPoints, get(SetPatchControlPoints, data)->PatchControlPoints);
+		break;
+	case CmdSetLogicOp:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetLogicOpEXT, "vkCmdSetLogicOpEXT", DynamicLogicOp, get(SetLogicOp, data)->LogicOp);
+		break;
+	case CmdSetPolygonMode:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetPolygonModeEXT, "vkCmdSetPolygonModeEXT", DynamicPolygonMode, get(SetPolygonMode, data)->PolygonMode);
+		break;
+	case CmdSetRasterizationSamples:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetRasterizationSamplesEXT, "vkCmdSetRasterizationSamplesEXT", DynamicRasterizationSamples, get(SetRasterizationSamples, data)->RasterizationSamples);
+		break;
+	case CmdSetDepthClampEnable:
+		setDynamicState(state, buffer, deviceFunctions.CmdSetDepthClampEnableEXT, "vkCmdSetDepthClampEnableEXT", DynamicDepthClampEnable, get(SetDepthClampEnable, data)->DepthClampEnable);
+		break;
+	case CmdSetStencilOp:
+		setStencilOp(state, buffer, get(SetStencilOp, data));
+		break;
+	case CmdSetColorBlendEnable:
+		if (deviceFunctions.CmdSetColorBlendEnableEXT == nullptr) { missingFunction("vkCmdSetColorBlendEnableEXT"); break; }
+		deviceFunctions.CmdSetColorBlendEnableEXT(
+			buffer,
+			get(SetColorBlendEnable, data)->FirstAttachment,
+			get(SetColorBlendEnable, data)->AttachmentCount,
+			getptr(SetColorBlendEnable, ColorBlendEnables, VkBool32)
+		);
+		break;
+	case CmdSetColorWriteMask:
+		if (deviceFunctions.CmdSetColorWriteMaskEXT == nullptr) { missingFunction("vkCmdSetColorWriteMaskEXT"); break; }
+		deviceFunctions.CmdSetColorWriteMaskEXT(
+			buffer,
+			get(SetColorWriteMask, data)->FirstAttachment,
+			get(SetColorWriteMask, data)->AttachmentCount,
+			getptr(SetColorWriteMask, ColorWriteMasks, VkColorComponentFlags)
+		);
+		break;
+
+	case CmdPushDescriptorSet:
+		pushDescriptorSet(buffer, (char*)data);
+		break;
+
+	case CmdPushDescriptorSetWithTemplate:
+		pushDescriptorSetWithTemplate(buffer, (char*)data);
+		break;
+
+	case CmdDrawMeshTasks:
+		if (deviceFunctions.CmdDrawMeshTasksEXT == nullptr) { missingFunction("vkCmdDrawMeshTasksEXT"); break; }
+		deviceFunctions.CmdDrawMeshTasksEXT(
+			buffer,
+			get(DrawMeshTasks, data)->GroupCountX,
+			get(DrawMeshTasks, data)->GroupCountY,
+			get(DrawMeshTasks, data)->GroupCountZ
+		);
+		break;
+	case CmdDrawMeshTasksIndirect:
+		if (deviceFunctions.CmdDrawMeshTasksIndirectEXT == nullptr) { missingFunction("vkCmdDrawMeshTasksIndirectEXT"); break; }
+		deviceFunctions.CmdDrawMeshTasksIndirectEXT(
+			buffer,
+			get(DrawMeshTasksIndirect, data)->Buffer,
+			get(DrawMeshTasksIndirect, data)->Offset,
+			get(DrawMeshTasksIndirect, data)->DrawCount,
+			get(DrawMeshTasksIndirect, data)->Stride
+		);
+		break;
+	case CmdDrawMeshTasksIndirectCount:
+		if (deviceFunctions.CmdDrawMeshTasksIndirectCountEXT == nullptr) { missingFunction("vkCmdDrawMeshTasksIndirectCountEXT"); break; }
+		deviceFunctions.CmdDrawMeshTasksIndirectCountEXT(
+			buffer,
+			get(DrawMeshTasksIndirectCount, data)->Buffer,
+			get(DrawMeshTasksIndirectCount, data)->Offset,
+			get(DrawMeshTasksIndirectCount, data)->CountBuffer,
+			get(DrawMeshTasksIndirectCount, data)->CountBufferOffset,
+			get(DrawMeshTasksIndirectCount, data)->MaxDrawCount,
+			get(DrawMeshTasksIndirectCount, data)->Stride
+		);
 		break;
 
 	case CmdCustom:
+		// the callback may bind another pipeline or set dynamic state
+		state->CurrentPipeline = VK_NULL_HANDLE;
+		invalidateDynamicState(state);
 		get(Custom, data)->Run(buffer);
 		break;
 
@@ -414,6 +741,7 @@ static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, Command
 		pipe = *get(IndirectBindPipeline, data)->Pipeline;
 		if (state->CurrentPipeline != pipe) {
 			state->CurrentPipeline = pipe;
+			invalidateDynamicState(state);
 			vkCmdBindPipeline(
 				buffer,
 				get(IndirectBindPipeline, data)->PipelineBindPoint,
@@ -447,6 +775,20 @@ static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, Command
 			get(IndirectDraw, data)->Calls
 		);
 		break;
+	case CmdIndirectPushDescriptorSet:
+		vmPushDescriptorSet(
+			buffer,
+			get(IndirectPushDescriptorSet, data)->Binding
+		);
+		break;
+	case CmdIndirectDrawMeshTasks:
+		vmDrawMeshTasks(
+			buffer,
+			get(IndirectDrawMeshTasks, data)->Stats,
+			get(IndirectDrawMeshTasks, data)->IsActive,
+			get(IndirectDrawMeshTasks, data)->Calls
+		);
+		break;
 
 
 	default:
@@ -454,39 +796,713 @@ static void enqueueCommand (CommandState* state, VkCommandBuffer buffer, Command
 	}
 }
 
+template<CommandType Op>
+static void handleCommand(CommandState* state, VkCommandBuffer buffer, void* data)
+{
+	enqueueCommand(state, buffer, Op, data);
+}
+
+#define HANDLER(n) case Cmd##n: size = sizeof(n##Command); handler = &handleCommand<Cmd##n>; break;
+
+// returns the handler and minimal size of a command, false for unknown opcodes
+static bool getHandler(CommandType op, CommandHandler& handler, uint32_t& size)
+{
+	switch (op)
+	{
+	HANDLER(BindPipeline)
+	HANDLER(SetViewport)
+	HANDLER(SetScissor)
+	HANDLER(SetLineWidth)
+	HANDLER(SetDepthBias)
+	HANDLER(SetBlendConstants)
+	HANDLER(SetDepthBounds)
+	HANDLER(SetStencilCompareMask)
+	HANDLER(SetStencilWriteMask)
+	HANDLER(SetStencilReference)
+	HANDLER(BindDescriptorSets)
+	HANDLER(BindIndexBuffer)
+	HANDLER(BindVertexBuffers)
+	HANDLER(Draw)
+	HANDLER(DrawIndexed)
+	HANDLER(DrawIndirect)
+	HANDLER(DrawIndexedIndirect)
+	HANDLER(Dispatch)
+	HANDLER(DispatchIndirect)
+	HANDLER(CopyBuffer)
+	HANDLER(CopyImage)
+	HANDLER(BlitImage)
+	HANDLER(CopyBufferToImage)
+	HANDLER(CopyImageToBuffer)
+	HANDLER(UpdateBuffer)
+	HANDLER(FillBuffer)
+	HANDLER(ClearColorImage)
+	HANDLER(ClearDepthStencilImage)
+	HANDLER(ClearAttachments)
+	HANDLER(ResolveImage)
+	HANDLER(SetEvent)
+	HANDLER(ResetEvent)
+	HANDLER(WaitEvents)
+	HANDLER(PipelineBarrier)
+	HANDLER(BeginQuery)
+	HANDLER(EndQuery)
+	HANDLER(ResetQueryPool)
+	HANDLER(WriteTimestamp)
+	HANDLER(CopyQueryPoolResults)
+	HANDLER(PushConstants)
+	HANDLER(BeginRenderPass)
+	HANDLER(NextSubpass)
+	HANDLER(EndRenderPass)
+	HANDLER(ExecuteCommands)
+	HANDLER(PipelineBarrier2)
+	HANDLER(SetEvent2)
+	HANDLER(WaitEvents2)
+	HANDLER(WriteTimestamp2)
+	HANDLER(BeginRendering)
+	HANDLER(EndRendering)
+	HANDLER(SetCullMode)
+	HANDLER(SetFrontFace)
+	HANDLER(SetPrimitiveTopology)
+	HANDLER(SetDepthTestEnable)
+	HANDLER(SetDepthWriteEnable)
+	HANDLER(SetDepthCompareOp)
+	HANDLER(SetDepthBoundsTestEnable)
+	HANDLER(SetStencilTestEnable)
+	HANDLER(SetStencilOp)
+	HANDLER(SetRasterizerDiscardEnable)
+	HANDLER(SetDepthBiasEnable)
+	HANDLER(SetPrimitiveRestartEnable)
+	HANDLER(SetPatchControlPoints)
+	HANDLER(SetLogicOp)
+	HANDLER(SetPolygonMode)
+	HANDLER(SetRasterizationSamples)
+	HANDLER(SetDepthClampEnable)
+	HANDLER(SetColorBlendEnable)
+	HANDLER(SetColorWriteMask)
+	HANDLER(PushDescriptorSet)
+	HANDLER(PushDescriptorSetWithTemplate)
+	HANDLER(DrawMeshTasks)
+	HANDLER(DrawMeshTasksIndirect)
+	HANDLER(DrawMeshTasksIndirectCount)
+	HANDLER(Custom)
+	HANDLER(IndirectBindPipeline)
+	HANDLER(IndirectBindDescriptorSets)
+	HANDLER(IndirectBindIndexBuffer)
+	HANDLER(IndirectBindVertexBuffers)
+	HANDLER(IndirectDraw)
+	HANDLER(IndirectPushDescriptorSet)
+	HANDLER(IndirectDrawMeshTasks)
+	case CmdCallFragment:
+		size = sizeof(CallFragmentCommand);
+		handler = nullptr;
+		break;
+	default:
+		return false;
+	}
+	return true;
+}
+
+#undef HANDLER
+
+// checks that the relative array pointer lies within the command
+static bool inCommand(uint32_t length, const void* relative, uint32_t count, size_t elementSize)
+{
+	if (count == 0) return true;
+	auto offset = (intptr_t)relative;
+	return offset >= 0 && (uint64_t)offset + (uint64_t)count * elementSize <= length;
+}
+
+static bool validDependencyInfo(uint32_t length, const DependencyInfoArgs& args)
+{
+	return
+		inCommand(length, args.MemoryBarriers, args.MemoryBarrierCount, sizeof(VkMemoryBarrier2)) &&
+		inCommand(length, args.BufferMemoryBarriers, args.BufferMemoryBarrierCount, sizeof(VkBufferMemoryBarrier2)) &&
+		inCommand(length, args.ImageMemoryBarriers, args.ImageMemoryBarrierCount, sizeof(VkImageMemoryBarrier2));
+}
+
+#define check(t,v,c,r) if (!inCommand(length, get(t, data)->v, (c), sizeof(r))) return false;
+
+// validates the relative pointers of the command
+static bool validateCommand(CommandType op, char* data, uint32_t length)
+{
+	switch (op)
+	{
+	case CmdBindDescriptorSets:
+		check(BindDescriptorSets, DescriptorSets, get(BindDescriptorSets, data)->SetCount, VkDescriptorSet)
+		check(BindDescriptorSets, DynamicOffsets, get(BindDescriptorSets, data)->DynamicOffsetCount, uint32_t)
+		return true;
+	case CmdBindVertexBuffers:
+		check(BindVertexBuffers, Buffers, get(BindVertexBuffers, data)->BindingCount, VkBuffer)
+		check(BindVertexBuffers, Offsets, get(BindVertexBuffers, data)->BindingCount, VkDeviceSize)
+		return true;
+	case CmdCopyBuffer:
+		check(CopyBuffer, Regions, get(CopyBuffer, data)->RegionCount, VkBufferCopy)
+		return true;
+	case CmdCopyImage:
+		check(CopyImage, Regions, get(CopyImage, data)->RegionCount, VkImageCopy)
+		return true;
+	case CmdBlitImage:
+		check(BlitImage, Regions, get(BlitImage, data)->RegionCount, VkImageBlit)
+		return true;
+	case CmdCopyBufferToImage:
+		check(CopyBufferToImage, Regions, get(CopyBufferToImage, data)->RegionCount, VkBufferImageCopy)
+		return true;
+	case CmdCopyImageToBuffer:
+		check(CopyImageToBuffer, Regions, get(CopyImageToBuffer, data)->RegionCount, VkBufferImageCopy)
+		return true;
+	case CmdClearColorImage:
+		check(ClearColorImage, Color, 1, VkClearColorValue)
+		check(ClearColorImage, Ranges, get(ClearColorImage, data)->RangeCount, VkImageSubresourceRange)
+		return true;
+	case CmdClearDepthStencilImage:
+		check(ClearDepthStencilImage, DepthStencil, 1, VkClearDepthStencilValue)
+		check(ClearDepthStencilImage, Ranges, get(ClearDepthStencilImage, data)->RangeCount, VkImageSubresourceRange)
+		return true;
+	case CmdClearAttachments:
+		check(ClearAttachments, Attachments, get(ClearAttachments, data)->AttachmentCount, VkClearAttachment)
+		check(ClearAttachments, Rects, get(ClearAttachments, data)->RectCount, VkClearRect)
+		return true;
+	case CmdResolveImage:
+		check(ResolveImage, Regions, get(ResolveImage, data)->RegionCount, VkImageResolve)
+		return true;
+	case CmdWaitEvents:
+		check(WaitEvents, Events, get(WaitEvents, data)->EventCount, VkEvent)
+		check(WaitEvents, MemoryBarriers, get(WaitEvents, data)->MemoryBarrierCount, VkMemoryBarrier)
+		check(WaitEvents, BufferMemoryBarriers, get(WaitEvents, data)->BufferMemoryBarrierCount, VkBufferMemoryBarrier)
+		check(WaitEvents, ImageMemoryBarriers, get(WaitEvents, data)->ImageMemoryBarrierCount, VkImageMemoryBarrier)
+		return true;
+	case CmdPipelineBarrier:
+		check(PipelineBarrier, MemoryBarriers, get(PipelineBarrier, data)->MemoryBarrierCount, VkMemoryBarrier)
+		check(PipelineBarrier, BufferMemoryBarriers, get(PipelineBarrier, data)->BufferMemoryBarrierCount, VkBufferMemoryBarrier)
+		check(PipelineBarrier, ImageMemoryBarriers, get(PipelineBarrier, data)->ImageMemoryBarrierCount, VkImageMemoryBarrier)
+		return true;
+	case CmdBeginRenderPass:
+		check(BeginRenderPass, RenderPassBegin, 1, VkRenderPassBeginInfo)
+		return true;
+	case CmdExecuteCommands:
+		check(ExecuteCommands, CommandBuffers, get(ExecuteCommands, data)->CommandBufferCount, VkCommandBuffer)
+		return true;
+	case CmdPipelineBarrier2:
+		return validDependencyInfo(length, get(PipelineBarrier2, data)->DependencyInfo);
+	case CmdSetEvent2:
+		return validDependencyInfo(length, get(SetEvent2, data)->DependencyInfo);
+	case CmdPushDescriptorSet:
+	{
+		check(PushDescriptorSet, Writes, get(PushDescriptorSet, data)->WriteCount, VkWriteDescriptorSet)
+		auto writes = (VkWriteDescriptorSet*)(data + (intptr_t)get(PushDescriptorSet, data)->Writes);
+		for (uint32_t i = 0; i < get(PushDescriptorSet, data)->WriteCount; i++)
+		{
+			auto& w = writes[i];
+			if (!inCommand(length, w.pImageInfo, w.pImageInfo ? w.descriptorCount : 0, sizeof(VkDescriptorImageInfo)) ||
+				!inCommand(length, w.pBufferInfo, w.pBufferInfo ? w.descriptorCount : 0, sizeof(VkDescriptorBufferInfo)) ||
+				!inCommand(length, w.pTexelBufferView, w.pTexelBufferView ? w.descriptorCount : 0, sizeof(VkBufferView)))
+				return false;
+		}
+		return true;
+	}
+	case CmdPushDescriptorSetWithTemplate:
+		check(PushDescriptorSetWithTemplate, Data, get(PushDescriptorSetWithTemplate, data)->DataSize, char)
+		return true;
+	case CmdSetColorBlendEnable:
+		check(SetColorBlendEnable, ColorBlendEnables, get(SetColorBlendEnable, data)->AttachmentCount, VkBool32)
+		return true;
+	case CmdSetColorWriteMask:
+		check(SetColorWriteMask, ColorWriteMasks, get(SetColorWriteMask, data)->AttachmentCount, VkColorComponentFlags)
+		return true;
+	case CmdBeginRendering:
+		check(BeginRendering, ColorAttachments, get(BeginRendering, data)->ColorAttachmentCount, VkRenderingAttachmentInfo)
+		check(BeginRendering, DepthAttachment, 1, VkRenderingAttachmentInfo)
+		check(BeginRendering, StencilAttachment, 1, VkRenderingAttachmentInfo)
+		return true;
+	case CmdWaitEvents2:
+	{
+		auto count = get(WaitEvents2, data)->EventCount;
+		check(WaitEvents2, Events, count, VkEvent)
+		check(WaitEvents2, DependencyInfos, count, DependencyInfoArgs)
+		auto args = (DependencyInfoArgs*)(data + (intptr_t)get(WaitEvents2, data)->DependencyInfos);
+		for (uint32_t i = 0; i < count; i++) if (!validDependencyInfo(length, args[i])) return false;
+		return true;
+	}
+	default:
+		return true;
+	}
+}
+
+#undef check
 #undef get
 #undef getptr
 
-DllExport(void) vmRun(VkCommandBuffer buffer, CommandFragment* fragment)
+// validates the commands of the fragment (size bytes) once and stores the decoded commands,
+// which are used by vmRun until the fragment is changed (and vmDecompile is called).
+DllExport(int) vmCompile(CommandFragment* fragment, uint64_t size)
 {
-#ifdef _DEBUG
-	std::unordered_set<CommandFragment*> set;
-#endif
+	vmDecompile(fragment);
+
+	auto count = fragment->CommandCount;
+	auto decoded = new DecodedCommand[count > 0 ? count : 1];
+	auto ptr = (char*)fragment->Commands;
+	uint64_t offset = 0;
 
-	CommandState state = { VK_NULL_HANDLE };
-	while (fragment)
+	for (uint32_t i = 0; i < count; i++)
 	{
-#ifdef _DEBUG
-		auto res = set.insert(fragment);
-		if (!std::get<1>(res)) {
-			printf("[VKVM] loop detected!!!!!!!\n");
-			break;
+		if (offset + 8 > size)
+		{
+			printf("[VKVM] command %u exceeds the fragment\n", i);
+			delete[] decoded;
+			return 0;
 		}
-#endif
 
-		auto ptr = (char*)fragment->Commands;
+		auto data = ptr + offset;
+		auto length = *(uint32_t*)(data);
+		auto op = *(CommandType*)(data + 4);
+
+		CommandHandler handler;
+		uint32_t minLength;
+		if (!getHandler(op, handler, minLength))
+		{
+			printf("[VKVM] command %u has unknown opcode %d\n", i, (int)op);
+			delete[] decoded;
+			return 0;
+		}
+
+		if (length < minLength || offset + length > size || !validateCommand(op, data, length))
+		{
+			printf("[VKVM] command %u (opcode %d) is malformed\n", i, (int)op);
+			delete[] decoded;
+			return 0;
+		}
+
+		decoded[i] = { handler, op, data };
+		offset += length;
+	}
+
+	auto compiled = new CompiledFragment();
+	compiled->Commands = fragment->Commands;
+	compiled->CommandCount = count;
+	compiled->Decoded = decoded;
+	fragment->Compiled = compiled;
+	return 1;
+}
+
+// decoded commands may still be used by running VMs, so they are only freed once all
+// VMs that started before vmDecompile are finished (see vmRetireEpoch).
+static std::mutex retiredMtx;
+static std::vector<std::pair<uint64_t, CompiledFragment*>> retiredCompiled;
 
-		for (int i = 0; i < (int)fragment->CommandCount; i++)
+DllExport(void) vmDecompile(CommandFragment* fragment)
+{
+	auto compiled = fragment->Compiled;
+	if (compiled == nullptr) return;
+
+	fragment->Compiled = nullptr;
+	auto epoch = vmRetireEpoch();
+
+	std::lock_guard<std::mutex> lock(retiredMtx);
+	retiredCompiled.push_back({ epoch, compiled });
+
+	size_t kept = 0;
+	for (auto& r : retiredCompiled)
+	{
+		if (vmCanFree(r.first))
 		{
-			auto length = *(uint32_t*)(ptr);
-			auto op = *(CommandType*)(ptr + 4);
+			delete[] r.second->Decoded;
+			delete r.second;
+		}
+		else
+		{
+			retiredCompiled[kept++] = r;
+		}
+	}
+	retiredCompiled.resize(kept);
+}
+
+// adjacent CmdPipelineBarriers (no command in between, calls into other fragments are fine)
+// are merged into one vkCmdPipelineBarrier with the union of the stage masks. global memory
+// barriers are merged into one, duplicate buffer/image barriers are merged by or-ing their
+// access masks. a batch is flushed before any other command is recorded.
+typedef struct {
+	bool								Pending;
+	VkPipelineStageFlags				SrcStageMask;
+	VkPipelineStageFlags				DstStageMask;
+	VkDependencyFlags					DependencyFlags;
+	bool								HasMemoryBarrier;
+	VkMemoryBarrier						MemoryBarrier;
+	std::vector<VkBufferMemoryBarrier>	BufferBarriers;
+	std::vector<VkImageMemoryBarrier>	ImageBarriers;
+} BarrierBatch;
+
+// one batch per thread keeps the arrays allocated across vmRun calls. it is always
+// flushed before CmdCustom callbacks run, so nested vmRuns find it empty.
+static thread_local BarrierBatch barrierBatch;
+
+static void flushBarriers(VkCommandBuffer buffer)
+{
+	auto& b = barrierBatch;
+	if (!b.Pending) return;
 
+	vkCmdPipelineBarrier(
+		buffer,
+		b.SrcStageMask,
+		b.DstStageMask,
+		b.DependencyFlags,
+		b.HasMemoryBarrier ? 1 : 0, &b.MemoryBarrier,
+		(uint32_t)b.BufferBarriers.size(), b.BufferBarriers.data(),
+		(uint32_t)b.ImageBarriers.size(), b.ImageBarriers.data()
+	);
+
+	b.Pending = false;
+	b.HasMemoryBarrier = false;
+	b.BufferBarriers.clear();
+	b.ImageBarriers.clear();
+}
+
+// counts may be VK_REMAINING_MIP_LEVELS / VK_REMAINING_ARRAY_LAYERS (both ~0U)
+static inline bool rangesOverlap(uint32_t a, uint32_t na, uint32_t b, uint32_t nb)
+{
+	uint64_t ea = na == VK_REMAINING_ARRAY_LAYERS ? UINT64_MAX : (uint64_t)a + na;
+	uint64_t eb = nb == VK_REMAINING_ARRAY_LAYERS ? UINT64_MAX : (uint64_t)b + nb;
+	return a < eb && b < ea;
+}
+
+static inline bool subresourcesOverlap(const VkImageSubresourceRange& a, const VkImageSubresourceRange& b)
+{
+	return
+		(a.aspectMask & b.aspectMask) != 0 &&
+		rangesOverlap(a.baseMipLevel, a.levelCount, b.baseMipLevel, b.levelCount) &&
+		rangesOverlap(a.baseArrayLayer, a.layerCount, b.baseArrayLayer, b.layerCount);
+}
+
+static inline bool sameSubresources(const VkImageSubresourceRange& a, const VkImageSubresourceRange& b)
+{
+	return
+		a.aspectMask == b.aspectMask &&
+		a.baseMipLevel == b.baseMipLevel && a.levelCount == b.levelCount &&
+		a.baseArrayLayer == b.baseArrayLayer && a.layerCount == b.layerCount;
+}
+
+// returns false if the barrier cannot join the pending batch: layout transitions of the same
+// subresources within one vkCmdPipelineBarrier would be unordered.
+static bool canBatch(const PipelineBarrierCommand* cmd, const VkMemoryBarrier* memory, const VkBufferMemoryBarrier* buffers, const VkImageMemoryBarrier* images)
+{
+	auto& b = barrierBatch;
+	if (cmd->DependencyFlags != b.DependencyFlags) return false;
+
+	for (uint32_t i = 0; i < cmd->MemoryBarrierCount; i++) if (memory[i].pNext != nullptr) return false;
+	for (uint32_t i = 0; i < cmd->BufferMemoryBarrierCount; i++) if (buffers[i].pNext != nullptr) return false;
+
+	for (uint32_t i = 0; i < cmd->ImageMemoryBarrierCount; i++)
+	{
+		auto& n = images[i];
+		if (n.pNext != nullptr) return false;
+
+		for (auto& o : b.ImageBarriers)
+		{
+			if (o.image != n.image || !subresourcesOverlap(o.subresourceRange, n.subresourceRange)) continue;
+
+			auto same =
+				o.oldLayout == n.oldLayout && o.newLayout == n.newLayout &&
+				o.srcQueueFamilyIndex == n.srcQueueFamilyIndex && o.dstQueueFamilyIndex == n.dstQueueFamilyIndex &&
+				sameSubresources(o.subresourceRange, n.subresourceRange);
+			if (!same) return false;
+		}
+	}
+	return true;
+}
+
+static void batchBarrier(VkCommandBuffer buffer, char* data)
+{
+	auto cmd = (PipelineBarrierCommand*)data;
+	auto memory = (const VkMemoryBarrier*)(data + (intptr_t)cmd->MemoryBarriers);
+	auto buffers = (const VkBufferMemoryBarrier*)(data + (intptr_t)cmd->BufferMemoryBarriers);
+	auto images = (const VkImageMemoryBarrier*)(data + (intptr_t)cmd->ImageMemoryBarriers);
+
+	auto& b = barrierBatch;
+	if (b.Pending && !canBatch(cmd, memory, buffers, images)) flushBarriers(buffer);
+
+	if (!b.Pending)
+	{
+		// barriers with extension structs are recorded as they are
+		bool chained = false;
+		for (uint32_t i = 0; i < cmd->MemoryBarrierCount; i++) chained |= memory[i].pNext != nullptr;
+		for (uint32_t i = 0; i < cmd->BufferMemoryBarrierCount; i++) chained |= buffers[i].pNext != nullptr;
+		for (uint32_t i = 0; i < cmd->ImageMemoryBarrierCount; i++) chained |= images[i].pNext != nullptr;
+		if (chained)
+		{
+			vkCmdPipelineBarrier(
+				buffer, cmd->SrcStageMask, cmd->DstStageMask, cmd->DependencyFlags,
+				cmd->MemoryBarrierCount, memory,
+				cmd->BufferMemoryBarrierCount, buffers,
+				cmd->ImageMemoryBarrierCount, images
+			);
+			return;
+		}
+
+		b.Pending = true;
+		b.SrcStageMask = 0;
+		b.DstStageMask = 0;
+		b.DependencyFlags = cmd->DependencyFlags;
+	}
+
+	b.SrcStageMask |= cmd->SrcStageMask;
+	b.DstStageMask |= cmd->DstStageMask;
+
+	for (uint32_t i = 0; i < cmd->MemoryBarrierCount; i++)
+	{
+		if (!b.HasMemoryBarrier)
+		{
+			b.HasMemoryBarrier = true;
+			b.MemoryBarrier = memory[i];
+		}
+		else
+		{
+			b.MemoryBarrier.srcAccessMask |= memory[i].srcAccessMask;
+			b.MemoryBarrier.dstAccessMask |= memory[i].dstAccessMask;
+		}
+	}
+
+	for (uint32_t i = 0; i < cmd->BufferMemoryBarrierCount; i++)
+	{
+		auto& n = buffers[i];
+		bool merged = false;
+		for (auto& o : b.BufferBarriers)
+		{
+			if (o.buffer == n.buffer && o.offset == n.offset && o.size == n.size &&
+				o.srcQueueFamilyIndex == n.srcQueueFamilyIndex && o.dstQueueFamilyIndex == n.dstQueueFamilyIndex)
+			{
+				o.srcAccessMask |= n.srcAccessMask;
+				o.dstAccessMask |= n.dstAccessMask;
+				merged = true;
+				break;
+			}
+		}
+		if (!merged) b.BufferBarriers.push_back(n);
+	}
+
+	for (uint32_t i = 0; i < cmd->ImageMemoryBarrierCount; i++)
+	{
+		auto& n = images[i];
+		bool merged = false;
+		for (auto& o : b.ImageBarriers)
+		{
+			// canBatch ensured that overlapping barriers are identical apart from the access masks
+			if (o.image == n.image && subresourcesOverlap(o.subresourceRange, n.subresourceRange))
+			{
+				o.srcAccessMask |= n.srcAccessMask;
+				o.dstAccessMask |= n.dstAccessMask;
+				merged = true;
+				break;
+			}
+		}
+		if (!merged) b.ImageBarriers.push_back(n);
+	}
+}
+
+// maximum nesting of CmdCallFragment, deeper calls are skipped
+#define MAX_CALL_DEPTH 64
+
+// a fragment chain being executed. Entry is the called fragment (head of the chain), calls to
+// the entry of a frame on the stack are cycles. Mark/Power/Steps detect loops in the chain
+// (Brent's algorithm).
+typedef struct {
+	CommandFragment*	Entry;
+	CommandFragment*	Fragment;
+	char*				Ptr;
+	DecodedCommand*		Decoded;
+	uint32_t			Remaining;
+	CommandFragment*	Mark;
+	uint32_t			Power;
+	uint32_t			Steps;
+} CallFrame;
+
+static inline void enterFragment(CallFrame* frame, CommandFragment* fragment)
+{
+	frame->Fragment = fragment;
+	frame->Ptr = fragment ? (char*)fragment->Commands : nullptr;
+	frame->Remaining = fragment ? fragment->CommandCount : 0;
+
+	// use the decoded commands if the fragment is compiled and unchanged
+	auto compiled = fragment ? fragment->Compiled : nullptr;
+	frame->Decoded =
+		compiled != nullptr && compiled->Commands == fragment->Commands && compiled->CommandCount == fragment->CommandCount
+		? compiled->Decoded : nullptr;
+}
+
+// runs the chain and all fragments called from it iteratively, sharing the state across calls
+static void runChain(VkCommandBuffer buffer, CommandFragment* fragment)
+{
+	CommandState state = {};
+	CallFrame stack[MAX_CALL_DEPTH];
+	int depth = 0;
+
+	auto frame = &stack[0];
+	enterFragment(frame, fragment);
+	frame->Entry = fragment;
+	frame->Mark = fragment;
+	frame->Power = 1;
+	frame->Steps = 0;
+
+	while (true)
+	{
+		if (frame->Remaining == 0)
+		{
+			if (frame->Fragment != nullptr)
+			{
+				auto next = frame->Fragment->Next.load(std::memory_order_acquire);
+				if (next != nullptr && next == frame->Mark)
+				{
+					printf("[VKVM] loop detected\n");
+					next = nullptr;
+				}
+				else if (++frame->Steps == frame->Power)
+				{
+					frame->Mark = next;
+					frame->Power <<= 1;
+					frame->Steps = 0;
+				}
+
+				enterFragment(frame, next);
+				if (next != nullptr) continue;
+			}
+
+			// the chain is done, return to the caller
+			if (depth == 0) break;
+			frame = &stack[--depth];
+			continue;
+		}
+
+		char* ptr;
+		CommandType op;
+		CommandHandler handler = nullptr;
+		frame->Remaining--;
+
+		if (frame->Decoded != nullptr)
+		{
+			auto d = frame->Decoded++;
+			ptr = (char*)d->Data;
+			op = d->OpCode;
+			handler = d->Handler;
+		}
+		else
+		{
+			ptr = frame->Ptr;
+			op = *(CommandType*)(ptr + 4);
+			frame->Ptr = ptr + *(uint32_t*)(ptr);
+		}
+
+		if (op == CmdPipelineBarrier)
+		{
+			batchBarrier(buffer, ptr);
+			continue;
+		}
+
+		if (op == CmdCallFragment)
+		{
+			auto callee = ((CallFragmentCommand*)ptr)->FragmentToCall;
+			if (callee == nullptr) continue;
+
+			bool cycle = false;
+			for (int i = 0; i <= depth && !cycle; i++) cycle = stack[i].Entry == callee;
+			if (cycle)
+			{
+				printf("[VKVM] call cycle detected\n");
+				continue;
+			}
+
+			if (depth + 1 >= MAX_CALL_DEPTH)
+			{
+				printf("[VKVM] maximum call depth exceeded\n");
+				continue;
+			}
+
+			frame = &stack[++depth];
+			enterFragment(frame, callee);
+			frame->Entry = callee;
+			frame->Mark = callee;
+			frame->Power = 1;
+			frame->Steps = 0;
+		}
+		else if (handler != nullptr)
+		{
+			flushBarriers(buffer);
+			handler(&state, buffer, (void*)ptr);
+		}
+		else
+		{
+			flushBarriers(buffer);
 			enqueueCommand(&state, buffer, op, (void*)ptr);
+		}
+	}
+
+	flushBarriers(buffer);
+}
+
+// epoch based reclamation of unlinked fragments. every running VM occupies a reader slot
+// holding the epoch it started in (0 = free). a fragment unlinked before vmRetireEpoch
+// returned e may be freed once vmCanFree(e) holds, i.e. all running VMs started later.
+#define EPOCH_READER_SLOTS 64
+
+static std::atomic<uint64_t> globalEpoch(1);
+static std::atomic<uint64_t> readerEpochs[EPOCH_READER_SLOTS];
 
-			ptr = ptr + length;
+static int enterEpoch()
+{
+	while (true)
+	{
+		auto epoch = globalEpoch.load();
+		for (int i = 0; i < EPOCH_READER_SLOTS; i++)
+		{
+			uint64_t expected = 0;
+			if (readerEpochs[i].compare_exchange_strong(expected, epoch)) return i;
 		}
+		std::this_thread::yield();
+	}
+}
 
-		fragment = fragment->Next;
+DllExport(void) vmRun(VkCommandBuffer buffer, CommandFragment* fragment)
+{
+	auto slot = enterEpoch();
+	runChain(buffer, fragment);
+	readerEpochs[slot].store(0, std::memory_order_release);
+}
+
+DllExport(uint64_t) vmRetireEpoch()
+{
+	return globalEpoch.fetch_add(1);
+}
+
+DllExport(int) vmCanFree(uint64_t epoch)
+{
+	for (int i = 0; i < EPOCH_READER_SLOTS; i++)
+	{
+		auto e = readerEpochs[i].load();
+		if (e != 0 && e <= epoch) return 0;
 	}
+	return 1;
 }
 
+// the chain may be modified while VMs are running it: every operation publishes
+// fully linked fragments with a single release store, so a running VM either sees the
+// old or the new chain. unlinked fragments keep their Next pointer, a VM currently
+// executing them continues with the rest of the chain.
+
+DllExport(void) vmLink(CommandFragment* left, CommandFragment* right)
+{
+	left->Next.store(right, std::memory_order_release);
+}
+
+DllExport(void) vmUnlink(CommandFragment* left)
+{
+	left->Next.store(nullptr, std::memory_order_release);
+}
+
+// inserts the chain first..last after left
+DllExport(void) vmInsertAfter(CommandFragment* left, CommandFragment* first, CommandFragment* last)
+{
+	last->Next.store(left->Next.load(std::memory_order_relaxed), std::memory_order_relaxed);
+	left->Next.store(first, std::memory_order_release);
+}
+
+// removes the chain left->Next..last
+DllExport(void) vmRemoveAfter(CommandFragment* left, CommandFragment* last)
+{
+	left->Next.store(last->Next.load(std::memory_order_relaxed), std::memory_order_release);
+}
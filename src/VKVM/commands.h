@@ -11,13 +11,17 @@
 #endif
 
 #include "vkvm.h"
+#include <atomic>
+#include <vector>
 
 
+struct CompiledFragment_;
 
 typedef struct CommandFragment_ {
-	uint32_t					CommandCount;
-	void*						Commands;
-	struct CommandFragment_*	Next;
+	uint32_t								CommandCount;
+	void*									Commands;
+	std::atomic<struct CommandFragment_*>	Next;		// written with release, read with acquire by vmRun
+	struct CompiledFragment_*				Compiled;	// decoded commands (vmCompile), null if not compiled
 } CommandFragment;
 
 
@@ -66,6 +70,36 @@ enum CommandType {
 	CmdNextSubpass = 42,
 	CmdEndRenderPass = 43,
 	CmdExecuteCommands = 44,
+	CmdPipelineBarrier2 = 45,
+	CmdSetEvent2 = 46,
+	CmdWaitEvents2 = 47,
+	CmdWriteTimestamp2 = 48,
+	CmdBeginRendering = 49,
+	CmdEndRendering = 50,
+	CmdSetCullMode = 51,
+	CmdSetFrontFace = 52,
+	CmdSetPrimitiveTopology = 53,
+	CmdSetDepthTestEnable = 54,
+	CmdSetDepthWriteEnable = 55,
+	CmdSetDepthCompareOp = 56,
+	CmdSetDepthBoundsTestEnable = 57,
+	CmdSetStencilTestEnable = 58,
+	CmdSetStencilOp = 59,
+	CmdSetRasterizerDiscardEnable = 60,
+	CmdSetDepthBiasEnable = 61,
+	CmdSetPrimitiveRestartEnable = 62,
+	CmdSetPatchControlPoints = 63,
+	CmdSetLogicOp = 64,
+	CmdSetPolygonMode = 65,
+	CmdSetRasterizationSamples = 66,
+	CmdSetDepthClampEnable = 67,
+	CmdSetColorBlendEnable = 68,
+	CmdSetColorWriteMask = 69,
+	CmdPushDescriptorSet = 70,
+	CmdPushDescriptorSetWithTemplate = 71,
+	CmdDrawMeshTasks = 72,
+	CmdDrawMeshTasksIndirect = 73,
+	CmdDrawMeshTasksIndirectCount = 74,
 
 	CmdCallFragment = 100,
 	CmdCustom = 101,
@@ -75,7 +109,9 @@ enum CommandType {
 	CmdIndirectBindDescriptorSets = 103,
 	CmdIndirectBindIndexBuffer = 104,
 	CmdIndirectBindVertexBuffers = 105,
-	CmdIndirectDraw = 106
+	CmdIndirectDraw = 106,
+	CmdIndirectPushDescriptorSet = 107,
+	CmdIndirectDrawMeshTasks = 108
 };
 
 
@@ -107,6 +143,17 @@ typedef struct {
 	VkImageMemoryBarrier*	ImageMemoryBarriers;
 } PipelineBarrierArgs;
 
+// VkDependencyInfo with its barrier arrays referenced relative to the command
+typedef struct {
+	VkDependencyFlags			DependencyFlags;
+	uint32_t					MemoryBarrierCount;
+	VkMemoryBarrier2*			MemoryBarriers;
+	uint32_t					BufferMemoryBarrierCount;
+	VkBufferMemoryBarrier2*		BufferMemoryBarriers;
+	uint32_t					ImageMemoryBarrierCount;
+	VkImageMemoryBarrier2*		ImageMemoryBarriers;
+} DependencyInfoArgs;
+
 DEFCMD(BindPipeline,
 	VkPipelineBindPoint		PipelineBindPoint;
 	VkPipeline				Pipeline;
@@ -406,6 +453,168 @@ DEFCMD(ExecuteCommands,
 	VkCommandBuffer*		CommandBuffers;
 )
 
+DEFCMD(PipelineBarrier2,
+	DependencyInfoArgs		DependencyInfo;
+)
+
+DEFCMD(SetEvent2,
+	VkEvent					Event;
+	DependencyInfoArgs		DependencyInfo;
+)
+
+// one dependency info per event
+DEFCMD(WaitEvents2,
+	uint32_t				EventCount;
+	VkEvent*				Events;
+	DependencyInfoArgs*		DependencyInfos;
+)
+
+DEFCMD(WriteTimestamp2,
+	VkPipelineStageFlags2	Stage;
+	VkQueryPool				QueryPool;
+	uint32_t				Query;
+)
+
+// VkRenderingInfo with its attachments referenced relative to the command,
+// a DepthAttachment/StencilAttachment offset of 0 means no attachment.
+DEFCMD(BeginRendering,
+	VkRenderingFlags			Flags;
+	VkRect2D					RenderArea;
+	uint32_t					LayerCount;
+	uint32_t					ViewMask;
+	uint32_t					ColorAttachmentCount;
+	VkRenderingAttachmentInfo*	ColorAttachments;
+	VkRenderingAttachmentInfo*	DepthAttachment;
+	VkRenderingAttachmentInfo*	StencilAttachment;
+)
+
+DEFCMD0(EndRendering)
+
+// extended dynamic state (VK_EXT_extended_dynamic_state 1/2/3)
+DEFCMD(SetCullMode,
+	VkCullModeFlags			CullMode;
+)
+
+DEFCMD(SetFrontFace,
+	VkFrontFace				FrontFace;
+)
+
+DEFCMD(SetPrimitiveTopology,
+	VkPrimitiveTopology		PrimitiveTopology;
+)
+
+DEFCMD(SetDepthTestEnable,
+	VkBool32				DepthTestEnable;
+)
+
+DEFCMD(SetDepthWriteEnable,
+	VkBool32				DepthWriteEnable;
+)
+
+DEFCMD(SetDepthCompareOp,
+	VkCompareOp				DepthCompareOp;
+)
+
+DEFCMD(SetDepthBoundsTestEnable,
+	VkBool32				DepthBoundsTestEnable;
+)
+
+DEFCMD(SetStencilTestEnable,
+	VkBool32				StencilTestEnable;
+)
+
+DEFCMD(SetStencilOp,
+	VkStencilFaceFlags		FaceMask;
+	VkStencilOp				FailOp;
+	VkStencilOp				PassOp;
+	VkStencilOp				DepthFailOp;
+	VkCompareOp				CompareOp;
+)
+
+DEFCMD(SetRasterizerDiscardEnable,
+	VkBool32				RasterizerDiscardEnable;
+)
+
+DEFCMD(SetDepthBiasEnable,
+	VkBool32				DepthBiasEnable;
+)
+
+DEFCMD(SetPrimitiveRestartEnable,
+	VkBool32				PrimitiveRestartEnable;
+)
+
+DEFCMD(SetPatchControlPoints,
+	uint32_t				PatchControlPoints;
+)
+
+DEFCMD(SetLogicOp,
+	VkLogicOp				LogicOp;
+)
+
+DEFCMD(SetPolygonMode,
+	VkPolygonMode			PolygonMode;
+)
+
+DEFCMD(SetRasterizationSamples,
+	VkSampleCountFlagBits	RasterizationSamples;
+)
+
+DEFCMD(SetDepthClampEnable,
+	VkBool32				DepthClampEnable;
+)
+
+DEFCMD(SetColorBlendEnable,
+	uint32_t				FirstAttachment;
+	uint32_t				AttachmentCount;
+	VkBool32*				ColorBlendEnables;
+)
+
+DEFCMD(SetColorWriteMask,
+	uint32_t				FirstAttachment;
+	uint32_t				AttachmentCount;
+	VkColorComponentFlags*	ColorWriteMasks;
+)
+
+// the writes and their image/buffer/texel buffer view arrays are referenced relative to the
+// command (0 = null), pNext chains are absolute.
+DEFCMD(PushDescriptorSet,
+	VkPipelineBindPoint		PipelineBindPoint;
+	VkPipelineLayout		Layout;
+	uint32_t				Set;
+	uint32_t				WriteCount;
+	VkWriteDescriptorSet*	Writes;
+)
+
+DEFCMD(PushDescriptorSetWithTemplate,
+	VkDescriptorUpdateTemplate	Template;
+	VkPipelineLayout			Layout;
+	uint32_t					Set;
+	uint32_t					DataSize;
+	void*						Data;
+)
+
+DEFCMD(DrawMeshTasks,
+	uint32_t				GroupCountX;
+	uint32_t				GroupCountY;
+	uint32_t				GroupCountZ;
+)
+
+DEFCMD(DrawMeshTasksIndirect,
+	VkBuffer				Buffer;
+	VkDeviceSize			Offset;
+	uint32_t				DrawCount;
+	uint32_t				Stride;
+)
+
+DEFCMD(DrawMeshTasksIndirectCount,
+	VkBuffer				Buffer;
+	VkDeviceSize			Offset;
+	VkBuffer				CountBuffer;
+	VkDeviceSize			CountBufferOffset;
+	uint32_t				MaxDrawCount;
+	uint32_t				Stride;
+)
+
 DEFCMD(CallFragment,
 	CommandFragment*        FragmentToCall;
 )
@@ -438,6 +647,16 @@ DEFCMD(IndirectDraw,
 	DrawCall* Calls;
 )
 
+DEFCMD(IndirectPushDescriptorSet,
+	PushDescriptorSetBinding* Binding;
+)
+
+DEFCMD(IndirectDrawMeshTasks,
+	RuntimeStats* Stats;
+	int* IsActive;
+	MeshTaskCall* Calls;
+)
+
 
 
 
@@ -495,5 +714,132 @@ typedef struct {
 } Command;
 */
 
+// handle types referenced by serialized command streams
+enum SerializedHandleType {
+	HandlePipeline = 1,
+	HandlePipelineLayout = 2,
+	HandleDescriptorSet = 3,
+	HandleBuffer = 4,
+	HandleImage = 5,
+	HandleEvent = 6,
+	HandleQueryPool = 7,
+	HandleRenderPass = 8,
+	HandleFramebuffer = 9,
+	HandleImageView = 10,
+	HandleSampler = 11,
+	HandleBufferView = 12
+};
+
+#define SERIALIZED_MAGIC 0x4D564B56 // "VKVM"
+#define SERIALIZED_VERSION 1
+
+// file layout: header, handle table, relocations, fragment table, command data.
+// all offsets are in bytes, relocation and fragment offsets are relative to the command data.
+typedef struct {
+	uint32_t	Magic;
+	uint32_t	Version;
+	uint32_t	PointerSize;
+	uint32_t	FragmentCount;
+	uint32_t	HandleCount;
+	uint32_t	RelocationCount;
+	uint64_t	HandlesOffset;
+	uint64_t	RelocationsOffset;
+	uint64_t	FragmentsOffset;
+	uint64_t	DataOffset;
+	uint64_t	DataSize;
+} SerializedHeader;
+
+typedef struct {
+	uint32_t	Type;		// SerializedHandleType
+	uint32_t	Padding;
+	uint64_t	Handle;		// the handle at export time
+} SerializedHandle;
+
+// a handle field in the command data, holding the index into the handle table in the file
+typedef struct {
+	uint64_t	Offset;
+	uint32_t	Handle;
+	uint32_t	Padding;
+} SerializedRelocation;
+
+typedef struct {
+	uint32_t	CommandCount;
+	uint32_t	Padding;
+	uint64_t	Offset;
+	uint64_t	Size;
+} SerializedFragment;
+
+// a memory-mapped command stream. the fragments run in place from the (copy-on-write)
+// mapping once the handles are bound via vmImportBind.
+typedef struct {
+	void*						Mapping;
+	uint64_t					MappingSize;
+	void*						FileHandle;
+	const SerializedHeader*		Header;
+	const SerializedHandle*		Handles;
+	const SerializedRelocation*	Relocations;
+	CommandFragment*			Fragments;
+} ImportedStream;
+
+typedef struct {
+	char*		Data;
+	uint64_t	Capacity;
+	uint64_t	Used;
+} EncoderChunk;
+
+// arena for building fragments natively, see encoder.cpp
+typedef struct {
+	std::vector<EncoderChunk>	Chunks;
+	uint64_t					ChunkSize;
+	size_t						Current;	// chunk of the open fragment
+	uint64_t					Start;		// offset of the open fragment's commands in the chunk
+	uint64_t					Last;		// offset of the last command relative to Start
+	uint32_t					Count;
+	CommandFragment*			Fragment;	// open fragment, null between vmEncoderFinish and vmEncoderBegin
+} CommandEncoder;
+
+typedef struct CommandState_ CommandState;
+typedef void (*CommandHandler)(CommandState* state, VkCommandBuffer buffer, void* data);
+
+// a validated command with its handler, CmdCallFragment has no handler
+typedef struct {
+	CommandHandler		Handler;
+	CommandType			OpCode;
+	void*				Data;
+} DecodedCommand;
+
+// the decoded commands of a fragment, valid as long as the fragment's commands are unchanged
+typedef struct CompiledFragment_ {
+	void*				Commands;
+	uint32_t			CommandCount;
+	DecodedCommand*		Decoded;
+} CompiledFragment;
+
 DllExport(void) vmRun(VkCommandBuffer buffer, CommandFragment* fragment);
+DllExport(int) vmCompile(CommandFragment* fragment, uint64_t size);
+DllExport(void) vmDecompile(CommandFragment* fragment);
+
+DllExport(int) vmExport(const char* path, CommandFragment* fragment);
+DllExport(ImportedStream*) vmImport(const char* path);
+DllExport(uint32_t) vmImportHandleCount(ImportedStream* stream);
+DllExport(const SerializedHandle*) vmImportHandles(ImportedStream* stream);
+DllExport(void) vmImportBind(ImportedStream* stream, const uint64_t* handles);
+DllExport(CommandFragment*) vmImportFragment(ImportedStream* stream);
+DllExport(void) vmImportClose(ImportedStream* stream);
+
+DllExport(CommandEncoder*) vmEncoderCreate(uint64_t chunkSize);
+DllExport(void) vmEncoderDelete(CommandEncoder* encoder);
+DllExport(void) vmEncoderReset(CommandEncoder* encoder);
+DllExport(void) vmEncoderBegin(CommandEncoder* encoder);
+DllExport(void*) vmEncoderPush(CommandEncoder* encoder, CommandType opCode, uint32_t size);
+DllExport(void*) vmEncoderPushArray(CommandEncoder* encoder, uint32_t field, const void* data, uint32_t count, uint32_t elementSize);
+DllExport(int) vmEncoderPushCommands(CommandEncoder* encoder, const void* commands, uint64_t size);
+DllExport(CommandFragment*) vmEncoderFinish(CommandEncoder* encoder, uint64_t* size);
+
+DllExport(void) vmLink(CommandFragment* left, CommandFragment* right);
+DllExport(void) vmUnlink(CommandFragment* left);
+DllExport(void) vmInsertAfter(CommandFragment* left, CommandFragment* first, CommandFragment* last);
+DllExport(void) vmRemoveAfter(CommandFragment* left, CommandFragment* last);
+DllExport(uint64_t) vmRetireEpoch();
+DllExport(int) vmCanFree(uint64_t epoch);
 
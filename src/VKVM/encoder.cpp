@@ -0,0 +1,241 @@
+#ifndef __GNUC__
+#include "stdafx.h"
+#endif
+
+#include "commands.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+
+#define DEFAULT_CHUNK_SIZE (1 << 20)
+
+static inline uint64_t align(uint64_t v, uint64_t a)
+{
+	return (v + a - 1) & ~(a - 1);
+}
+
+static EncoderChunk allocChunk(uint64_t capacity)
+{
+	EncoderChunk c;
+	c.Data = (char*)malloc((size_t)capacity);
+	c.Capacity = capacity;
+	c.Used = 0;
+	return c;
+}
+
+// reserves bytes at the end of the open fragment. moves the fragment's commands to
+// another chunk when the current one is full, so pointers into the fragment are only
+// valid until the next reserve (relative pointers stay valid).
+static char* reserve(CommandEncoder* encoder, uint64_t bytes)
+{
+	auto chunk = &encoder->Chunks[encoder->Current];
+	if (chunk->Used + bytes > chunk->Capacity)
+	{
+		auto pending = chunk->Used - encoder->Start;
+		auto needed = pending + bytes;
+
+		auto next = encoder->Current + 1;
+		if (next >= encoder->Chunks.size() || encoder->Chunks[next].Capacity < needed)
+		{
+			auto capacity = encoder->ChunkSize;
+			while (capacity < needed) capacity *= 2;
+			encoder->Chunks.insert(encoder->Chunks.begin() + next, allocChunk(capacity));
+			chunk = &encoder->Chunks[encoder->Current];
+		}
+
+		auto target = &encoder->Chunks[next];
+		memcpy(target->Data, chunk->Data + encoder->Start, (size_t)pending);
+		target->Used = pending;
+		chunk->Used = encoder->Start;
+
+		encoder->Current = next;
+		encoder->Start = 0;
+		chunk = target;
+	}
+
+	auto ptr = chunk->Data + chunk->Used;
+	chunk->Used += bytes;
+	return ptr;
+}
+
+static inline char* fragmentStart(CommandEncoder* encoder)
+{
+	return encoder->Chunks[encoder->Current].Data + encoder->Start;
+}
+
+DllExport(CommandEncoder*) vmEncoderCreate(uint64_t chunkSize)
+{
+	auto encoder = new CommandEncoder();
+	encoder->ChunkSize = chunkSize >= 256 ? align(chunkSize, 16) : DEFAULT_CHUNK_SIZE;
+	encoder->Chunks.push_back(allocChunk(encoder->ChunkSize));
+	encoder->Current = 0;
+	encoder->Start = 0;
+	encoder->Last = 0;
+	encoder->Count = 0;
+	encoder->Fragment = nullptr;
+	return encoder;
+}
+
+DllExport(void) vmEncoderDelete(CommandEncoder* encoder)
+{
+	if (encoder == nullptr) return;
+	for (auto& c : encoder->Chunks) free(c.Data);
+	delete encoder;
+}
+
+// releases all fragments of the encoder at once while keeping its memory.
+// compiled fragments need to be decompiled (vmDecompile) before.
+DllExport(void) vmEncoderReset(CommandEncoder* encoder)
+{
+	for (auto& c : encoder->Chunks) c.Used = 0;
+	encoder->Current = 0;
+	encoder->Start = 0;
+	encoder->Last = 0;
+	encoder->Count = 0;
+	encoder->Fragment = nullptr;
+}
+
+DllExport(void) vmEncoderBegin(CommandEncoder* encoder)
+{
+	if (encoder->Fragment != nullptr)
+	{
+		printf("[VKVM] vmEncoderBegin: previous fragment was not finished\n");
+		return;
+	}
+
+	// the fragment header is allocated in front of its commands
+	auto chunk = &encoder->Chunks[encoder->Current];
+	chunk->Used = align(chunk->Used, 16);
+	encoder->Start = chunk->Used;
+	encoder->Fragment = new (reserve(encoder, align(sizeof(CommandFragment), 16))) CommandFragment();
+	encoder->Start = encoder->Chunks[encoder->Current].Used;
+	encoder->Last = 0;
+	encoder->Count = 0;
+}
+
+// appends a zeroed command of the given size with Length and OpCode set and returns it.
+// the pointer is valid until the next push.
+DllExport(void*) vmEncoderPush(CommandEncoder* encoder, CommandType opCode, uint32_t size)
+{
+	if (encoder->Fragment == nullptr || size < 8)
+	{
+		printf("[VKVM] vmEncoderPush: no open fragment or invalid size %u\n", size);
+		return nullptr;
+	}
+
+	size = (uint32_t)align(size, 8);
+	auto ptr = reserve(encoder, size);
+	memset(ptr, 0, size);
+	*(uint32_t*)ptr = size;
+	*(CommandType*)(ptr + 4) = opCode;
+
+	encoder->Last = (uint64_t)(ptr - fragmentStart(encoder));
+	encoder->Count++;
+	return ptr;
+}
+
+// appends count elements to the last command and stores their relative pointer in the
+// field at the given offset of the command. copies data if not null and returns the elements.
+DllExport(void*) vmEncoderPushArray(CommandEncoder* encoder, uint32_t field, const void* data, uint32_t count, uint32_t elementSize)
+{
+	if (encoder->Fragment == nullptr || encoder->Count == 0)
+	{
+		printf("[VKVM] vmEncoderPushArray: no command to attach to\n");
+		return nullptr;
+	}
+
+	auto length = *(uint32_t*)(fragmentStart(encoder) + encoder->Last);
+	if (field < 8 || (uint64_t)field + sizeof(void*) > length)
+	{
+		printf("[VKVM] vmEncoderPushArray: field %u is outside of the command\n", field);
+		return nullptr;
+	}
+
+	auto offset = align(length, 8);
+	auto bytes = align((uint64_t)count * elementSize, 8);
+	reserve(encoder, offset - length + bytes);
+
+	// the command may have moved
+	auto cmd = fragmentStart(encoder) + encoder->Last;
+	auto arr = cmd + offset;
+	if (data != nullptr && count > 0) memcpy(arr, data, (size_t)count * elementSize);
+	if (offset > length) memset(cmd + length, 0, (size_t)(offset - length));
+
+	*(void**)(cmd + field) = (void*)(intptr_t)offset;
+	*(uint32_t*)cmd = (uint32_t)(offset + bytes);
+	return arr;
+}
+
+// appends size bytes of already encoded commands (e.g. an array of fixed-size commands
+// written by managed code) and returns their number, -1 if the commands are malformed.
+// managed commands are only 4-byte aligned (e.g. SetLineWidthCommand has 12 bytes), the
+// last one is padded so that the following commands start 8-byte aligned again.
+DllExport(int) vmEncoderPushCommands(CommandEncoder* encoder, const void* commands, uint64_t size)
+{
+	if (encoder->Fragment == nullptr)
+	{
+		printf("[VKVM] vmEncoderPushCommands: no open fragment\n");
+		return -1;
+	}
+
+	auto src = (const char*)commands;
+	uint64_t offset = 0;
+	uint64_t last = 0;
+	int count = 0;
+	while (offset < size)
+	{
+		if (size - offset < 8)
+		{
+			printf("[VKVM] vmEncoderPushCommands: command %d is truncated\n", count);
+			return -1;
+		}
+
+		auto length = *(const uint32_t*)(src + offset);
+		if (length < 8 || (length & 3) != 0 || length > size - offset)
+		{
+			printf("[VKVM] vmEncoderPushCommands: command %d is malformed\n", count);
+			return -1;
+		}
+		last = offset;
+		offset += length;
+		count++;
+	}
+	if (count == 0) return 0;
+
+	auto padding = align(size, 8) - size;
+	auto ptr = reserve(encoder, size + padding);
+	memcpy(ptr, src, (size_t)size);
+	if (padding != 0)
+	{
+		memset(ptr + size, 0, (size_t)padding);
+		*(uint32_t*)(ptr + last) += (uint32_t)padding;
+	}
+
+	encoder->Last = (uint64_t)(ptr - fragmentStart(encoder)) + last;
+	encoder->Count += count;
+	return count;
+}
+
+// finishes the open fragment and returns it. the fragment lives until the encoder is
+// reset or deleted. size receives the byte size of its commands (for vmCompile).
+DllExport(CommandFragment*) vmEncoderFinish(CommandEncoder* encoder, uint64_t* size)
+{
+	auto fragment = encoder->Fragment;
+	if (fragment == nullptr)
+	{
+		printf("[VKVM] vmEncoderFinish: no open fragment\n");
+		return nullptr;
+	}
+
+	fragment->CommandCount = encoder->Count;
+	fragment->Commands = fragmentStart(encoder);
+	fragment->Next.store(nullptr, std::memory_order_relaxed);
+	fragment->Compiled = nullptr;
+	if (size != nullptr) *size = encoder->Chunks[encoder->Current].Used - encoder->Start;
+
+	encoder->Fragment = nullptr;
+	encoder->Count = 0;
+	encoder->Last = 0;
+	return fragment;
+}
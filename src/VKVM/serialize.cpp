@@ -0,0 +1,621 @@
+#ifndef __GNUC__
+#include "stdafx.h"
+#endif
+
+#include "commands.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <unordered_map>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#define get(t,v) ((t##Command*)(v))
+#define getptr(t,v,r) (r*)(((char*)((t##Command*)data)->v) + (intptr_t)data)
+#define handle(f,t) visit((uint64_t*)&(f), t)
+
+static_assert(sizeof(VkPipeline) == sizeof(uint64_t), "non-dispatchable handles need to be 64 bit");
+
+template<typename F>
+static void visitDependencyInfo(char* data, DependencyInfoArgs* args, F&& visit)
+{
+	auto buffers = (VkBufferMemoryBarrier2*)(data + (intptr_t)args->BufferMemoryBarriers);
+	for (uint32_t i = 0; i < args->BufferMemoryBarrierCount; i++) handle(buffers[i].buffer, HandleBuffer);
+
+	auto images = (VkImageMemoryBarrier2*)(data + (intptr_t)args->ImageMemoryBarriers);
+	for (uint32_t i = 0; i < args->ImageMemoryBarrierCount; i++) handle(images[i].image, HandleImage);
+}
+
+// calls visit for every handle field of the command and returns false for commands
+// referencing memory outside of the command (which cannot be serialized).
+// handle fields may be unaligned (managed streams only align commands to 4 bytes).
+template<typename F>
+static bool visitHandles(char* data, F&& visit)
+{
+	auto op = *(CommandType*)(data + 4);
+
+	switch (op)
+	{
+	case CmdBindPipeline:
+		handle(get(BindPipeline, data)->Pipeline, HandlePipeline);
+		return true;
+
+	case CmdSetLineWidth:
+	case CmdSetDepthBias:
+	case CmdSetBlendConstants:
+	case CmdSetDepthBounds:
+	case CmdSetStencilCompareMask:
+	case CmdSetStencilWriteMask:
+	case CmdSetStencilReference:
+	case CmdDraw:
+	case CmdDrawIndexed:
+	case CmdDispatch:
+	case CmdDrawMeshTasks:
+	case CmdClearAttachments:
+	case CmdNextSubpass:
+	case CmdEndRenderPass:
+	case CmdEndRendering:
+	case CmdSetCullMode:
+	case CmdSetFrontFace:
+	case CmdSetPrimitiveTopology:
+	case CmdSetDepthTestEnable:
+	case CmdSetDepthWriteEnable:
+	case CmdSetDepthCompareOp:
+	case CmdSetDepthBoundsTestEnable:
+	case CmdSetStencilTestEnable:
+	case CmdSetStencilOp:
+	case CmdSetRasterizerDiscardEnable:
+	case CmdSetDepthBiasEnable:
+	case CmdSetPrimitiveRestartEnable:
+	case CmdSetPatchControlPoints:
+	case CmdSetLogicOp:
+	case CmdSetPolygonMode:
+	case CmdSetRasterizationSamples:
+	case CmdSetDepthClampEnable:
+	case CmdSetColorBlendEnable:
+	case CmdSetColorWriteMask:
+		return true;
+
+	case CmdBindDescriptorSets:
+	{
+		handle(get(BindDescriptorSets, data)->Layout, HandlePipelineLayout);
+		auto sets = getptr(BindDescriptorSets, DescriptorSets, VkDescriptorSet);
+		for (uint32_t i = 0; i < get(BindDescriptorSets, data)->SetCount; i++) handle(sets[i], HandleDescriptorSet);
+		return true;
+	}
+
+	case CmdBindIndexBuffer:
+		handle(get(BindIndexBuffer, data)->Buffer, HandleBuffer);
+		return true;
+
+	case CmdBindVertexBuffers:
+	{
+		auto buffers = getptr(BindVertexBuffers, Buffers, VkBuffer);
+		for (uint32_t i = 0; i < get(BindVertexBuffers, data)->BindingCount; i++) handle(buffers[i], HandleBuffer);
+		return true;
+	}
+
+	case CmdDrawIndirect:
+		handle(get(DrawIndirect, data)->Buffer, HandleBuffer);
+		return true;
+	case CmdDrawIndexedIndirect:
+		handle(get(DrawIndexedIndirect, data)->Buffer, HandleBuffer);
+		return true;
+	case CmdDispatchIndirect:
+		handle(get(DispatchIndirect, data)->Buffer, HandleBuffer);
+		return true;
+	case CmdDrawMeshTasksIndirect:
+		handle(get(DrawMeshTasksIndirect, data)->Buffer, HandleBuffer);
+		return true;
+	case CmdDrawMeshTasksIndirectCount:
+		handle(get(DrawMeshTasksIndirectCount, data)->Buffer, HandleBuffer);
+		handle(get(DrawMeshTasksIndirectCount, data)->CountBuffer, HandleBuffer);
+		return true;
+
+	case CmdCopyBuffer:
+		handle(get(CopyBuffer, data)->SrcBuffer, HandleBuffer);
+		handle(get(CopyBuffer, data)->DstBuffer, HandleBuffer);
+		return true;
+	case CmdCopyImage:
+		handle(get(CopyImage, data)->SrcImage, HandleImage);
+		handle(get(CopyImage, data)->DstImage, HandleImage);
+		return true;
+	case CmdBlitImage:
+		handle(get(BlitImage, data)->SrcImage, HandleImage);
+		handle(get(BlitImage, data)->DstImage, HandleImage);
+		return true;
+	case CmdResolveImage:
+		handle(get(ResolveImage, data)->SrcImage, HandleImage);
+		handle(get(ResolveImage, data)->DstImage, HandleImage);
+		return true;
+	case CmdCopyBufferToImage:
+		handle(get(CopyBufferToImage, data)->SrcBuffer, HandleBuffer);
+		handle(get(CopyBufferToImage, data)->DstImage, HandleImage);
+		return true;
+	case CmdCopyImageToBuffer:
+		handle(get(CopyImageToBuffer, data)->SrcImage, HandleImage);
+		handle(get(CopyImageToBuffer, data)->DstBuffer, HandleBuffer);
+		return true;
+	case CmdFillBuffer:
+		handle(get(FillBuffer, data)->DstBuffer, HandleBuffer);
+		return true;
+	case CmdClearColorImage:
+		handle(get(ClearColorImage, data)->Image, HandleImage);
+		return true;
+	case CmdClearDepthStencilImage:
+		handle(get(ClearDepthStencilImage, data)->Image, HandleImage);
+		return true;
+
+	case CmdSetEvent:
+		handle(get(SetEvent, data)->Event, HandleEvent);
+		return true;
+	case CmdResetEvent:
+		handle(get(ResetEvent, data)->Event, HandleEvent);
+		return true;
+
+	case CmdWaitEvents:
+	{
+		auto events = getptr(WaitEvents, Events, VkEvent);
+		for (uint32_t i = 0; i < get(WaitEvents, data)->EventCount; i++) handle(events[i], HandleEvent);
+
+		auto buffers = getptr(WaitEvents, BufferMemoryBarriers, VkBufferMemoryBarrier);
+		for (uint32_t i = 0; i < get(WaitEvents, data)->BufferMemoryBarrierCount; i++) handle(buffers[i].buffer, HandleBuffer);
+
+		auto images = getptr(WaitEvents, ImageMemoryBarriers, VkImageMemoryBarrier);
+		for (uint32_t i = 0; i < get(WaitEvents, data)->ImageMemoryBarrierCount; i++) handle(images[i].image, HandleImage);
+		return true;
+	}
+
+	case CmdPipelineBarrier:
+	{
+		auto buffers = getptr(PipelineBarrier, BufferMemoryBarriers, VkBufferMemoryBarrier);
+		for (uint32_t i = 0; i < get(PipelineBarrier, data)->BufferMemoryBarrierCount; i++) handle(buffers[i].buffer, HandleBuffer);
+
+		auto images = getptr(PipelineBarrier, ImageMemoryBarriers, VkImageMemoryBarrier);
+		for (uint32_t i = 0; i < get(PipelineBarrier, data)->ImageMemoryBarrierCount; i++) handle(images[i].image, HandleImage);
+		return true;
+	}
+
+	case CmdPipelineBarrier2:
+		visitDependencyInfo(data, &get(PipelineBarrier2, data)->DependencyInfo, visit);
+		return true;
+	case CmdSetEvent2:
+		handle(get(SetEvent2, data)->Event, HandleEvent);
+		visitDependencyInfo(data, &get(SetEvent2, data)->DependencyInfo, visit);
+		return true;
+	case CmdWaitEvents2:
+	{
+		auto events = getptr(WaitEvents2, Events, VkEvent);
+		auto infos = getptr(WaitEvents2, DependencyInfos, DependencyInfoArgs);
+		for (uint32_t i = 0; i < get(WaitEvents2, data)->EventCount; i++)
+		{
+			handle(events[i], HandleEvent);
+			visitDependencyInfo(data, &infos[i], visit);
+		}
+		return true;
+	}
+	case CmdWriteTimestamp2:
+		handle(get(WriteTimestamp2, data)->QueryPool, HandleQueryPool);
+		return true;
+
+	case CmdBeginRendering:
+	{
+		auto cmd = get(BeginRendering, data);
+		auto colors = getptr(BeginRendering, ColorAttachments, VkRenderingAttachmentInfo);
+		for (uint32_t i = 0; i < cmd->ColorAttachmentCount + 2; i++)
+		{
+			VkRenderingAttachmentInfo* a;
+			if (i < cmd->ColorAttachmentCount) a = &colors[i];
+			else if (i == cmd->ColorAttachmentCount && cmd->DepthAttachment) a = getptr(BeginRendering, DepthAttachment, VkRenderingAttachmentInfo);
+			else if (i > cmd->ColorAttachmentCount && cmd->StencilAttachment) a = getptr(BeginRendering, StencilAttachment, VkRenderingAttachmentInfo);
+			else continue;
+
+			if (a->pNext != nullptr) return false;
+			handle(a->imageView, HandleImageView);
+			handle(a->resolveImageView, HandleImageView);
+		}
+		return true;
+	}
+
+	case CmdPushDescriptorSet:
+	{
+		handle(get(PushDescriptorSet, data)->Layout, HandlePipelineLayout);
+		auto writes = getptr(PushDescriptorSet, Writes, VkWriteDescriptorSet);
+		for (uint32_t i = 0; i < get(PushDescriptorSet, data)->WriteCount; i++)
+		{
+			auto& w = writes[i];
+			if (w.pNext != nullptr) return false;
+
+			auto images = (VkDescriptorImageInfo*)(data + (intptr_t)w.pImageInfo);
+			auto buffers = (VkDescriptorBufferInfo*)(data + (intptr_t)w.pBufferInfo);
+			auto views = (VkBufferView*)(data + (intptr_t)w.pTexelBufferView);
+			for (uint32_t j = 0; j < w.descriptorCount; j++)
+			{
+				if (w.pImageInfo)
+				{
+					handle(images[j].sampler, HandleSampler);
+					handle(images[j].imageView, HandleImageView);
+				}
+				if (w.pBufferInfo) handle(buffers[j].buffer, HandleBuffer);
+				if (w.pTexelBufferView) handle(views[j], HandleBufferView);
+			}
+		}
+		return true;
+	}
+
+	case CmdBeginQuery:
+		handle(get(BeginQuery, data)->QueryPool, HandleQueryPool);
+		return true;
+	case CmdEndQuery:
+		handle(get(EndQuery, data)->QueryPool, HandleQueryPool);
+		return true;
+	case CmdResetQueryPool:
+		handle(get(ResetQueryPool, data)->QueryPool, HandleQueryPool);
+		return true;
+	case CmdWriteTimestamp:
+		handle(get(WriteTimestamp, data)->QueryPool, HandleQueryPool);
+		return true;
+	case CmdCopyQueryPoolResults:
+		handle(get(CopyQueryPoolResults, data)->QueryPool, HandleQueryPool);
+		handle(get(CopyQueryPoolResults, data)->DstBuffer, HandleBuffer);
+		return true;
+
+	case CmdBeginRenderPass:
+	{
+		// clear values are referenced by an absolute pointer
+		auto info = getptr(BeginRenderPass, RenderPassBegin, VkRenderPassBeginInfo);
+		if (info->pNext != nullptr || info->clearValueCount != 0) return false;
+		handle(info->renderPass, HandleRenderPass);
+		handle(info->framebuffer, HandleFramebuffer);
+		return true;
+	}
+
+	default:
+		// absolute pointers (viewports, push constant values, nested fragments, indirect bindings, ...)
+		return false;
+	}
+}
+
+#undef handle
+#undef get
+#undef getptr
+
+DllExport(int) vmExport(const char* path, CommandFragment* fragment)
+{
+	std::vector<SerializedHandle> handles;
+	std::vector<SerializedRelocation> relocations;
+	std::vector<SerializedFragment> fragments;
+	std::vector<char> commands;
+	std::unordered_map<uint64_t, uint32_t> handleIndices;
+
+	for (auto f = fragment; f != nullptr; f = f->Next.load(std::memory_order_acquire))
+	{
+		// fragments start 16 byte aligned
+		commands.resize((commands.size() + 15) & ~(size_t)15);
+
+		size_t size = 0;
+		auto src = (char*)f->Commands;
+		for (uint32_t i = 0; i < f->CommandCount; i++) size += *(uint32_t*)(src + size);
+
+		auto offset = commands.size();
+		commands.insert(commands.end(), src, src + size);
+		fragments.push_back({ f->CommandCount, 0, (uint64_t)offset, (uint64_t)size });
+
+		// replace the handles in the copy with their indices
+		auto ptr = commands.data() + offset;
+		for (uint32_t i = 0; i < f->CommandCount; i++)
+		{
+			auto ok = visitHandles(ptr, [&](uint64_t* field, SerializedHandleType type) {
+				uint64_t value;
+				memcpy(&value, field, sizeof(uint64_t));
+				if (value == 0) return;
+
+				auto it = handleIndices.find(value);
+				uint64_t index;
+				if (it == handleIndices.end())
+				{
+					index = handles.size();
+					handleIndices[value] = (uint32_t)index;
+					handles.push_back({ (uint32_t)type, 0, value });
+				}
+				else
+				{
+					index = it->second;
+				}
+
+				relocations.push_back({ (uint64_t)((char*)field - commands.data()), (uint32_t)index, 0 });
+				memcpy(field, &index, sizeof(uint64_t));
+			});
+
+			if (!ok)
+			{
+				printf("[VKVM] cannot serialize command %d\n", (int)*(CommandType*)(ptr + 4));
+				return 0;
+			}
+			ptr += *(uint32_t*)ptr;
+		}
+	}
+
+	SerializedHeader header;
+	header.Magic = SERIALIZED_MAGIC;
+	header.Version = SERIALIZED_VERSION;
+	header.PointerSize = (uint32_t)sizeof(void*);
+	header.FragmentCount = (uint32_t)fragments.size();
+	header.HandleCount = (uint32_t)handles.size();
+	header.RelocationCount = (uint32_t)relocations.size();
+	header.HandlesOffset = sizeof(SerializedHeader);
+	header.RelocationsOffset = header.HandlesOffset + handles.size() * sizeof(SerializedHandle);
+	header.FragmentsOffset = header.RelocationsOffset + relocations.size() * sizeof(SerializedRelocation);
+	header.DataOffset = (header.FragmentsOffset + fragments.size() * sizeof(SerializedFragment) + 15) & ~(uint64_t)15;
+	header.DataSize = commands.size();
+
+	auto file = fopen(path, "wb");
+	if (file == nullptr)
+	{
+		printf("[VKVM] cannot open %s\n", path);
+		return 0;
+	}
+
+	static const char padding[16] = { 0 };
+	auto pad = header.DataOffset - (header.FragmentsOffset + fragments.size() * sizeof(SerializedFragment));
+
+	fwrite(&header, sizeof(SerializedHeader), 1, file);
+	fwrite(handles.data(), sizeof(SerializedHandle), handles.size(), file);
+	fwrite(relocations.data(), sizeof(SerializedRelocation), relocations.size(), file);
+	fwrite(fragments.data(), sizeof(SerializedFragment), fragments.size(), file);
+	fwrite(padding, 1, (size_t)pad, file);
+	fwrite(commands.data(), 1, commands.size(), file);
+	auto failed = ferror(file) != 0;
+	fclose(file);
+
+	return failed ? 0 : 1;
+}
+
+static void unmap(ImportedStream* stream)
+{
+#ifdef _WIN32
+	if (stream->Mapping != nullptr) UnmapViewOfFile(stream->Mapping);
+	if (stream->FileHandle != nullptr) CloseHandle((HANDLE)stream->FileHandle);
+#else
+	if (stream->Mapping != nullptr) munmap(stream->Mapping, (size_t)stream->MappingSize);
+#endif
+	stream->Mapping = nullptr;
+	stream->FileHandle = nullptr;
+}
+
+// true if count elements of the given size at offset lie within size bytes (without overflowing)
+static inline bool inRange(uint64_t offset, uint64_t count, uint64_t elementSize, uint64_t size)
+{
+	if (offset > size) return false;
+	return elementSize == 0 || count <= (size - offset) / elementSize;
+}
+
+// checks the tables and command lengths of a mapped stream against the mapping. the contents
+// of the commands are not checked here, see validCommands.
+static bool validStream(const char* base, uint64_t mappingSize)
+{
+	if (mappingSize < sizeof(SerializedHeader)) return false;
+
+	auto header = (const SerializedHeader*)base;
+	if (header->Magic != SERIALIZED_MAGIC || header->Version != SERIALIZED_VERSION ||
+		header->PointerSize != (uint32_t)sizeof(void*))
+		return false;
+
+	if ((header->HandlesOffset & 7) != 0 || (header->RelocationsOffset & 7) != 0 ||
+		(header->FragmentsOffset & 7) != 0 || (header->DataOffset & 15) != 0)
+		return false;
+
+	if (!inRange(header->HandlesOffset, header->HandleCount, sizeof(SerializedHandle), mappingSize) ||
+		!inRange(header->RelocationsOffset, header->RelocationCount, sizeof(SerializedRelocation), mappingSize) ||
+		!inRange(header->FragmentsOffset, header->FragmentCount, sizeof(SerializedFragment), mappingSize) ||
+		!inRange(header->DataOffset, header->DataSize, 1, mappingSize))
+		return false;
+
+	auto relocations = (const SerializedRelocation*)(base + header->RelocationsOffset);
+	for (uint32_t i = 0; i < header->RelocationCount; i++)
+	{
+		const auto& r = relocations[i];
+		if ((r.Offset & 3) != 0 || !inRange(r.Offset, 1, sizeof(uint64_t), header->DataSize) || r.Handle >= header->HandleCount)
+			return false;
+	}
+
+	// the commands of each fragment need to fill exactly its range
+	auto data = base + header->DataOffset;
+	auto fragments = (const SerializedFragment*)(base + header->FragmentsOffset);
+	for (uint32_t i = 0; i < header->FragmentCount; i++)
+	{
+		const auto& f = fragments[i];
+		if ((f.Offset & 15) != 0 || !inRange(f.Offset, f.Size, 1, header->DataSize)) return false;
+
+		uint64_t offset = 0;
+		for (uint32_t c = 0; c < f.CommandCount; c++)
+		{
+			if (f.Size - offset < 8) return false;
+			auto length = *(const uint32_t*)(data + f.Offset + offset);
+			if (length < 8 || (length & 3) != 0 || length > f.Size - offset) return false;
+			offset += length;
+		}
+		if (offset != f.Size) return false;
+	}
+
+	return true;
+}
+
+// compiles the imported fragments (validating the relative pointers of their commands) and checks
+// that they only contain commands vmExport can write, and that the relocations cover exactly their
+// non-null handle fields with handles of the right type. otherwise running the stream could
+// follow absolute pointers or raw handles taken from the file.
+static bool validCommands(ImportedStream* stream)
+{
+	auto header = stream->Header;
+	auto data = (char*)stream->Mapping + header->DataOffset;
+	auto fragments = (const SerializedFragment*)((char*)stream->Mapping + header->FragmentsOffset);
+
+	std::unordered_map<uint64_t, SerializedHandleType> fields;
+	bool exportable = true;
+	for (uint32_t i = 0; i < header->FragmentCount && exportable; i++)
+	{
+		if (!vmCompile(&stream->Fragments[i], fragments[i].Size)) return false;
+
+		auto ptr = data + fragments[i].Offset;
+		for (uint32_t c = 0; c < fragments[i].CommandCount && exportable; c++)
+		{
+			exportable = visitHandles(ptr, [&](uint64_t* field, SerializedHandleType type) {
+				if (!fields.emplace((uint64_t)((char*)field - data), type).second) exportable = false;
+			});
+			ptr += *(uint32_t*)ptr;
+		}
+	}
+	if (!exportable) return false;
+
+	for (uint32_t i = 0; i < header->RelocationCount; i++)
+	{
+		const auto& r = stream->Relocations[i];
+		auto it = fields.find(r.Offset);
+		if (it == fields.end() || stream->Handles[r.Handle].Type != (uint32_t)it->second) return false;
+		fields.erase(it);
+	}
+
+	// handle fields without relocation need to be null
+	for (const auto& f : fields)
+	{
+		uint64_t value;
+		memcpy(&value, data + f.first, sizeof(uint64_t));
+		if (value != 0) return false;
+	}
+	return true;
+}
+
+DllExport(ImportedStream*) vmImport(const char* path)
+{
+	auto stream = new ImportedStream();
+	memset(stream, 0, sizeof(ImportedStream));
+
+	// map the file copy-on-write, binding the handles only touches the pages containing them
+#ifdef _WIN32
+	auto file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER size;
+		GetFileSizeEx(file, &size);
+		auto mapping = CreateFileMappingA(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+		CloseHandle(file);
+
+		if (mapping != nullptr)
+		{
+			stream->FileHandle = mapping;
+			stream->MappingSize = (uint64_t)size.QuadPart;
+			stream->Mapping = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+		}
+	}
+#else
+	auto fd = open(path, O_RDONLY);
+	if (fd >= 0)
+	{
+		struct stat st;
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			auto ptr = mmap(nullptr, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+			if (ptr != MAP_FAILED)
+			{
+				stream->Mapping = ptr;
+				stream->MappingSize = (uint64_t)st.st_size;
+			}
+		}
+		close(fd);
+	}
+#endif
+
+	if (stream->Mapping == nullptr)
+	{
+		printf("[VKVM] cannot map %s\n", path);
+		unmap(stream);
+		delete stream;
+		return nullptr;
+	}
+
+	auto base = (char*)stream->Mapping;
+	auto header = (const SerializedHeader*)base;
+	if (!validStream(base, stream->MappingSize))
+	{
+		printf("[VKVM] invalid command stream %s\n", path);
+		unmap(stream);
+		delete stream;
+		return nullptr;
+	}
+
+	stream->Header = header;
+	stream->Handles = (const SerializedHandle*)(base + header->HandlesOffset);
+	stream->Relocations = (const SerializedRelocation*)(base + header->RelocationsOffset);
+
+	auto fragments = (const SerializedFragment*)(base + header->FragmentsOffset);
+	auto data = base + header->DataOffset;
+	stream->Fragments = new CommandFragment[header->FragmentCount > 0 ? header->FragmentCount : 1];
+	for (uint32_t i = 0; i < header->FragmentCount; i++)
+	{
+		auto& f = stream->Fragments[i];
+		f.CommandCount = fragments[i].CommandCount;
+		f.Commands = data + fragments[i].Offset;
+		f.Next.store(i + 1 < header->FragmentCount ? &stream->Fragments[i + 1] : nullptr);
+		f.Compiled = nullptr;
+	}
+	if (header->FragmentCount == 0)
+	{
+		stream->Fragments[0].CommandCount = 0;
+		stream->Fragments[0].Commands = nullptr;
+		stream->Fragments[0].Next.store(nullptr);
+		stream->Fragments[0].Compiled = nullptr;
+	}
+
+	if (!validCommands(stream))
+	{
+		printf("[VKVM] invalid commands in %s\n", path);
+		vmImportClose(stream);
+		return nullptr;
+	}
+
+	return stream;
+}
+
+DllExport(uint32_t) vmImportHandleCount(ImportedStream* stream)
+{
+	return stream->Header->HandleCount;
+}
+
+DllExport(const SerializedHandle*) vmImportHandles(ImportedStream* stream)
+{
+	return stream->Handles;
+}
+
+// patches the handle fields with the given handles, indexed like the handle table.
+// needs to be called before running the imported fragments.
+DllExport(void) vmImportBind(ImportedStream* stream, const uint64_t* handles)
+{
+	auto data = (char*)stream->Mapping + stream->Header->DataOffset;
+	for (uint32_t i = 0; i < stream->Header->RelocationCount; i++)
+	{
+		const auto& r = stream->Relocations[i];
+		memcpy(data + r.Offset, &handles[r.Handle], sizeof(uint64_t));
+	}
+}
+
+DllExport(CommandFragment*) vmImportFragment(ImportedStream* stream)
+{
+	return stream->Fragments;
+}
+
+DllExport(void) vmImportClose(ImportedStream* stream)
+{
+	if (stream == nullptr) return;
+	for (uint32_t i = 0; i < stream->Header->FragmentCount; i++) vmDecompile(&stream->Fragments[i]);
+	delete[] stream->Fragments;
+	unmap(stream);
+	delete stream;
+}
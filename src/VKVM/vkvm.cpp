@@ -4,8 +4,99 @@
 
 #include "vkvm.h"
 #include <stdio.h>
+#include <vector>
+#include <mutex>
 
 
+DeviceFunctions deviceFunctions = {};
+
+// VMFeatures passed to vmInit
+static uint32_t enabledFeatures = VMFeatureNone;
+
+// the device passed to vmInit, the functions above belong to it
+static VkDevice initializedDevice = nullptr;
+static std::mutex initMtx;
+
+static PFN_vkVoidFunction loadFunction(VkDevice device, const char* name, const char* alias)
+{
+	auto f = vkGetDeviceProcAddr(device, name);
+	if (f == nullptr && alias != nullptr) f = vkGetDeviceProcAddr(device, alias);
+	return f;
+}
+
+#define load(feature, n, alias) deviceFunctions.n = (features & feature) ? (PFN_vk##n)loadFunction(device, "vk" #n, alias) : nullptr;
+
+DllExport(int) vmInit(VkDevice device, uint32_t features)
+{
+	std::lock_guard<std::mutex> lock(initMtx);
+	if (initializedDevice != nullptr && initializedDevice != device)
+	{
+		printf("[VKVM] vmInit: another device is initialized, the VM only supports one device at a time\n");
+		return 0;
+	}
+
+	initializedDevice = device;
+	enabledFeatures = features;
+
+	load(VMFeatureSynchronization2, CmdPipelineBarrier2, "vkCmdPipelineBarrier2KHR")
+	load(VMFeatureSynchronization2, CmdSetEvent2, "vkCmdSetEvent2KHR")
+	load(VMFeatureSynchronization2, CmdWaitEvents2, "vkCmdWaitEvents2KHR")
+	load(VMFeatureSynchronization2, CmdWriteTimestamp2, "vkCmdWriteTimestamp2KHR")
+	load(VMFeatureDynamicRendering, CmdBeginRendering, "vkCmdBeginRenderingKHR")
+	load(VMFeatureDynamicRendering, CmdEndRendering, "vkCmdEndRenderingKHR")
+	load(VMFeatureExtendedDynamicState, CmdSetCullMode, "vkCmdSetCullModeEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetFrontFace, "vkCmdSetFrontFaceEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetPrimitiveTopology, "vkCmdSetPrimitiveTopologyEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetDepthTestEnable, "vkCmdSetDepthTestEnableEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetDepthWriteEnable, "vkCmdSetDepthWriteEnableEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetDepthCompareOp, "vkCmdSetDepthCompareOpEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetDepthBoundsTestEnable, "vkCmdSetDepthBoundsTestEnableEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetStencilTestEnable, "vkCmdSetStencilTestEnableEXT")
+	load(VMFeatureExtendedDynamicState, CmdSetStencilOp, "vkCmdSetStencilOpEXT")
+	load(VMFeatureExtendedDynamicState2, CmdSetRasterizerDiscardEnable, "vkCmdSetRasterizerDiscardEnableEXT")
+	load(VMFeatureExtendedDynamicState2, CmdSetDepthBiasEnable, "vkCmdSetDepthBiasEnableEXT")
+	load(VMFeatureExtendedDynamicState2, CmdSetPrimitiveRestartEnable, "vkCmdSetPrimitiveRestartEnableEXT")
+	load(VMFeatureExtendedDynamicState2PatchControlPoints, CmdSetPatchControlPointsEXT, nullptr)
+	load(VMFeatureExtendedDynamicState2LogicOp, CmdSetLogicOpEXT, nullptr)
+	load(VMFeatureExtendedDynamicState3PolygonMode, CmdSetPolygonModeEXT, nullptr)
+	load(VMFeatureExtendedDynamicState3RasterizationSamples, CmdSetRasterizationSamplesEXT, nullptr)
+	load(VMFeatureExtendedDynamicState3DepthClampEnable, CmdSetDepthClampEnableEXT, nullptr)
+	load(VMFeatureExtendedDynamicState3ColorBlendEnable, CmdSetColorBlendEnableEXT, nullptr)
+	load(VMFeatureExtendedDynamicState3ColorWriteMask, CmdSetColorWriteMaskEXT, nullptr)
+	load(VMFeaturePushDescriptor, CmdPushDescriptorSetKHR, "vkCmdPushDescriptorSet")
+	load(VMFeaturePushDescriptor, CmdPushDescriptorSetWithTemplateKHR, "vkCmdPushDescriptorSetWithTemplate")
+	load(VMFeatureMultiDraw, CmdDrawMultiEXT, nullptr)
+	load(VMFeatureMultiDraw, CmdDrawMultiIndexedEXT, nullptr)
+	load(VMFeatureDrawIndirectCount, CmdDrawIndirectCount, "vkCmdDrawIndirectCountKHR")
+	load(VMFeatureDrawIndirectCount, CmdDrawIndexedIndirectCount, "vkCmdDrawIndexedIndirectCountKHR")
+	load(VMFeatureMeshShader, CmdDrawMeshTasksEXT, nullptr)
+	load(VMFeatureMeshShader, CmdDrawMeshTasksIndirectEXT, nullptr)
+	load(VMFeatureMeshShader, CmdDrawMeshTasksIndirectCountEXT, nullptr)
+	return 1;
+}
+
+#undef load
+
+// VkPhysicalDeviceMultiDrawPropertiesEXT::maxMultiDrawCount, at least 1024 if the extension is supported
+static uint32_t maxMultiDrawCount = 1024;
+
+DllExport(void) vmSetMaxMultiDrawCount(uint32_t count)
+{
+	maxMultiDrawCount = count;
+}
+
+// forgets the functions of the device (before it is destroyed), so that another device can be initialized
+DllExport(void) vmRelease(VkDevice device)
+{
+	std::lock_guard<std::mutex> lock(initMtx);
+	if (initializedDevice != device) return;
+
+	initializedDevice = nullptr;
+	enabledFeatures = VMFeatureNone;
+	deviceFunctions = {};
+	maxMultiDrawCount = 1024;
+}
+
 DllExport(void) vmBindDescriptorSets(VkCommandBuffer commandBuffer, DescriptorSetBinding* binding)
 {
 	if (binding->Count == 0)return;
@@ -23,11 +114,77 @@ DllExport(void) vmBindVertexBuffers(VkCommandBuffer commandBuffer, VertexBufferB
 	vkCmdBindVertexBuffers(commandBuffer, binding->FirstBinding, binding->BindingCount, binding->Buffers, binding->Offsets);
 }
 
+DllExport(void) vmPushDescriptorSet(VkCommandBuffer commandBuffer, PushDescriptorSetBinding* binding)
+{
+	if (binding->WriteCount == 0)return;
+	if (deviceFunctions.CmdPushDescriptorSetKHR == nullptr)
+	{
+		printf("[VKVM] vkCmdPushDescriptorSetKHR is not available (vmInit not called or not enabled on the device)\n");
+		return;
+	}
+	deviceFunctions.CmdPushDescriptorSetKHR(commandBuffer, binding->BindPoint, binding->Layout, binding->Set, binding->WriteCount, binding->Writes);
+}
+
+// issues runs of draws sharing instance count and first instance as one vkCmdDrawMulti(Indexed)EXT,
+// the draw infos are collected in per-thread scratch arrays.
+static void drawMulti(VkCommandBuffer commandBuffer, RuntimeStats* stats, DrawCall* call)
+{
+	static thread_local std::vector<VkMultiDrawInfoEXT> draws;
+	static thread_local std::vector<VkMultiDrawIndexedInfoEXT> indexedDraws;
+
+	auto info = call->DrawCalls;
+	auto count = call->Count;
+	auto indexed = call->IsIndexed;
+	stats->DrawCalls += count;
+
+	int i = 0;
+	while (i < count)
+	{
+		auto instanceCount = info[i].InstanceCount;
+		auto firstInstance = info[i].FirstInstance;
+		if (instanceCount == 0 || info[i].FaceVertexCount == 0) { i++; continue; }
+
+		draws.clear();
+		indexedDraws.clear();
+		for (; i < count && (uint32_t)(draws.size() + indexedDraws.size()) < maxMultiDrawCount; i++)
+		{
+			auto& d = info[i];
+			if (d.FaceVertexCount == 0) continue;
+			if (d.InstanceCount != instanceCount || d.FirstInstance != firstInstance) break;
+
+			if (indexed) indexedDraws.push_back({ (uint32_t)d.FirstIndex, (uint32_t)d.FaceVertexCount, d.BaseVertex });
+			else draws.push_back({ (uint32_t)d.FirstIndex, (uint32_t)d.FaceVertexCount });
+		}
+
+		auto n = (uint32_t)(indexed ? indexedDraws.size() : draws.size());
+		stats->EffectiveDrawCalls += instanceCount * (int)n;
+
+		if (indexed)
+			deviceFunctions.CmdDrawMultiIndexedEXT(commandBuffer, n, indexedDraws.data(), instanceCount, firstInstance, sizeof(VkMultiDrawIndexedInfoEXT), nullptr);
+		else
+			deviceFunctions.CmdDrawMultiEXT(commandBuffer, n, draws.data(), instanceCount, firstInstance, sizeof(VkMultiDrawInfoEXT));
+	}
+}
+
 DllExport(void) vmDraw(VkCommandBuffer commandBuffer, RuntimeStats* stats, int* isActive, DrawCall* call)
 {
 	if (!*isActive || call->Count == 0) return;
+	auto indexed = call->IsIndexed;
 
-	if (call->IsIndirect)
+	if (call->IsIndirect && call->HasCount)
+	{
+		// the actual count is only known on the GPU, Count is an upper bound
+		stats->DrawCalls++;
+		stats->EffectiveDrawCalls += call->Count;
+		const auto& buffer = call->DrawCallBuffer;
+
+		auto draw = indexed ? deviceFunctions.CmdDrawIndexedIndirectCount : deviceFunctions.CmdDrawIndirectCount;
+		if (draw == nullptr)
+			printf("[VKVM] %s is not available (vmInit not called or not enabled on the device)\n", indexed ? "vkCmdDrawIndexedIndirectCount" : "vkCmdDrawIndirectCount");
+		else
+			draw(commandBuffer, buffer.Handle, buffer.Offset, buffer.CountHandle, buffer.CountOffset, (uint32_t)call->Count, buffer.Stride);
+	}
+	else if (call->IsIndirect)
 	{
 		stats->DrawCalls++;
 		stats->EffectiveDrawCalls += call->Count;
@@ -38,11 +195,14 @@ DllExport(void) vmDraw(VkCommandBuffer commandBuffer, RuntimeStats* stats, int*
 		else
 			vkCmdDrawIndirect(commandBuffer, buffer.Handle, buffer.Offset, call->Count, buffer.Stride);
 	}
+	else if ((enabledFeatures & VMFeatureMultiDraw) && maxMultiDrawCount > 1 && (indexed ? deviceFunctions.CmdDrawMultiIndexedEXT != nullptr : deviceFunctions.CmdDrawMultiEXT != nullptr))
+	{
+		drawMulti(commandBuffer, stats, call);
+	}
 	else
 	{
 		auto info = call->DrawCalls;
 		auto count = call->Count;
-		auto indexed = call->IsIndexed;
 		stats->DrawCalls += count;
 
 		for (int i = 0; i < count; i++, info += 1)
@@ -60,3 +220,56 @@ DllExport(void) vmDraw(VkCommandBuffer commandBuffer, RuntimeStats* stats, int*
 		}
 	}
 }
+
+DllExport(void) vmDrawMeshTasks(VkCommandBuffer commandBuffer, RuntimeStats* stats, int* isActive, MeshTaskCall* call)
+{
+	if (!*isActive || call->Count == 0) return;
+
+	if (call->IsIndirect)
+	{
+		// with a count buffer Count is the maximum (upper bound for the stats)
+		stats->DrawCalls++;
+		stats->EffectiveDrawCalls += call->Count;
+		const auto& buffer = call->TaskBuffer;
+
+		if (call->HasCount)
+		{
+			if (deviceFunctions.CmdDrawMeshTasksIndirectCountEXT == nullptr)
+			{
+				printf("[VKVM] vkCmdDrawMeshTasksIndirectCountEXT is not available (vmInit not called or not enabled on the device)\n");
+				return;
+			}
+			deviceFunctions.CmdDrawMeshTasksIndirectCountEXT(commandBuffer, buffer.Handle, buffer.Offset, buffer.CountHandle, buffer.CountOffset, (uint32_t)call->Count, buffer.Stride);
+		}
+		else
+		{
+			if (deviceFunctions.CmdDrawMeshTasksIndirectEXT == nullptr)
+			{
+				printf("[VKVM] vkCmdDrawMeshTasksIndirectEXT is not available (vmInit not called or not enabled on the device)\n");
+				return;
+			}
+			deviceFunctions.CmdDrawMeshTasksIndirectEXT(commandBuffer, buffer.Handle, buffer.Offset, (uint32_t)call->Count, buffer.Stride);
+		}
+	}
+	else
+	{
+		if (deviceFunctions.CmdDrawMeshTasksEXT == nullptr)
+		{
+			printf("[VKVM] vkCmdDrawMeshTasksEXT is not available (vmInit not called or not enabled on the device)\n");
+			return;
+		}
+
+		auto groups = call->Groups;
+		auto count = call->Count;
+		stats->DrawCalls += count;
+
+		for (int i = 0; i < count; i++, groups += 1)
+		{
+			if (groups->groupCountX != 0 && groups->groupCountY != 0 && groups->groupCountZ != 0)
+			{
+				stats->EffectiveDrawCalls++;
+				deviceFunctions.CmdDrawMeshTasksEXT(commandBuffer, groups->groupCountX, groups->groupCountY, groups->groupCountZ);
+			}
+		}
+	}
+}
@@ -24,9 +24,12 @@ typedef struct {
 	int BaseVertex;
 } DrawCallInfo;
 
+// indirect draws with HasCount read the draw count from CountHandle/CountOffset,
+// Count is the maximum number of draws then.
 typedef struct {
 	uint8_t		IsIndirect;
 	uint8_t		IsIndexed;
+	uint8_t		HasCount;
 	int			Count;
 	union {
 		DrawCallInfo*  DrawCalls;
@@ -34,10 +37,29 @@ typedef struct {
 			VkBuffer Handle;
 			uint64_t Offset;
 			int		 Stride;
+			VkBuffer CountHandle;
+			uint64_t CountOffset;
 		} DrawCallBuffer;
 	};
 } DrawCall;
 
+// mesh task draws: either Count direct group counts or an indirect buffer like DrawCall
+typedef struct {
+	uint8_t		IsIndirect;
+	uint8_t		HasCount;
+	int			Count;
+	union {
+		VkDrawMeshTasksIndirectCommandEXT*  Groups;
+		struct {
+			VkBuffer Handle;
+			uint64_t Offset;
+			int		 Stride;
+			VkBuffer CountHandle;
+			uint64_t CountOffset;
+		} TaskBuffer;
+	};
+} MeshTaskCall;
+
 typedef struct {
 	int FirstBinding;
 	int BindingCount;
@@ -59,9 +81,90 @@ typedef struct {
 	VkIndexType Type;
 } IndexBufferBinding;
 
+typedef struct {
+	VkPipelineBindPoint BindPoint;
+	VkPipelineLayout Layout;
+	uint32_t Set;
+	uint32_t WriteCount;
+	VkWriteDescriptorSet* Writes;
+} PushDescriptorSetBinding;
+
+
+// device extensions and features enabled on the device passed to vmInit. commands of extensions
+// that are not enabled must not be used (even if the driver exports them) and are left null.
+// each bit requires the extension and the corresponding Vk*Features member enabled on the device,
+// the extended dynamic state 2/3 setters have a bit per feature member.
+typedef enum {
+	VMFeatureNone										= 0x0000,
+	VMFeatureSynchronization2							= 0x0001,	// synchronization2
+	VMFeatureDynamicRendering							= 0x0002,	// dynamicRendering
+	VMFeatureExtendedDynamicState						= 0x0004,	// extendedDynamicState
+	VMFeatureExtendedDynamicState2						= 0x0008,	// extendedDynamicState2
+	VMFeatureExtendedDynamicState3PolygonMode			= 0x0010,	// extendedDynamicState3PolygonMode
+	VMFeaturePushDescriptor								= 0x0020,
+	VMFeatureMultiDraw									= 0x0040,	// multiDraw
+	VMFeatureDrawIndirectCount							= 0x0080,
+	VMFeatureMeshShader									= 0x0100,	// meshShader
+	VMFeatureExtendedDynamicState2LogicOp				= 0x0200,	// extendedDynamicState2LogicOp
+	VMFeatureExtendedDynamicState2PatchControlPoints	= 0x0400,	// extendedDynamicState2PatchControlPoints
+	VMFeatureExtendedDynamicState3RasterizationSamples	= 0x0800,	// extendedDynamicState3RasterizationSamples
+	VMFeatureExtendedDynamicState3DepthClampEnable		= 0x1000,	// extendedDynamicState3DepthClampEnable
+	VMFeatureExtendedDynamicState3ColorBlendEnable		= 0x2000,	// extendedDynamicState3ColorBlendEnable
+	VMFeatureExtendedDynamicState3ColorWriteMask		= 0x4000,	// extendedDynamicState3ColorWriteMask
+} VMFeatures;
+
+// device level commands of newer Vulkan versions and extensions, which the loader does not
+// necessarily export. loaded by vmInit, null if the feature is not enabled on the device.
+typedef struct {
+	PFN_vkCmdPipelineBarrier2				CmdPipelineBarrier2;
+	PFN_vkCmdSetEvent2						CmdSetEvent2;
+	PFN_vkCmdWaitEvents2					CmdWaitEvents2;
+	PFN_vkCmdWriteTimestamp2				CmdWriteTimestamp2;
+	PFN_vkCmdBeginRendering					CmdBeginRendering;
+	PFN_vkCmdEndRendering					CmdEndRendering;
+	PFN_vkCmdSetCullMode					CmdSetCullMode;
+	PFN_vkCmdSetFrontFace					CmdSetFrontFace;
+	PFN_vkCmdSetPrimitiveTopology			CmdSetPrimitiveTopology;
+	PFN_vkCmdSetDepthTestEnable				CmdSetDepthTestEnable;
+	PFN_vkCmdSetDepthWriteEnable			CmdSetDepthWriteEnable;
+	PFN_vkCmdSetDepthCompareOp				CmdSetDepthCompareOp;
+	PFN_vkCmdSetDepthBoundsTestEnable		CmdSetDepthBoundsTestEnable;
+	PFN_vkCmdSetStencilTestEnable			CmdSetStencilTestEnable;
+	PFN_vkCmdSetStencilOp					CmdSetStencilOp;
+	PFN_vkCmdSetRasterizerDiscardEnable		CmdSetRasterizerDiscardEnable;
+	PFN_vkCmdSetDepthBiasEnable				CmdSetDepthBiasEnable;
+	PFN_vkCmdSetPrimitiveRestartEnable		CmdSetPrimitiveRestartEnable;
+	PFN_vkCmdSetPatchControlPointsEXT		CmdSetPatchControlPointsEXT;
+	PFN_vkCmdSetLogicOpEXT					CmdSetLogicOpEXT;
+	PFN_vkCmdSetPolygonModeEXT				CmdSetPolygonModeEXT;
+	PFN_vkCmdSetRasterizationSamplesEXT		CmdSetRasterizationSamplesEXT;
+	PFN_vkCmdSetDepthClampEnableEXT			CmdSetDepthClampEnableEXT;
+	PFN_vkCmdSetColorBlendEnableEXT			CmdSetColorBlendEnableEXT;
+	PFN_vkCmdSetColorWriteMaskEXT			CmdSetColorWriteMaskEXT;
+	PFN_vkCmdPushDescriptorSetKHR			CmdPushDescriptorSetKHR;
+	PFN_vkCmdPushDescriptorSetWithTemplateKHR	CmdPushDescriptorSetWithTemplateKHR;
+	PFN_vkCmdDrawMultiEXT					CmdDrawMultiEXT;
+	PFN_vkCmdDrawMultiIndexedEXT			CmdDrawMultiIndexedEXT;
+	PFN_vkCmdDrawIndirectCount				CmdDrawIndirectCount;
+	PFN_vkCmdDrawIndexedIndirectCount		CmdDrawIndexedIndirectCount;
+	PFN_vkCmdDrawMeshTasksEXT				CmdDrawMeshTasksEXT;
+	PFN_vkCmdDrawMeshTasksIndirectEXT		CmdDrawMeshTasksIndirectEXT;
+	PFN_vkCmdDrawMeshTasksIndirectCountEXT	CmdDrawMeshTasksIndirectCountEXT;
+} DeviceFunctions;
+
+extern DeviceFunctions deviceFunctions;
+
+// the device functions, features and limits are global, so the VM supports a single device at a
+// time: vmInit fails (returns 0) while another device is initialized, vmRelease ends its use.
+DllExport(int) vmInit(VkDevice device, uint32_t features);
+DllExport(void) vmRelease(VkDevice device);
+DllExport(void) vmSetMaxMultiDrawCount(uint32_t count);
+
 
 DllExport(void) vmBindDescriptorSets(VkCommandBuffer commandBuffer, DescriptorSetBinding* binding);
 DllExport(void) vmBindIndexBuffer(VkCommandBuffer commandBuffer, IndexBufferBinding* indexBuffer);
 DllExport(void) vmBindVertexBuffers(VkCommandBuffer commandBuffer, VertexBufferBinding* binding);
+DllExport(void) vmPushDescriptorSet(VkCommandBuffer commandBuffer, PushDescriptorSetBinding* binding);
 DllExport(void) vmDraw(VkCommandBuffer commandBuffer, RuntimeStats* stats, int* isActive, DrawCall* call);
+DllExport(void) vmDrawMeshTasks(VkCommandBuffer commandBuffer, RuntimeStats* stats, int* isActive, MeshTaskCall* call);
 